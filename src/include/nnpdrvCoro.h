@@ -0,0 +1,262 @@
+/*******************************************************************************
+ * INTEL CORPORATION CONFIDENTIAL Copyright(c) 2017-2020 Intel Corporation. All Rights Reserved.
+ *
+ * The source code contained or described herein and all documents related to the
+ * source code ("Material") are owned by Intel Corporation or its suppliers or
+ * licensors. Title to the Material remains with Intel Corporation or its suppliers
+ * and licensors. The Material contains trade secrets and proprietary and
+ * confidential information of Intel or its suppliers and licensors. The Material
+ * is protected by worldwide copyright and trade secret laws and treaty provisions.
+ * No part of the Material may be used, copied, reproduced, modified, published,
+ * uploaded, posted, transmitted, distributed, or disclosed in any way without
+ * Intel's prior express written permission.
+ *
+ * No license under any patent, copyright, trade secret or other intellectual
+ * property right is granted to or conferred upon you by disclosure or delivery of
+ * the Materials, either expressly, by implication, inducement, estoppel or
+ * otherwise. Any license under such intellectual property rights must be express
+ * and approved by Intel in writing.
+ ********************************************************************************/
+
+
+/**
+ * @brief Optional C++20 coroutine front-end for the inference interface.
+ * @file nnpdrvCoro.h
+ *
+ * Provides awaitables for command list schedule, copy schedule and
+ * command stream markers, usable from any C++20 coroutine type:
+ *
+ *     nnpdrv::CompletionResult r = co_await nnpdrv::scheduleCommandList(cmdlist);
+ *
+ * The coroutine is resumed from the completion callback of the
+ * operation. By default the callback runs on the driver callback
+ * workers (NNP_COMPLETION_CALLBACK_WORKER) so the code following the
+ * co_await never runs on the context response thread. Passing flags
+ * of zero resumes inline on the response thread, in which case the
+ * coroutine must not block until its next suspension point.
+ *
+ * A command list or copy handle must not be awaited by more than one
+ * coroutine at a time, and its completion callback is owned by the
+ * awaiter for the duration of the co_await.
+ *
+ * The header is empty when not compiled as C++20 or later.
+ */
+
+#pragma once
+
+#include "nnpdrvInference.h"
+
+#if defined(__cplusplus) && __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<coroutine>)
+
+#include <coroutine>
+
+namespace nnpdrv {
+
+/**
+ * @brief Result of an awaited operation
+ *
+ * error is the status of scheduling the operation, or of querying its
+ * final state. numErrors is the error count reported on completion,
+ * for command lists the error details can be retrieved with
+ * nnpdrvWaitCommandList.
+ */
+struct CompletionResult {
+	NNPError error;
+	uint32_t numErrors;
+};
+
+namespace detail {
+
+class AwaiterBase {
+public:
+	AwaiterBase(uint32_t flags) : m_flags(flags)
+	{
+		m_result.error = NNP_NO_ERROR;
+		m_result.numErrors = 0;
+	}
+
+	AwaiterBase(const AwaiterBase &) = delete;
+	AwaiterBase &operator=(const AwaiterBase &) = delete;
+
+	bool await_ready() const noexcept { return false; }
+
+protected:
+	static void onComplete(uint64_t handle, uint32_t numErrors, void *userData)
+	{
+		AwaiterBase *a = static_cast<AwaiterBase *>(userData);
+
+		(void)handle;
+		a->m_result.numErrors = numErrors;
+		a->m_coro.resume();
+	}
+
+	std::coroutine_handle<> m_coro;
+	CompletionResult        m_result;
+	uint32_t                m_flags;
+};
+
+} // namespace detail
+
+/**
+ * @brief Awaitable schedule of a command list
+ *
+ * Scheduling is done in await_suspend, the awaiter must be awaited
+ * exactly once.
+ */
+class CommandListAwaiter : public detail::AwaiterBase {
+public:
+	CommandListAwaiter(NNPCommandList cmdlist, uint32_t flags) :
+		AwaiterBase(flags),
+		m_cmdlist(cmdlist)
+	{
+	}
+
+	bool await_suspend(std::coroutine_handle<> coro)
+	{
+		NNPError rc;
+
+		m_coro = coro;
+		rc = nnpdrvCommandListSetCompletionCallback(m_cmdlist, onComplete, this, m_flags);
+		if (rc == NNP_NO_ERROR) {
+			/* may resume before returning, do not touch members after success */
+			rc = nnpdrvScheduleCommandList(m_cmdlist);
+			if (rc == NNP_NO_ERROR)
+				return true;
+			nnpdrvCommandListSetCompletionCallback(m_cmdlist, nullptr, nullptr, 0);
+		}
+
+		m_result.error = rc;
+		return false;
+	}
+
+	CompletionResult await_resume()
+	{
+		if (m_result.error == NNP_NO_ERROR)
+			nnpdrvCommandListSetCompletionCallback(m_cmdlist, nullptr, nullptr, 0);
+		return m_result;
+	}
+
+private:
+	NNPCommandList m_cmdlist;
+};
+
+/**
+ * @brief Awaitable copy schedule
+ */
+class CopyAwaiter : public detail::AwaiterBase {
+public:
+	CopyAwaiter(NNPCopyHandle copy, uint64_t byteSize, uint8_t priority, uint32_t flags) :
+		AwaiterBase(flags),
+		m_copy(copy),
+		m_byteSize(byteSize),
+		m_priority(priority)
+	{
+	}
+
+	bool await_suspend(std::coroutine_handle<> coro)
+	{
+		NNPError rc;
+
+		m_coro = coro;
+		rc = nnpdrvCopySetCompletionCallback(m_copy, onComplete, this, m_flags);
+		if (rc == NNP_NO_ERROR) {
+			/* may resume before returning, do not touch members after success */
+			rc = nnpdrvScheduleCopy(m_copy, m_byteSize, m_priority);
+			if (rc == NNP_NO_ERROR)
+				return true;
+			nnpdrvCopySetCompletionCallback(m_copy, nullptr, nullptr, 0);
+		}
+
+		m_result.error = rc;
+		return false;
+	}
+
+	CompletionResult await_resume()
+	{
+		if (m_result.error == NNP_NO_ERROR)
+			nnpdrvCopySetCompletionCallback(m_copy, nullptr, nullptr, 0);
+		return m_result;
+	}
+
+private:
+	NNPCopyHandle m_copy;
+	uint64_t      m_byteSize;
+	uint8_t       m_priority;
+};
+
+/**
+ * @brief Awaitable command stream marker
+ *
+ * On failure error holds the nnpdrvWaitForMarker status, either
+ * NNP_BROKEN_MARKER or NNP_CONTEXT_BROKEN.
+ */
+class MarkerAwaiter : public detail::AwaiterBase {
+public:
+	MarkerAwaiter(NNPInferContext ctx, NNPMarker marker, uint32_t flags) :
+		AwaiterBase(flags),
+		m_ctx(ctx),
+		m_marker(marker)
+	{
+	}
+
+	bool await_suspend(std::coroutine_handle<> coro)
+	{
+		NNPError rc;
+
+		m_coro = coro;
+		rc = nnpdrvInferContextNotifyMarker(m_ctx, m_marker, onComplete, this, m_flags);
+		if (rc == NNP_NO_ERROR)
+			return true;
+
+		m_result.error = rc;
+		return false;
+	}
+
+	CompletionResult await_resume()
+	{
+		/* the marker is done, this only fetches its final status */
+		if (m_result.error == NNP_NO_ERROR && m_result.numErrors != 0)
+			m_result.error = nnpdrvWaitForMarker(m_ctx, m_marker, 0);
+		return m_result;
+	}
+
+private:
+	NNPInferContext m_ctx;
+	NNPMarker       m_marker;
+};
+
+/**
+ * @brief Schedules a command list, resumes when the schedule completes
+ */
+inline CommandListAwaiter scheduleCommandList(NNPCommandList cmdlist,
+					      uint32_t       flags = NNP_COMPLETION_CALLBACK_WORKER)
+{
+	return CommandListAwaiter(cmdlist, flags);
+}
+
+/**
+ * @brief Schedules a copy, resumes when the copy completes
+ */
+inline CopyAwaiter scheduleCopy(NNPCopyHandle copy,
+				uint64_t      byteSize = 0,
+				uint8_t       priority = 0,
+				uint32_t      flags = NNP_COMPLETION_CALLBACK_WORKER)
+{
+	return CopyAwaiter(copy, byteSize, priority, flags);
+}
+
+/**
+ * @brief Resumes when all commands scheduled before the marker completed
+ */
+inline MarkerAwaiter waitMarker(NNPInferContext ctx,
+				NNPMarker       marker,
+				uint32_t        flags = NNP_COMPLETION_CALLBACK_WORKER)
+{
+	return MarkerAwaiter(ctx, marker, flags);
+}
+
+} // namespace nnpdrv
+
+#endif
+#endif
@@ -93,12 +93,37 @@ typedef uint64_t NNPCopyHandle;      /**< handle to a copy operation definition
 typedef uint64_t NNPDeviceNetwork;   /**< handle to a network resource   */
 typedef uint64_t NNPInferRequest;    /**< handle to an infer request     */
 typedef uint32_t NNPMarker;          /**< handle to host-to-card command stream marker */
+typedef uint64_t NNPCompletionQueue; /**< handle to a completion queue       */
+typedef uint64_t NNPSubmitQueue;     /**< handle to a context submit queue    */
+typedef uint64_t NNPPinnedHandle;    /**< pinned copy, command list or infer request handle */
+typedef uint64_t NNPCommandListTemplate; /**< handle to a command list template */
 
 /**
  * bit values for flags in nnpdrvCreateInferContextWithFlags
  */
 #define NNP_ULT_CONTEXT      (1 << 0)
 #define NNP_ULT_CONTEXT_LAST (1 << 1)
+#define NNP_PACKED_RINGBUF_CONTEXT (1 << 2) /**< command payloads (command lists, infer
+					     *   request and network creation) are
+					     *   packed as variable length records in
+					     *   the command ring buffers instead of
+					     *   using a full page each. Requires card
+					     *   support, context creation fails with
+					     *   NNP_NOT_SUPPORTED if the card does not
+					     *   acknowledge the packed layout.
+					     */
+#define NNP_CMDLIST_PIPELINE_CONTEXT (1 << 3) /**< allows command lists of the
+					       *   context to have more than one
+					       *   in-flight instance, see
+					       *   nnpdrvCommandListSetInstanceDepth.
+					       *   Requires card support.
+					       */
+#define NNP_CMDLIST_REBIND_CONTEXT (1 << 4) /**< allows the copies and infer
+					     *   requests of created command lists
+					     *   of the context to be replaced, see
+					     *   nnpdrvCommandListRebind.
+					     *   Requires card support.
+					     */
 
 /**
  * fix size struct for inference request config data
@@ -114,6 +139,148 @@ typedef struct {
 } nnpdrvinfSchedParams;
 
 
+/**
+ * @brief Inference context creation options
+ *
+ * Options structure for nnpdrvCreateInferContextWithOptions.
+ * Zero valued fields select the driver default.
+ * Ring buffer sizes must be a multiple of 4KB.
+ */
+typedef struct {
+	uint8_t  flags;              /**< context flags, as in nnpdrvCreateInferContextWithFlags */
+	uint32_t cmdRingSize;        /**< byte size of each command ring buffer (default 8KB) */
+	uint32_t respRingSize;       /**< byte size of the response ring buffer (default 8KB) */
+	uint32_t maxCmdRingSize;     /**< if larger than cmdRingSize, a command ring which
+				      *   repeatedly gets full is recreated with double
+				      *   size, up to this limit, once the device has
+				      *   drained it
+				      */
+	uint32_t cmdRingGrowStalls;  /**< number of ring-full stalls which trigger a
+				      *   command ring resize (default 16)
+				      */
+} NNPInferContextOptions;
+
+/**
+ * @brief Inference context ring buffers information
+ */
+typedef struct {
+	uint32_t createRingSize;     /**< current byte size of the create command ring */
+	uint32_t executeRingSize;    /**< current byte size of the execute command ring */
+	uint32_t responseRingSize;   /**< byte size of the response ring */
+	uint32_t numRingGrows;       /**< number of command ring resizes done */
+	uint64_t createRingStalls;   /**< number of times a writer waited for space
+				      *   in the create command ring
+				      */
+	uint64_t executeRingStalls;  /**< number of times a writer waited for space
+				      *   in the execute command ring
+				      */
+} NNPInferContextRingInfo;
+
+/**
+ * @brief Protocol ID allocator occupancy
+ */
+typedef struct {
+	uint32_t allocated;     /**< IDs currently allocated */
+	uint32_t maxAllocated;  /**< highest number of IDs allocated at once */
+	uint32_t capacity;      /**< total number of IDs */
+} NNPIdUsage;
+
+/**
+ * @brief Inference context protocol ID occupancy, per object type
+ */
+typedef struct {
+	NNPIdUsage deviceResources;
+	NNPIdUsage copies;
+	NNPIdUsage networks;
+	NNPIdUsage commandLists;
+} NNPInferContextIdUsage;
+
+/**
+ * @brief Completion wait policy
+ *
+ * Controls how a thread waits for a command list, marker or host
+ * resource lock to complete. The wait condition is first polled
+ * spinCount times on the cpu, then polled yieldCount times while
+ * yielding the cpu, and only then the thread blocks until completion.
+ * A zero policy always blocks, which is the default.
+ */
+typedef struct {
+	uint32_t spinCount;     /**< number of busy polls before yielding */
+	uint32_t yieldCount;    /**< number of polls with cpu yield before blocking */
+} NNPWaitPolicy;
+
+/**
+ * @brief Completion wait statistics
+ *
+ * Counts which phase of the wait policy resolved each wait.
+ */
+typedef struct {
+	uint64_t spinResolved;  /**< waits completed while spinning */
+	uint64_t yieldResolved; /**< waits completed while yielding */
+	uint64_t blockResolved; /**< waits completed after blocking */
+	uint64_t timedOut;      /**< waits which timed out */
+} NNPWaitStats;
+
+/**
+ * @brief Completion callback
+ *
+ * Invoked when a command list schedule or a copy scheduled with
+ * nnpdrvScheduleCopy completes.
+ *
+ * @param[in] handle      The completed command list or copy handle
+ * @param[in] numErrors   Number of errors detected during execution,
+ *                        zero on success
+ * @param[in] userData    User data given when the callback was set
+ */
+typedef void (*NNPCompletionCallback)(uint64_t  handle,
+				      uint32_t  numErrors,
+				      void     *userData);
+
+#define NNP_COMPLETION_CALLBACK_WORKER (1 << 0) /**< run the callback on the driver callback
+						 *   worker pool instead of inline on the
+						 *   response thread
+						 */
+
+/**
+ * @brief Completion queue entry types
+ */
+typedef enum {
+	NNP_COMPLETION_ENTRY_COMMAND_LIST = 0, /**< command list schedule completed */
+	NNP_COMPLETION_ENTRY_COPY         = 1, /**< copy scheduled with nnpdrvScheduleCopy completed */
+	NNP_COMPLETION_ENTRY_MARKER       = 2  /**< marker completed */
+} NNPCompletionEntryType;
+
+/**
+ * @brief Completion queue entry
+ */
+typedef struct {
+	uint32_t type;          /**< one of NNPCompletionEntryType */
+	uint32_t numErrors;     /**< number of errors, zero on success */
+	uint64_t handle;        /**< completed command list or copy handle, or marker */
+	uint64_t userData;      /**< user data given when the object was attached */
+} NNPCompletionEntry;
+
+#define NNP_SUBMIT_QUEUE_PRIORITY_NORMAL 0 /**< normal priority submit queue */
+#define NNP_SUBMIT_QUEUE_PRIORITY_HIGH   1 /**< high priority submit queue */
+#define NNP_SUBMIT_QUEUE_PRIORITY_MAX    3 /**< highest allowed submit queue priority */
+
+/**
+ * @brief Submit queue statistics
+ *
+ * A submission stalls when it waits for an earlier submission of the
+ * same queue, for the context execute ring to be granted or for free
+ * space in a command ring of the context. The command rings are shared
+ * by all queues of the context, so a queue also stalls on ring space
+ * taken by other queues.
+ */
+typedef struct {
+	uint64_t numSubmitted;  /**< submissions done through the queue */
+	uint64_t numStalls;     /**< submissions which stalled */
+	uint64_t stallTimeUs;   /**< total time submissions spent stalled */
+	uint32_t depth;         /**< submissions currently in the queue */
+	uint32_t maxDepth;      /**< highest depth seen */
+} NNPSubmitQueueStats;
+
 /**
  * @brief describes the reason for context critical error
  */
@@ -225,6 +392,31 @@ NNPError nnpdrvCreateInferContextWithFlags(uint32_t         deviceNum,
 NNPError nnpdrvCreateInferContext(uint32_t         deviceNum,
 				  NNPInferContext *outContext);
 
+/**
+ * @brief Creates an inference context with specific options
+ *
+ * Same as nnpdrvCreateInferContextWithFlags, but also allows to set
+ * the size of the context command and response ring buffers and to
+ * let the driver grow the command ring buffers when submissions
+ * repeatedly block on a full ring.
+ *
+ * @param[in]  deviceNum     NNP-I device number
+ * @param[in]  options       Context creation options
+ * @param[out] outContext    Created context handle
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_INVALID_ARGUMENT options or outContext is NULL or a ring
+ *                              size is not a multiple of 4KB
+ * @retval NNP_IO_ERROR         Internal driver error has occurred
+ * @retval NNP_NO_SUCH_DEVICE   The device number does not exist
+ * @retval NNP_DEVICE_NOT_READY The device state is not yet ready to accept
+ *                              inference contexts.
+ * @retval NNP_OUT_OF_MEMORY    System ran out of memory
+ */
+NNPError nnpdrvCreateInferContextWithOptions(uint32_t                      deviceNum,
+					     const NNPInferContextOptions *options,
+					     NNPInferContext              *outContext);
+
 /**
  * @brief Destroys an inference context
  *
@@ -276,6 +468,291 @@ NNPError nnpdrvRecoverInferContext(NNPInferContext ctx);
 NNPError nnpdrvQueryInferContextInfo(NNPInferContext 	  ctx,
                                      NNPInferContextInfo *outInferContextInfo);
 
+/**
+ * @brief Query infer context ring buffers information
+ *
+ * Returns the current size of the context ring buffers and the number
+ * of times submitting threads had to wait for free space in the
+ * command rings.
+ *
+ * @param[in]  ctx        Infer context handle
+ * @param[out] outInfo    Pointer to ring info to be filled
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_INVALID_ARGUMENT The outInfo parameter is NULL
+ * @retval NNP_NO_SUCH_CONTEXT  The infer context handle does not exist
+ */
+NNPError nnpdrvQueryInferContextRingInfo(NNPInferContext          ctx,
+					 NNPInferContextRingInfo *outInfo);
+
+/**
+ * @brief Query infer context protocol ID occupancy
+ *
+ * Every device resource, copy, network and command list of a context
+ * holds one protocol ID until its destruction completes on the device.
+ * Running out of IDs makes object creation fail.
+ *
+ * @param[in]  ctx        Infer context handle
+ * @param[out] outUsage   Pointer to ID usage to be filled
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_INVALID_ARGUMENT The outUsage parameter is NULL
+ * @retval NNP_NO_SUCH_CONTEXT  The infer context handle does not exist
+ */
+NNPError nnpdrvQueryInferContextIdUsage(NNPInferContext         ctx,
+					NNPInferContextIdUsage *outUsage);
+
+/**
+ * @brief Query infer request protocol ID occupancy of a device network
+ *
+ * @param[in]  net        Device network handle
+ * @param[out] outUsage   Pointer to ID usage to be filled
+ *
+ * @retval NNP_NO_ERROR              Success
+ * @retval NNP_INVALID_ARGUMENT      The outUsage parameter is NULL
+ * @retval NNP_NO_SUCH_NETWORK       The network handle does not exist
+ */
+NNPError nnpdrvQueryDeviceNetworkIdUsage(NNPDeviceNetwork  net,
+					 NNPIdUsage       *outUsage);
+
+/**
+ * @brief Creates a completion queue
+ *
+ * A completion queue collects completion entries of command lists,
+ * copies and markers from any inference context on any device.
+ * Objects are attached with nnpdrvCommandListSetCompletionQueue,
+ * nnpdrvCopySetCompletionQueue and nnpdrvCompletionQueueAddMarker,
+ * and completed entries are harvested with nnpdrvCompletionQueueWait.
+ *
+ * @param[out] outCq     Created completion queue handle
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_INVALID_ARGUMENT outCq is NULL
+ * @retval NNP_OUT_OF_MEMORY    System ran out of memory
+ */
+NNPError nnpdrvCreateCompletionQueue(NNPCompletionQueue *outCq);
+
+/**
+ * @brief Destroys a completion queue
+ *
+ * Threads waiting on the queue return, entries of objects still
+ * attached to the queue are dropped.
+ *
+ * @param[in] cq   Completion queue handle
+ *
+ * @retval NNP_NO_ERROR                  Success
+ * @retval NNP_NO_SUCH_COMPLETION_QUEUE  The cq handle does not exist
+ */
+NNPError nnpdrvDestroyCompletionQueue(NNPCompletionQueue cq);
+
+/**
+ * @brief Attaches a command list to a completion queue
+ *
+ * An entry is posted to the queue each time a schedule of the command
+ * list completes. A command list can be attached to a single queue,
+ * attaching replaces the previous queue, a zero cq detaches.
+ *
+ * @param[in] commandList   Command list handle
+ * @param[in] cq            Completion queue handle, or zero
+ * @param[in] userData      Value reported in the entries userData
+ *
+ * @retval NNP_NO_ERROR                  Success
+ * @retval NNP_NO_SUCH_CMDLIST           The commandList handle does not exist
+ * @retval NNP_NO_SUCH_COMPLETION_QUEUE  The cq handle does not exist
+ */
+NNPError nnpdrvCommandListSetCompletionQueue(NNPCommandList     commandList,
+					     NNPCompletionQueue cq,
+					     uint64_t           userData);
+
+/**
+ * @brief Attaches a copy handle to a completion queue
+ *
+ * An entry is posted to the queue each time a copy scheduled with
+ * nnpdrvScheduleCopy completes. Attaching replaces the previous
+ * queue, a zero cq detaches.
+ *
+ * @param[in] copyHandle    Copy handle
+ * @param[in] cq            Completion queue handle, or zero
+ * @param[in] userData      Value reported in the entries userData
+ *
+ * @retval NNP_NO_ERROR                  Success
+ * @retval NNP_NO_SUCH_COPY_HANDLE       The copy handle does not exist
+ * @retval NNP_NO_SUCH_COMPLETION_QUEUE  The cq handle does not exist
+ */
+NNPError nnpdrvCopySetCompletionQueue(NNPCopyHandle      copyHandle,
+				      NNPCompletionQueue cq,
+				      uint64_t           userData);
+
+/**
+ * @brief Requests a completion queue entry for a marker
+ *
+ * A single entry is posted to the queue when the marker completes.
+ * The entry numErrors is non zero if the marker failed or the context
+ * became broken.
+ *
+ * @param[in] cq         Completion queue handle
+ * @param[in] ctx        Inference context handle
+ * @param[in] marker     Marker returned by nnpdrvGetMarker
+ * @param[in] userData   Value reported in the entry userData
+ *
+ * @retval NNP_NO_ERROR                  Success
+ * @retval NNP_NO_SUCH_CONTEXT           The context handle does not exist
+ * @retval NNP_NO_SUCH_COMPLETION_QUEUE  The cq handle does not exist
+ * @retval NNP_IO_ERROR                  Internal driver error has occurred
+ */
+NNPError nnpdrvCompletionQueueAddMarker(NNPCompletionQueue cq,
+					NNPInferContext    ctx,
+					NNPMarker          marker,
+					uint64_t           userData);
+
+/**
+ * @brief Waits for and harvests completion queue entries
+ *
+ * Waits until at least minEntries entries are available, then returns
+ * up to maxEntries of them in completion order. A minEntries of one
+ * waits for any completion, a minEntries equal to the number of
+ * outstanding attached operations waits for all of them.
+ * On timeout the available entries, fewer than minEntries, are still
+ * returned.
+ *
+ * @param[in]  cq              Completion queue handle
+ * @param[out] entries         Array of maxEntries entries to be filled
+ * @param[in]  maxEntries      Maximum number of entries to harvest
+ * @param[in]  minEntries      Number of entries to wait for
+ * @param[in]  timeoutUs       Wait timeout in microseconds, UINT32_MAX
+ *                             waits without timeout
+ * @param[out] outNumEntries   Number of entries returned
+ *
+ * @retval NNP_NO_ERROR                  Success
+ * @retval NNP_INVALID_ARGUMENT          NULL pointer argument, zero maxEntries
+ *                                       or minEntries larger than maxEntries
+ * @retval NNP_NO_SUCH_COMPLETION_QUEUE  The cq handle does not exist or was
+ *                                       destroyed during the wait
+ * @retval NNP_TIMED_OUT                 Less than minEntries entries completed
+ *                                       before the timeout expired
+ * @retval NNP_IO_ERROR                  Pending batched operations of the
+ *                                       calling thread could not be sent
+ */
+NNPError nnpdrvCompletionQueueWait(NNPCompletionQueue  cq,
+				   NNPCompletionEntry *entries,
+				   uint32_t            maxEntries,
+				   uint32_t            minEntries,
+				   uint32_t            timeoutUs,
+				   uint32_t           *outNumEntries);
+
+/**
+ * @brief Creates a submit queue on an inference context
+ *
+ * A context may have several submit queues, each with its own priority.
+ * Submissions of a queue are sent to the device in order, without
+ * waiting for submissions in progress on other queues of the context.
+ * All queues of a context still share the context command channel, so
+ * their messages are serialized when written to the device, and an
+ * error which breaks the context fails the submissions of every queue.
+ * The queue priority is set in the priority field of scheduled copies
+ * and inference requests. Command list schedules carrying command
+ * overwrites are granted the context execute ring in queue priority
+ * order, so a high priority queue does not wait behind large uploads
+ * of lower priority queues.
+ *
+ * @param[in]  ctx        Inference context handle
+ * @param[in]  priority   Queue priority, NNP_SUBMIT_QUEUE_PRIORITY_*
+ * @param[out] outQueue   Created submit queue handle
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_INVALID_ARGUMENT outQueue is NULL or priority is out of range
+ * @retval NNP_NO_SUCH_CONTEXT  The context handle does not exist
+ * @retval NNP_OUT_OF_MEMORY    System ran out of memory
+ */
+NNPError nnpdrvCreateSubmitQueue(NNPInferContext  ctx,
+				 uint8_t          priority,
+				 NNPSubmitQueue  *outQueue);
+
+/**
+ * @brief Destroys a submit queue
+ *
+ * @param[in] queue   Submit queue handle
+ *
+ * @retval NNP_NO_ERROR              Success
+ * @retval NNP_NO_SUCH_SUBMIT_QUEUE  The queue handle does not exist
+ */
+NNPError nnpdrvDestroySubmitQueue(NNPSubmitQueue queue);
+
+/**
+ * @brief Schedules a copy through a submit queue
+ *
+ * Same as nnpdrvScheduleCopy with the queue priority.
+ *
+ * @param[in] queue      Submit queue handle
+ * @param[in] copyHandle Copy handle, must belong to the queue context
+ * @param[in] byteSize   bytes to copy, if zero, all resource is copied.
+ *
+ * @retval NNP_NO_ERROR              Success
+ * @retval NNP_NO_SUCH_SUBMIT_QUEUE  The queue handle does not exist
+ * @retval NNP_NO_SUCH_COPY_HANDLE   The copyHandle does not exist
+ * @retval NNP_INVALID_ARGUMENT      The copy belongs to a different context
+ *
+ * Other return values are as of nnpdrvScheduleCopy.
+ */
+NNPError nnpdrvSubmitQueueScheduleCopy(NNPSubmitQueue queue,
+				       NNPCopyHandle  copyHandle,
+				       uint64_t       byteSize);
+
+/**
+ * @brief Schedules an inference request through a submit queue
+ *
+ * Same as nnpdrvScheduleInferReq, the priority in schedParams is
+ * replaced with the queue priority.
+ *
+ * @param[in] queue        Submit queue handle
+ * @param[in] infReq       Inference request handle, must belong to the
+ *                         queue context
+ * @param[in] schedParams  Schedule parameters, may be NULL
+ *
+ * @retval NNP_NO_ERROR               Success
+ * @retval NNP_NO_SUCH_SUBMIT_QUEUE   The queue handle does not exist
+ * @retval NNP_NO_SUCH_INFREQ_HANDLE  The infReq handle does not exist
+ * @retval NNP_INVALID_ARGUMENT       The request belongs to a different context
+ *
+ * Other return values are as of nnpdrvScheduleInferReq.
+ */
+NNPError nnpdrvSubmitQueueScheduleInferReq(NNPSubmitQueue              queue,
+					   NNPInferRequest             infReq,
+					   const nnpdrvinfSchedParams *schedParams);
+
+/**
+ * @brief Schedules a command list through a submit queue
+ *
+ * Same as nnpdrvScheduleCommandList with the execute ring granted in
+ * queue priority order.
+ *
+ * @param[in] queue        Submit queue handle
+ * @param[in] commandList  Command list handle, must belong to the
+ *                         queue context
+ *
+ * @retval NNP_NO_ERROR              Success
+ * @retval NNP_NO_SUCH_SUBMIT_QUEUE  The queue handle does not exist
+ * @retval NNP_NO_SUCH_CMDLIST       The commandList handle does not exist
+ * @retval NNP_INVALID_ARGUMENT      The command list belongs to a different context
+ *
+ * Other return values are as of nnpdrvScheduleCommandList.
+ */
+NNPError nnpdrvSubmitQueueScheduleCommandList(NNPSubmitQueue queue,
+					      NNPCommandList commandList);
+
+/**
+ * @brief Queries submit queue depth and stall statistics
+ *
+ * @param[in]  queue      Submit queue handle
+ * @param[out] outStats   Returns the queue statistics
+ *
+ * @retval NNP_NO_ERROR              Success
+ * @retval NNP_INVALID_ARGUMENT      outStats is NULL
+ * @retval NNP_NO_SUCH_SUBMIT_QUEUE  The queue handle does not exist
+ */
+NNPError nnpdrvQuerySubmitQueueStats(NNPSubmitQueue       queue,
+				     NNPSubmitQueueStats *outStats);
+
 /**
  * @brief Write 64 bit value to device's SW trace.
  *
@@ -440,6 +917,8 @@ NNPError nnpdrvGetHostResourceDmaBufFD(NNPHostResource hostRes, int *outFD);
  *                              not yet complete.
  * @retval NNP_CONTEXT_BROKEN   Copy from/to this resource has failed.
  * @retval NNP_NOT_SUPPORTED    hostRes has attribute "lockless".
+ * @retval NNP_IO_ERROR         Pending batched operations of the calling
+ *                              thread could not be sent.
  */
 NNPError nnpdrvLockHostResource(NNPHostResource hostRes,
 				uint32_t        timeoutUs);
@@ -459,6 +938,41 @@ NNPError nnpdrvLockHostResource(NNPHostResource hostRes,
  */
 NNPError nnpdrvUnlockHostResource(NNPHostResource hostRes);
 
+/**
+ * @brief Query host resource lock wait statistics
+ *
+ * Returns process wide counters of nnpdrvLockHostResource waits,
+ * by the wait policy phase which resolved them.
+ *
+ * @param[out] outStats   Pointer to wait statistics to be filled
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_INVALID_ARGUMENT outStats is NULL
+ */
+NNPError nnpdrvQueryHostResourceWaitStats(NNPWaitStats *outStats);
+
+/**
+ * @brief Returns an eventfd signalled when device access to a host resource ends
+ *
+ * The returned file descriptor is a non-blocking eventfd which is
+ * signalled each time a device copy operation referencing the host
+ * resource completes. After it becomes readable, read it to reset the
+ * counter and call nnpdrvLockHostResource with zero timeout.
+ * The file descriptor is owned by the host resource and is closed when
+ * the host resource is destroyed, the caller must not close it.
+ *
+ * @param[in]  hostRes   Host resource handle
+ * @param[out] outFd     Returns the eventfd
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_INVALID_ARGUMENT outFd is NULL
+ * @retval NNP_NO_SUCH_RESOURCE hostRes is not a host resource handle
+ * @retval NNP_NOT_SUPPORTED    hostRes has attribute "lockless".
+ * @retval NNP_IO_ERROR         Failed to create the eventfd
+ */
+NNPError nnpdrvHostResourceGetEventFd(NNPHostResource hostRes,
+				      int            *outFd);
+
 NNPError nnpdrvGetCopyContext(NNPCopyHandle    copyHandle,
 							  NNPInferContext *outCtx);
 NNPError nnpdrvGetInferReqContext(NNPInferRequest  infReq,
@@ -502,6 +1016,99 @@ NNPError nnpdrvCreateCommandListBegin(NNPInferContext  ctx,
  */
 NNPError nnpdrvCreateCommandListEnd(NNPCommandList commandList);
 
+/**
+ * @brief Ends creation of a command list without waiting for the device
+ *
+ * Same as nnpdrvCreateCommandListEnd but returns once the list is sent
+ * to the device. The create status is returned by
+ * nnpdrvWaitCommandListCreated. Until the device replies, only
+ * schedules of the copies and infer requests appended to the list, or
+ * of command lists containing them, wait for the creation. Other
+ * schedules on the context proceed.
+ *
+ * The command list cannot be scheduled before its creation completed,
+ * nnpdrvScheduleCommandList returns NNP_DEVICE_BUSY meanwhile.
+ *
+ * @param[in] commandList       Command list handle to end creation
+ *
+ * @retval NNP_NO_ERROR         The list was sent to the device
+ * @retval NNP_NO_SUCH_CMDLIST  The commandList handle does not exist
+ * @retval NNP_DEVICE_BUSY      Creation of the list was already ended
+ * @retval NNP_IO_ERROR         Internal driver error has occurred
+ * @retval NNP_CONTEXT_BROKEN   Context is in broken state and must be either
+ *                              recovered using nnpdrvRecoverInferContext or
+ *                              destroyed.
+ */
+NNPError nnpdrvCreateCommandListEndAsync(NNPCommandList commandList);
+
+/**
+ * @brief Waits for creation of a command list to complete
+ *
+ * Returns the create status of a list ended with
+ * nnpdrvCreateCommandListEndAsync. Zero timeoutUs polls the status.
+ *
+ * @param[in] commandList       Command list handle
+ * @param[in] timeoutUs         Timeout in microseconds, UINT32_MAX waits forever
+ *
+ * @retval NNP_NO_ERROR         The command list is created
+ * @retval NNP_NO_SUCH_CMDLIST  The commandList handle does not exist
+ * @retval NNP_TIMED_OUT        The device did not reply yet
+ * @retval NNP_INVALID_ARGUMENT Creation of the list was not ended
+ * Other return values are the create failure status, as of
+ * nnpdrvCreateCommandListEnd.
+ */
+NNPError nnpdrvWaitCommandListCreated(NNPCommandList commandList,
+				      uint32_t       timeoutUs);
+
+/**
+ * @brief Starts capturing the schedules of a context into a command list
+ *
+ * Creates a command list and sets the context in capture mode. Until
+ * nnpdrvInferContextEndCapture is called, schedules of copies, infer
+ * requests and command lists of the context made by the calling thread,
+ * including through pinned handles, are appended to the command list in
+ * call order instead of being sent to the device, and return
+ * NNP_NO_ERROR. A scheduled command list is appended command by command.
+ * Schedules made by other threads, including submit queue workers, are
+ * not captured and are sent to the device as usual.
+ * While capturing, nnpdrvGetMarker and schedules of sub-resource copies
+ * on the calling thread return NNP_NOT_SUPPORTED.
+ *
+ * @param[in]  ctx               Inference context handle
+ * @param[out] outCommandList    Returns the capture command list handle
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_NO_SUCH_CONTEXT  The context handle does not exist
+ * @retval NNP_INVALID_ARGUMENT outCommandList is NULL
+ * @retval NNP_DEVICE_BUSY      The context is already capturing
+ * @retval NNP_OUT_OF_MEMORY    System ran out of memory
+ * @retval NNP_CONTEXT_BROKEN   Context is in broken state
+ */
+NNPError nnpdrvInferContextBeginCapture(NNPInferContext  ctx,
+					NNPCommandList  *outCommandList);
+
+/**
+ * @brief Ends capture mode of a context and creates the command list
+ *
+ * Leaves capture mode and ends creation of the capture command list,
+ * as of nnpdrvCreateCommandListEnd. The list is then scheduled with
+ * nnpdrvScheduleCommandList. If creation fails the list remains and
+ * should be destroyed with nnpdrvDestroyCommandList.
+ *
+ * @param[in]  ctx               Inference context handle
+ * @param[out] outCommandList    Returns the capture command list handle
+ *                               (may be NULL)
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_NO_SUCH_CONTEXT  The context handle does not exist
+ * @retval NNP_INVALID_ARGUMENT The context is not capturing, or the capture
+ *                              was begun by another thread
+ * @retval NNP_NOT_SUPPORTED    Nothing was captured
+ * Other return values are as of nnpdrvCreateCommandListEnd.
+ */
+NNPError nnpdrvInferContextEndCapture(NNPInferContext  ctx,
+				      NNPCommandList  *outCommandList);
+
 /**
  * @brief Appends an infer command handle into a command list object.
  *
@@ -549,6 +1156,92 @@ NNPError nnpdrvCommandListAppendInferRequest(NNPCommandList        commandList,
  */
 NNPError nnpdrvDestroyCommandList(NNPCommandList commandList);
 
+/**
+ * @brief Records a command list as a template
+ *
+ * The template holds the commands appended to the command list, in
+ * append order, with their schedule parameters. Command lists with the
+ * same structure are then created from the template by
+ * nnpdrvInstantiateCommandListTemplate. The command list may be
+ * destroyed after the template is created, the copies and infer
+ * requests it references must exist as long as the template does.
+ *
+ * @param[in]  commandList  Command list handle, finalized or not
+ * @param[out] outTemplate  Returns the template handle
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_INVALID_ARGUMENT outTemplate is NULL or the command list is empty
+ * @retval NNP_NO_SUCH_CMDLIST  The commandList handle does not exist
+ * @retval NNP_OUT_OF_MEMORY    System ran out of memory
+ */
+NNPError nnpdrvCreateCommandListTemplate(NNPCommandList          commandList,
+					 NNPCommandListTemplate *outTemplate);
+
+/**
+ * @brief Returns the number of commands recorded in a template
+ *
+ * Each recorded copy or infer request counts as one command, this is
+ * the row length of the substitution table of
+ * nnpdrvInstantiateCommandListTemplate.
+ *
+ * @param[in]  tmpl            Command list template handle
+ * @param[out] outNumCommands  Returns the number of commands
+ *
+ * @retval NNP_NO_ERROR                  Success
+ * @retval NNP_INVALID_ARGUMENT          outNumCommands is NULL
+ * @retval NNP_NO_SUCH_CMDLIST_TEMPLATE  The template handle does not exist
+ */
+NNPError nnpdrvQueryCommandListTemplate(NNPCommandListTemplate tmpl,
+					uint32_t              *outNumCommands);
+
+/**
+ * @brief Creates command lists from a template
+ *
+ * Creates numLists command lists with the recorded commands and
+ * finalizes them on the device. All create requests are sent before
+ * the device replies are waited for, so the cost of a device round
+ * trip is paid once for the whole batch.
+ *
+ * substHandles is either NULL, in which case all lists reference the
+ * recorded objects, or a table of numLists rows of numCommands handles.
+ * Entry j of row i replaces the copy or infer request of recorded
+ * command j in list i, zero keeps the recorded object. Copy byte sizes
+ * are the recorded ones and are truncated to the substituted copy size.
+ *
+ * On failure no command list is left created.
+ *
+ * @param[in]  tmpl             Command list template handle
+ * @param[in]  numLists         Number of command lists to create
+ * @param[in]  substHandles     Substitution table (may be NULL)
+ * @param[out] outCommandLists  Array of numLists created handles
+ *
+ * @retval NNP_NO_ERROR                  Success
+ * @retval NNP_INVALID_ARGUMENT          numLists is zero, outCommandLists is NULL
+ *                                       or a substituted object belongs to
+ *                                       another context
+ * @retval NNP_NO_SUCH_CMDLIST_TEMPLATE  The template handle does not exist
+ * @retval NNP_NO_SUCH_COPY_HANDLE       A copy substitution does not exist
+ * @retval NNP_NO_SUCH_INFREQ_HANDLE     An infer request substitution does not exist
+ * @retval NNP_OUT_OF_MEMORY             System ran out of memory
+ * Other return values are as of nnpdrvCreateCommandListEnd.
+ */
+NNPError nnpdrvInstantiateCommandListTemplate(NNPCommandListTemplate tmpl,
+					      uint32_t               numLists,
+					      const uint64_t        *substHandles,
+					      NNPCommandList        *outCommandLists);
+
+/**
+ * @brief Destroys a command list template
+ *
+ * Command lists created from the template are not affected.
+ *
+ * @param[in] tmpl  Command list template handle
+ *
+ * @retval NNP_NO_ERROR                  Success
+ * @retval NNP_NO_SUCH_CMDLIST_TEMPLATE  The template handle does not exist
+ */
+NNPError nnpdrvDestroyCommandListTemplate(NNPCommandListTemplate tmpl);
+
 /**
  * @brief Overwrites copy command parameters for next schedule.
  *
@@ -563,7 +1256,8 @@ NNPError nnpdrvDestroyCommandList(NNPCommandList commandList);
  * @retval NNP_IO_ERROR         Internal driver error has occurred
  * @retval NNP_NO_SUCH_CMDLIST  The commandList handle does not exist
  * @retval NNP_NO_SUCH_COPY_HANDLE  The command at given index is not copy
- * @retval NNP_INVALID_ARGUMENT copy_idx is out of range
+ * @retval NNP_INVALID_ARGUMENT copy_idx is out of range or the copy was
+ *                              dropped as redundant when the list was created
  */
 NNPError nnpdrvCommandListOverwriteCopy(NNPCommandList        commandList,
 					uint16_t              copy_idx,
@@ -589,6 +1283,92 @@ NNPError nnpdrvCommandListOverwriteInferRequest(NNPCommandList        commandLis
 						uint16_t              infreq_idx,
 						nnpdrvinfSchedParams *schedParams);
 
+/**
+ * @brief One command edit of nnpdrvCommandListOverwrite
+ */
+typedef struct {
+	uint16_t              index;        /**< command index, as for the overwrite calls */
+	uint8_t               isInferReq;   /**< zero to edit a copy, else an infer request */
+	uint8_t               priority;     /**< copy priority */
+	uint32_t              flags;        /**< copy flags, bitmask from NNPScheduleFlags */
+	uint64_t              byteSize;     /**< copy size, zero copies the whole resource */
+	nnpdrvinfSchedParams *schedParams;  /**< infer request params (may be NULL) */
+} NNPCommandListEdit;
+
+/**
+ * @brief Overwrites several commands of a command list at once
+ *
+ * Applies each edit as nnpdrvCommandListOverwriteCopy or
+ * nnpdrvCommandListOverwriteInferRequest would. The edits are validated
+ * first and applied together under one lock of the command list, so
+ * either all are applied or none is and a concurrent schedule sees
+ * either none or all of them.
+ *
+ * @param[in] commandList       Command list handle
+ * @param[in] numEdits          Number of entries in edits
+ * @param[in] edits             Array of edits
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_NO_SUCH_CMDLIST  The commandList handle does not exist
+ * @retval NNP_INVALID_ARGUMENT edits is NULL while numEdits is not zero, or
+ *                              an index is out of range
+ * @retval NNP_NO_SUCH_COPY_HANDLE    A copy edit index is not a copy
+ * @retval NNP_NO_SUCH_INFREQ_HANDLE  An infer request edit index is not
+ *                                    an infer request
+ */
+NNPError nnpdrvCommandListOverwrite(NNPCommandList            commandList,
+				    uint32_t                  numEdits,
+				    const NNPCommandListEdit *edits);
+
+/**
+ * @brief One command rebinding of nnpdrvCommandListRebind
+ */
+typedef struct {
+	uint16_t index;   /**< command index, as for the overwrite calls */
+	uint64_t handle;  /**< NNPCopyHandle for a copy command, NNPInferRequest
+			   *   for an infer request command
+			   */
+} NNPCommandListBinding;
+
+/**
+ * @brief Replaces the copies or infer requests of created commands
+ *
+ * Binds commands of a created command list to other copies or infer
+ * requests, so one command list may serve several buffer sets. The new
+ * bindings are sent with the next schedule and stay in effect until
+ * rebound again.
+ * A copy may be replaced by a copy of the same context, direction and
+ * sizes. An infer request may be replaced by a request of the same
+ * network whose inputs and outputs have the same sizes.
+ * If the commands were reordered when the list was created, a rebound
+ * command must not access a resource written by, or write a resource
+ * accessed by, a command it was reordered with.
+ * Either all bindings are applied or none is.
+ *
+ * @param[in] commandList       Command list handle
+ * @param[in] numBindings       Number of entries in bindings
+ * @param[in] bindings          Array of bindings
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_NO_SUCH_CMDLIST  The commandList handle does not exist
+ * @retval NNP_INVALID_ARGUMENT bindings is NULL while numBindings is not
+ *                              zero, an index is out of range, a shape
+ *                              does not match or the command order
+ *                              does not hold with the new resources
+ * @retval NNP_NO_SUCH_COPY_HANDLE    A copy handle does not exist
+ * @retval NNP_NO_SUCH_INFREQ_HANDLE  An infer request handle does not exist
+ * @retval NNP_DEVICE_BUSY      The list is not created, has in-flight
+ *                              instances or a new copy or infer request
+ *                              is used by a command list being created
+ * @retval NNP_NOT_SUPPORTED    Redundant copies were dropped from the list,
+ *                              the context was not created with
+ *                              NNP_CMDLIST_REBIND_CONTEXT or the card does
+ *                              not support rebinding
+ */
+NNPError nnpdrvCommandListRebind(NNPCommandList               commandList,
+				 uint32_t                     numBindings,
+				 const NNPCommandListBinding *bindings);
+
 /**
  * @brief Schedule of a command list
  *
@@ -599,6 +1379,10 @@ NNPError nnpdrvCommandListOverwriteInferRequest(NNPCommandList        commandLis
  *
  * @retval NNP_NO_ERROR         Success
  * @retval NNP_NO_SUCH_CMDLIST  The commandList handle does not exist
+ * @retval NNP_DEVICE_BUSY      The command list is not finalized, has
+ *                              unhandled errors or all its instances
+ *                              are in flight (see
+ *                              nnpdrvCommandListSetInstanceDepth)
  * @retval NNP_IO_ERROR         Internal driver error has occurred
  * @retval NNP_OUT_OF_MEMORY    System ran out of memory
  * @retval NNP_CONTEXT_BROKEN   Context is in broken state and must be either
@@ -607,6 +1391,21 @@ NNPError nnpdrvCommandListOverwriteInferRequest(NNPCommandList        commandLis
  */
 NNPError nnpdrvScheduleCommandList(NNPCommandList commandList);
 
+/**
+ * @brief Schedules a command list through a pinned handle
+ *
+ * Same as nnpdrvScheduleCommandList, see nnpdrvPinCommandList.
+ *
+ * @param[in]  pinned    Pinned command list handle
+ *
+ * @retval NNP_INVALID_ARGUMENT  The pinned handle is not a pinned command list
+ * @retval NNP_NO_SUCH_CMDLIST   The pinned command list was destroyed, only
+ *                               detected in debug builds
+ *
+ * Other return values are as of nnpdrvScheduleCommandList.
+ */
+NNPError nnpdrvPinnedScheduleCommandList(NNPPinnedHandle pinned);
+
 /**
  * @brief Wait for command list to complete
  *
@@ -638,6 +1437,137 @@ NNPError nnpdrvWaitCommandList(NNPCommandList commandList,
 			       NNPCriticalErrorInfo *errors,
 			       uint32_t *numErrors);
 
+/**
+ * @brief Sets the number of in-flight instances of a command list
+ *
+ * By default a command list may be scheduled again only after its
+ * previous schedule has completed, further schedules return
+ * NNP_DEVICE_BUSY meanwhile. This function allows up to depth schedules
+ * of the command list to be in flight at once. Each schedule is an
+ * instance, numbered by schedule order starting from one, and instances
+ * complete in that order.
+ * All instances share the command list error state, a failed instance
+ * blocks further schedules until the errors are cleared.
+ *
+ * @param[in] commandList       Command list handle
+ * @param[in] depth             Maximum number of in-flight instances
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_NO_SUCH_CMDLIST  The commandList handle does not exist
+ * @retval NNP_INVALID_ARGUMENT depth is zero
+ * @retval NNP_NOT_SUPPORTED    depth is larger than one and the context
+ *                              was not created with
+ *                              NNP_CMDLIST_PIPELINE_CONTEXT or the card does
+ *                              not support queued schedules of a command
+ *                              list
+ */
+NNPError nnpdrvCommandListSetInstanceDepth(NNPCommandList commandList,
+					   uint32_t       depth);
+
+/**
+ * @brief Schedules a command list and returns the scheduled instance
+ *
+ * Same as nnpdrvScheduleCommandList, returns the instance number which
+ * may be passed to nnpdrvWaitCommandListInstance.
+ *
+ * @param[in]  commandList      Command list handle to schedule
+ * @param[out] outInstance      Returns the scheduled instance (may be NULL)
+ *
+ * @retval NNP_DEVICE_BUSY      The instance depth of the command list
+ *                              is exhausted
+ *
+ * Other return values are as of nnpdrvScheduleCommandList.
+ */
+NNPError nnpdrvScheduleCommandListInstance(NNPCommandList commandList,
+					   uint64_t      *outInstance);
+
+/**
+ * @brief Wait for a command list instance to complete
+ *
+ * Same as nnpdrvWaitCommandList but waits only until the given instance,
+ * and the instances scheduled before it, have completed. An instance of
+ * zero waits for all scheduled instances.
+ *
+ * @param[in] commandList       Command list handle
+ * @param[in] instance          Instance returned by
+ *                              nnpdrvScheduleCommandListInstance
+ * @param[in] timeoutUs         Timeout in micro seconds
+ * @param[out] errors           Array of critical errors information
+ * @param[in/out] numErrors     As of nnpdrvWaitCommandList
+ *
+ * @retval NNP_INVALID_ARGUMENT The instance was not scheduled
+ *
+ * Other return values are as of nnpdrvWaitCommandList.
+ */
+NNPError nnpdrvWaitCommandListInstance(NNPCommandList        commandList,
+				       uint64_t              instance,
+				       uint32_t              timeoutUs,
+				       NNPCriticalErrorInfo *errors,
+				       uint32_t             *numErrors);
+
+/**
+ * @brief Queries the instance counters of a command list
+ *
+ * An instance is in flight while it was scheduled but not completed,
+ * the number of in-flight instances is outScheduled - outCompleted.
+ *
+ * @param[in]  commandList      Command list handle
+ * @param[out] outScheduled     Number of instances scheduled (may be NULL)
+ * @param[out] outCompleted     Number of instances completed (may be NULL)
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_NO_SUCH_CMDLIST  The commandList handle does not exist
+ */
+NNPError nnpdrvQueryCommandListInstances(NNPCommandList commandList,
+					 uint64_t      *outScheduled,
+					 uint64_t      *outCompleted);
+
+/**
+ * @brief Returns an eventfd signalled when a command list schedule completes
+ *
+ * The returned file descriptor is a non-blocking eventfd which is
+ * signalled each time a schedule of the command list completes,
+ * successfully or not. After it becomes readable, read it to reset the
+ * counter and call nnpdrvWaitCommandList with zero timeout to retrieve
+ * the completion status.
+ * The file descriptor is owned by the command list and is closed when
+ * the command list is destroyed, the caller must not close it.
+ *
+ * @param[in]  commandList   Command list handle
+ * @param[out] outFd         Returns the eventfd
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_INVALID_ARGUMENT outFd is NULL
+ * @retval NNP_NO_SUCH_CMDLIST  The commandList handle does not exist
+ * @retval NNP_IO_ERROR         Failed to create the eventfd
+ */
+NNPError nnpdrvCommandListGetEventFd(NNPCommandList commandList,
+				     int           *outFd);
+
+/**
+ * @brief Sets a completion callback for a command list
+ *
+ * The callback is called each time a schedule of the command list
+ * completes, with the command list handle and the number of errors.
+ * By default the callback runs inline on the context response thread
+ * and must not block or wait for other device operations of the
+ * context. With NNP_COMPLETION_CALLBACK_WORKER it runs on a bounded
+ * driver worker pool instead (size set by NNPI_CALLBACK_WORKERS env
+ * variable), falling back to inline when the pool queue is full.
+ *
+ * @param[in] commandList   Command list handle
+ * @param[in] callback      Completion callback, NULL removes the callback
+ * @param[in] userData      User data passed to the callback
+ * @param[in] flags         Bitmask of NNP_COMPLETION_CALLBACK_* flags
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_NO_SUCH_CMDLIST  The commandList handle does not exist
+ */
+NNPError nnpdrvCommandListSetCompletionCallback(NNPCommandList        commandList,
+						NNPCompletionCallback callback,
+						void                 *userData,
+						uint32_t              flags);
+
 /**
  * @brief Retrives error message buffer of critical error state in command list
  *
@@ -1213,6 +2143,24 @@ NNPError nnpdrvDestroyInferRequest(NNPInferRequest inferReq);
 NNPError nnpdrvScheduleInferReq(NNPInferRequest infReq,
 				nnpdrvinfSchedParams *schedParams);
 
+/**
+ * @brief Schedules an inference request through a pinned handle
+ *
+ * Same as nnpdrvScheduleInferReq, see nnpdrvPinInferRequest.
+ *
+ * @param[in]  pinned        Pinned inference request handle
+ * @param[in]  schedParams   Schedule parameters, may be NULL
+ *
+ * @retval NNP_INVALID_ARGUMENT       The pinned handle is not a pinned
+ *                                    inference request
+ * @retval NNP_NO_SUCH_INFREQ_HANDLE  The pinned request was destroyed, only
+ *                                    detected in debug builds
+ *
+ * Other return values are as of nnpdrvScheduleInferReq.
+ */
+NNPError nnpdrvPinnedScheduleInferReq(NNPPinnedHandle       pinned,
+				      nnpdrvinfSchedParams *schedParams);
+
 /**
  * @brief Schedule a copy operation for execution
  *
@@ -1236,6 +2184,163 @@ NNPError nnpdrvScheduleInferReq(NNPInferRequest infReq,
  */
 NNPError nnpdrvScheduleCopy(NNPCopyHandle copyHandle, uint64_t byteSize, uint8_t priority);
 
+/**
+ * @brief Pins a copy handle for fast path scheduling
+ *
+ * Resolves the copy handle once and returns a pinned handle which
+ * refers to the copy object directly. Scheduling through a pinned
+ * handle skips the handle lookup and the reference counting of
+ * nnpdrvScheduleCopy. The application must keep the copy handle alive
+ * and stop using the pinned handle before calling nnpdrvUnpinHandle,
+ * which must be called before the copy is destroyed. Pinned handles are
+ * only validated in debug builds.
+ *
+ * @param[in]  copyHandle   Copy handle
+ * @param[out] outPinned    Returns the pinned handle
+ *
+ * @retval NNP_NO_ERROR             Success
+ * @retval NNP_INVALID_ARGUMENT     outPinned is NULL
+ * @retval NNP_NO_SUCH_COPY_HANDLE  The copyHandle does not exist
+ * @retval NNP_OUT_OF_MEMORY        System ran out of memory
+ */
+NNPError nnpdrvPinCopy(NNPCopyHandle    copyHandle,
+		       NNPPinnedHandle *outPinned);
+
+/**
+ * @brief Pins a command list handle for fast path scheduling
+ *
+ * See nnpdrvPinCopy.
+ *
+ * @param[in]  commandList  Command list handle
+ * @param[out] outPinned    Returns the pinned handle
+ *
+ * @retval NNP_NO_ERROR          Success
+ * @retval NNP_INVALID_ARGUMENT  outPinned is NULL
+ * @retval NNP_NO_SUCH_CMDLIST   The commandList handle does not exist
+ * @retval NNP_OUT_OF_MEMORY     System ran out of memory
+ */
+NNPError nnpdrvPinCommandList(NNPCommandList   commandList,
+			      NNPPinnedHandle *outPinned);
+
+/**
+ * @brief Pins an inference request handle for fast path scheduling
+ *
+ * See nnpdrvPinCopy.
+ *
+ * @param[in]  infReq       Inference request handle
+ * @param[out] outPinned    Returns the pinned handle
+ *
+ * @retval NNP_NO_ERROR               Success
+ * @retval NNP_INVALID_ARGUMENT       outPinned is NULL
+ * @retval NNP_NO_SUCH_INFREQ_HANDLE  The infReq handle does not exist
+ * @retval NNP_OUT_OF_MEMORY          System ran out of memory
+ */
+NNPError nnpdrvPinInferRequest(NNPInferRequest  infReq,
+			       NNPPinnedHandle *outPinned);
+
+/**
+ * @brief Releases a pinned handle
+ *
+ * @param[in] pinned   Pinned handle returned by one of the nnpdrvPin* functions
+ *
+ * @retval NNP_NO_ERROR          Success
+ * @retval NNP_INVALID_ARGUMENT  pinned is NULL, or in debug builds, is not
+ *                               a live pinned handle
+ */
+NNPError nnpdrvUnpinHandle(NNPPinnedHandle pinned);
+
+/**
+ * @brief Schedules a copy through a pinned handle
+ *
+ * Same as nnpdrvScheduleCopy.
+ *
+ * @param[in]  pinned    Pinned copy handle
+ * @param[in]  byteSize  bytes to copy, if zero, all resource is copied.
+ * @param[in]  priority  set priority for copy op: 1 for hight , 0 for normal
+ *
+ * @retval NNP_INVALID_ARGUMENT     The pinned handle is not a pinned copy
+ * @retval NNP_NO_SUCH_COPY_HANDLE  The pinned copy was destroyed, only
+ *                                  detected in debug builds
+ *
+ * Other return values are as of nnpdrvScheduleCopy.
+ */
+NNPError nnpdrvPinnedScheduleCopy(NNPPinnedHandle pinned,
+				  uint64_t        byteSize,
+				  uint8_t         priority);
+
+/**
+ * @brief Sets a completion callback for a copy handle
+ *
+ * The callback is called each time a copy scheduled with
+ * nnpdrvScheduleCopy completes, with the copy handle and the number
+ * of errors (one if the copy failed). It is not called for copies
+ * executed as part of a command list.
+ * See nnpdrvCommandListSetCompletionCallback for callback context.
+ *
+ * @param[in] copyHandle    Copy handle
+ * @param[in] callback      Completion callback, NULL removes the callback
+ * @param[in] userData      User data passed to the callback
+ * @param[in] flags         Bitmask of NNP_COMPLETION_CALLBACK_* flags
+ *
+ * @retval NNP_NO_ERROR             Success
+ * @retval NNP_NO_SUCH_COPY_HANDLE  The copy handle does not exist
+ */
+NNPError nnpdrvCopySetCompletionCallback(NNPCopyHandle         copyHandle,
+					 NNPCompletionCallback callback,
+					 void                 *userData,
+					 uint32_t              flags);
+
+/**
+ * @brief Starts a submission batch on the calling thread.
+ *
+ * After this call, schedule operations issued by the calling thread on the
+ * given context (nnpdrvScheduleCopy, nnpdrvScheduleInferReq,
+ * nnpdrvScheduleCommandList, ...) are not sent to the device immediately
+ * but accumulated in a per-thread buffer. The buffer is sent to the device,
+ * in submission order and with a single system call, when
+ * nnpdrvSubmitBatch is called, when the buffer gets full or when
+ * nnpdrvGetMarker is called on the context.
+ * Operations which wait for a device reply (object creation, destruction,
+ * waits) first send any pending batched operations.
+ * A thread may have only one open batch at a time, starting a batch on
+ * another context submits the currently open batch.
+ * If batched operations cannot be sent to the device, the context
+ * becomes broken, so waits for these operations return an error.
+ *
+ * @param[in]  ctx               Inference context handle
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_NO_SUCH_CONTEXT  The context handle does not exist
+ * @retval NNP_IO_ERROR         Internal driver error has occurred
+ * @retval NNP_OUT_OF_MEMORY    System ran out of memory
+ * @retval NNP_CONTEXT_BROKEN   Context is in broken state and must be either
+ *                              recovered using nnpdrvRecoverInferContext or
+ *                              destroyed.
+ */
+NNPError nnpdrvBeginSubmitBatch(NNPInferContext ctx);
+
+/**
+ * @brief Sends all operations batched by the calling thread and ends the batch.
+ *
+ * Sends all operations accumulated since nnpdrvBeginSubmitBatch on the
+ * calling thread to the device and ends the submission batch.
+ * The function does not wait for the operations to complete.
+ * If the calling thread has no open batch on the context, the function
+ * does nothing.
+ *
+ * @param[in]  ctx               Inference context handle
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_NO_SUCH_CONTEXT  The context handle does not exist
+ * @retval NNP_IO_ERROR         Internal driver error has occurred, some
+ *                              of the batched operations were not sent and
+ *                              the context becomes broken.
+ * @retval NNP_CONTEXT_BROKEN   Context is in broken state and must be either
+ *                              recovered using nnpdrvRecoverInferContext or
+ *                              destroyed.
+ */
+NNPError nnpdrvSubmitBatch(NNPInferContext ctx);
+
 /**
  * @brief Gets a marker handle which marks the current command position in the context command queue.
  *
@@ -1249,6 +2354,8 @@ NNPError nnpdrvScheduleCopy(NNPCopyHandle copyHandle, uint64_t byteSize, uint8_t
  * @retval NNP_NO_ERROR         Success
  * @retval NNP_NO_SUCH_CONTEXT  The context handle does not exist
  * @retval NNP_INVALID_ARGUMENT outMarker is NULL
+ * @retval NNP_NOT_SUPPORTED    The context is capturing, see
+ *                              nnpdrvInferContextBeginCapture
  * @retval NNP_IO_ERROR         Internal driver error has occurred
  * @retval NNP_OUT_OF_MEMORY    System ran out of memory
  * @retval NNP_CONTEXT_BROKEN   Context is in broken state and must be either
@@ -1306,6 +2413,80 @@ NNPError nnpdrvWaitForMarker(NNPInferContext ctx,
 			     NNPMarker	     marker,
 			     uint32_t	     timeoutUs);
 
+/**
+ * @brief Requests a one-shot callback for a command stream marker
+ *
+ * The callback is called once, with the marker as handle, when all
+ * commands scheduled before the marker have completed. numErrors is
+ * non zero if the marker failed to be created or the context became
+ * broken. With NNP_COMPLETION_CALLBACK_WORKER the callback runs on the
+ * driver callback workers, otherwise it runs on the context response
+ * thread and must not block. If the marker has already completed the
+ * callback may be called before this function returns.
+ *
+ * @param[in] ctx        Inference context handle
+ * @param[in] marker     Marker returned by nnpdrvGetMarker
+ * @param[in] cb         Callback function
+ * @param[in] userData   Passed to the callback
+ * @param[in] flags      NNP_COMPLETION_CALLBACK_* flags
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_INVALID_ARGUMENT cb is NULL
+ * @retval NNP_NO_SUCH_CONTEXT  The context handle does not exist
+ * @retval NNP_IO_ERROR         Internal driver error has occurred
+ */
+NNPError nnpdrvInferContextNotifyMarker(NNPInferContext       ctx,
+					NNPMarker             marker,
+					NNPCompletionCallback cb,
+					void                 *userData,
+					uint32_t              flags);
+
+/**
+ * @brief Sets the completion wait policy of an inference context
+ *
+ * The policy is used by nnpdrvWaitForMarker and nnpdrvWaitCommandList
+ * calls on the context, unless the calling thread has set its own
+ * policy with nnpdrvSetThreadWaitPolicy.
+ *
+ * @param[in] ctx      Inference context handle
+ * @param[in] policy   Wait policy
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_INVALID_ARGUMENT policy is NULL
+ * @retval NNP_NO_SUCH_CONTEXT  The context handle does not exist
+ */
+NNPError nnpdrvInferContextSetWaitPolicy(NNPInferContext      ctx,
+					 const NNPWaitPolicy *policy);
+
+/**
+ * @brief Sets the completion wait policy of the calling thread
+ *
+ * While set, the thread policy overrides the context policy for all
+ * waits done by the calling thread, including nnpdrvLockHostResource.
+ * It can be set around a single wait call to select a policy per call.
+ *
+ * @param[in] policy   Wait policy, NULL removes the thread policy
+ *
+ * @retval NNP_NO_ERROR         Success
+ */
+NNPError nnpdrvSetThreadWaitPolicy(const NNPWaitPolicy *policy);
+
+/**
+ * @brief Query completion wait statistics of an inference context
+ *
+ * Returns counters of marker and command list waits on the context,
+ * by the wait policy phase which resolved them.
+ *
+ * @param[in]  ctx        Inference context handle
+ * @param[out] outStats   Pointer to wait statistics to be filled
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_INVALID_ARGUMENT outStats is NULL
+ * @retval NNP_NO_SUCH_CONTEXT  The context handle does not exist
+ */
+NNPError nnpdrvQueryInferContextWaitStats(NNPInferContext ctx,
+					  NNPWaitStats   *outStats);
+
 /**
  * @brief returns the last critical error detected on the given context.
  *
@@ -1353,6 +2534,50 @@ NNPError nnpdrvWaitForCriticalError(NNPInferContext ctx,
 				    uint32_t	    timeoutUs,
 				    NNPCriticalErrorInfo *outErrorInfo);
 
+/**
+ * @brief Returns an eventfd signalled when markers of the context complete
+ *
+ * The returned file descriptor is a non-blocking eventfd which is
+ * signalled each time one or more markers of the context complete or
+ * fail, and when the context becomes broken. It can be added to an
+ * epoll/poll set; after it becomes readable, read it to reset the
+ * counter and check the pending markers with nnpdrvWaitForMarker with
+ * zero timeout.
+ * The file descriptor is owned by the context and is closed when the
+ * context is destroyed, the caller must not close it.
+ *
+ * @param[in]  ctx      Inference context handle
+ * @param[out] outFd    Returns the eventfd
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_INVALID_ARGUMENT outFd is NULL
+ * @retval NNP_NO_SUCH_CONTEXT  The context handle does not exist
+ * @retval NNP_IO_ERROR         Failed to create the eventfd
+ */
+NNPError nnpdrvInferContextGetMarkerEventFd(NNPInferContext ctx,
+					    int            *outFd);
+
+/**
+ * @brief Returns an eventfd signalled on context critical error
+ *
+ * The returned file descriptor is a non-blocking eventfd which is
+ * signalled when a critical error is detected on the context, the
+ * condition waited for by nnpdrvWaitForCriticalError. After it becomes
+ * readable, call nnpdrvGetError to retrieve the error.
+ * The file descriptor is owned by the context and is closed when the
+ * context is destroyed, the caller must not close it.
+ *
+ * @param[in]  ctx      Inference context handle
+ * @param[out] outFd    Returns the eventfd
+ *
+ * @retval NNP_NO_ERROR         Success
+ * @retval NNP_INVALID_ARGUMENT outFd is NULL
+ * @retval NNP_NO_SUCH_CONTEXT  The context handle does not exist
+ * @retval NNP_IO_ERROR         Failed to create the eventfd
+ */
+NNPError nnpdrvInferContextGetErrorEventFd(NNPInferContext ctx,
+					   int            *outFd);
+
 
 /**
  * @brief Retrives error message buffer of the critical error message
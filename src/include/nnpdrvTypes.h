@@ -157,6 +157,9 @@ typedef enum {
 	NNP_OUT_OF_ECC_MEMORY      = 27,  /**< Failed to alloc device resource from ecc memory */
 	NNP_NO_SUCH_CMDLIST        = 28,
 	NNP_VERSIONS_MISMATCH      = 29,  /**< Kernel and user space versions are not match*/
+	NNP_NO_SUCH_COMPLETION_QUEUE = 30, /**< The specified completion queue handle does not exist */
+	NNP_NO_SUCH_SUBMIT_QUEUE   = 31,  /**< The specified submit queue handle does not exist */
+	NNP_NO_SUCH_CMDLIST_TEMPLATE = 32, /**< The specified command list template handle does not exist */
 
 	NNP_UNKNOWN_ERROR          = 999
 } NNPError;
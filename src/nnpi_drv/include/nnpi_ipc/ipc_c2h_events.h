@@ -203,13 +203,13 @@ int event_valToNNPErrno(enum event_val event_val);
  *
  * event_code                        event_val         ContextID   obj_id                         obj_id_2
  * ---------                        --------         ---------   ------                        ------
- * NNP_IPC_CREATE_CONTEXT_SUCCESS   0                Valid       Not-Valid                     Not-Valid
+ * NNP_IPC_CREATE_CONTEXT_SUCCESS   features (5)     Valid       Not-Valid                     Not-Valid
  * NNP_IPC_CREATE_DEVRES_SUCCESS    bid (for p2p     Valid       Device resource protocol_id    offset (valid for p2p resource only)
  * NNP_IPC_CREATE_COPY_SUCCESS      0                Valid       Copy handle protocol_id        Not-Valid
  * NNP_IPC_CREATE_DEVNET_SUCCESS    0                Valid       Device network protocol_id     Not-Valid
  * NNP_IPC_CREATE_INFREQ_SUCCESS    devnetID         Valid       inf req protocol_id            Not-Valid
- * NNP_IPC_EXECUTE_COPY_SUCCESS     0                Valid       Copy handle protocol_id        Not-Valid or Cmd list protocol_id(in case Cmd list complete)
- * NNP_IPC_EXECUTE_COPY_SUBRES_SUCCESS   0           Valid       Copy handle protocol_id        Not-Valid or Cmd list protocol_id(in case Cmd list complete)
+ * NNP_IPC_EXECUTE_COPY_SUCCESS     0 (7)            Valid       Copy handle protocol_id        Not-Valid or Cmd list protocol_id(in case Cmd list complete)
+ * NNP_IPC_EXECUTE_COPY_SUBRES_SUCCESS   0 (7)       Valid       Copy handle protocol_id        Not-Valid or Cmd list protocol_id(in case Cmd list complete)
  * NNP_IPC_CREATE_CHANNEL_SUCCESS   0                Not-Valid   Channel protocol_id            Not-Valid
  * NNP_IPC_CHANNEL_SET_RB_SUCCESS   0                Not-Valid   Channel protocol_id            rb_id
  * NNP_IPC_CHANNEL_MAP_HOSTRES_SUCCESS   0           Not-Valid   Channel protocol_id            Hostres id
@@ -223,7 +223,7 @@ int event_valToNNPErrno(enum event_val event_val);
  * NNP_IPC_CHANNEL_SET_RB_FAILED    0                Not-valid   channel protocol_id            rb_id
  * NNP_IPC_CREATE_CMD_SUCCESS       0                Valid       Cmd list protocol_id           Not-Valid
  * NNP_IPC_CMD_DESTROYED            0                Valid       Cmd list protocol_id           Not-Valid
- * NNP_IPC_EXECUTE_CMD_COMPLETE     0                Valid       Cmd list protocol_id           Not-Valid
+ * NNP_IPC_EXECUTE_CMD_COMPLETE     0 (6)            Valid       Cmd list protocol_id           Not-Valid
  *
  * NNP_IPC_EXECUTE_CPYLST_SUCCESS   0 or
  *                                  enum event_val
@@ -272,5 +272,20 @@ int event_valToNNPErrno(enum event_val event_val);
  *    (2) - this event is generated by the host when a card reset is forced.
  *    (3) - host generated event when device state changes
  *    (4) - host generated event when "nnpi_ctl disable -abort" is requested
+ *    (5) - the NNP_IPC_CTX_FEATURE_* bits of the create request cflags which
+ *    the card enabled for the context. Always 0 on channels created with a
+ *    protocol version older than NNP_IPC_CHAN_CTX_FEATURES_VERSION, and a
+ *    card never reports a bit which was not requested.
+ *    (6) - one event per NNP_IPC_H2C_OP_CHAN_SCHEDULE_CMDLIST. When the
+ *    context has NNP_IPC_CTX_FEATURE_CMDLIST_PIPELINE enabled, a schedule
+ *    of a command list which is still executing is queued, and the events
+ *    (or failure events) of the queued schedules are sent in schedule
+ *    order. Without the feature such a schedule is a protocol error.
+ *    (7) - when a copy or infer request of a command list was rebound by a
+ *    schedule on a context with NNP_IPC_CTX_FEATURE_CMDLIST_REBIND enabled,
+ *    obj_id of its completion and failure events (also
+ *    NNP_IPC_SCHEDULE_INFREQ_FAILED) is the protocol_id named by that
+ *    schedule, not the one the entry was created with. A schedule which
+ *    names an ID on a context without the feature is a protocol error.
  */
 #endif
@@ -9,7 +9,15 @@
 #include <linux/types.h>
 #include "ipc_protocol.h"
 
-#define NNP_IPC_CHAN_PROTOCOL_VERSION NNP_MAKE_VERSION(1, 6, 0)
+#define NNP_IPC_CHAN_PROTOCOL_VERSION NNP_MAKE_VERSION(1, 7, 0)
+
+/*
+ * Oldest channel protocol version the host still speaks. A channel
+ * created with a version older than NNP_IPC_CHAN_CTX_FEATURES_VERSION
+ * must not request context features.
+ */
+#define NNP_IPC_CHAN_PROTOCOL_MIN_VERSION NNP_MAKE_VERSION(1, 6, 0)
+#define NNP_IPC_CHAN_CTX_FEATURES_VERSION NNP_MAKE_VERSION(1, 7, 0)
 
 #define NNP_IPC_GENMSG_BAD_CLIENT_ID   0xFFF
 
@@ -103,6 +111,45 @@ union h2c_ChanInferenceContextOp {
 };
 CHECK_MESSAGE_SIZE(union h2c_ChanInferenceContextOp, 1);
 
+/*
+ * cflags bits of NNP_IPC_H2C_OP_CHAN_INF_CONTEXT.
+ * Bits 0-1 are ULT test flags. On channels created with protocol version
+ * NNP_IPC_CHAN_CTX_FEATURES_VERSION or later, the remaining bits request
+ * optional context features and the card reports the subset it enabled
+ * in the event_val of NNP_IPC_CREATE_CONTEXT_SUCCESS (see ipc_c2h_events.h).
+ * The host must not use a feature which was not reported. On older
+ * channels these bits must be zero.
+ */
+#define NNP_IPC_CTX_CFLAG_ULT           (1 << 0)
+#define NNP_IPC_CTX_CFLAG_ULT_LAST      (1 << 1)
+
+/*
+ * Command payloads in both command ring buffers are written as 8-byte
+ * aligned records instead of one payload per page. Each record starts with
+ * an 8 byte header: __le32 payload size followed by __le32 flags. Flag bit 0
+ * marks a padding record which skips the rest of the ring up to its end.
+ */
+#define NNP_IPC_CTX_FEATURE_PACKED_RB   (1 << 2)
+
+/*
+ * NNP_IPC_H2C_OP_CHAN_SCHEDULE_CMDLIST of a command list which is still
+ * executing is queued by the card rather than rejected. Queued schedules
+ * execute in order and each one is reported with exactly one
+ * NNP_IPC_EXECUTE_CMD_COMPLETE (or failure event), in schedule order.
+ */
+#define NNP_IPC_CTX_FEATURE_CMDLIST_PIPELINE (1 << 3)
+
+/*
+ * The edited entries of NNP_IPC_H2C_OP_CHAN_SCHEDULE_CMDLIST may name a
+ * different copy or infer request ID than the entry had when the command
+ * list was created. The card executes the entry with the named object
+ * and recomputes the entry dependencies from its resources.
+ */
+#define NNP_IPC_CTX_FEATURE_CMDLIST_REBIND   (1 << 4)
+
+#define NNP_IPC_CTX_CFLAG_FEATURES_MASK (0xff & ~(NNP_IPC_CTX_CFLAG_ULT | \
+						  NNP_IPC_CTX_CFLAG_ULT_LAST))
+
 union h2c_ChanInferenceResourceOp {
 	struct {
 		__le64 opcode      : 6;  /* NNP_IPC_H2C_OP_CHAN_INF_RESOURCE */
@@ -6,7 +6,16 @@
 #include "nnpiChannel.h"
 #include <unistd.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <new>
 #include "nnpiHostProc.h"
 #include "nnpdrvInference.h"
 #include "ipc_chan_protocol.h"
@@ -14,6 +23,20 @@
 
 static nnpiActiveContexts::ptr s_active_contexts;
 
+#define SUBMIT_BATCH_MAX_MSGS   128
+#define SUBMIT_BATCH_MAX_QWORDS (SUBMIT_BATCH_MAX_MSGS * 4)
+
+struct nnpiSubmitBatch {
+	std::weak_ptr<nnpiChannel> chan; /* does not keep the channel fd open */
+	uint32_t         num_msgs;
+	uint32_t         num_qwords;
+	struct iovec     iov[SUBMIT_BATCH_MAX_MSGS];
+	uint64_t         buf[SUBMIT_BATCH_MAX_QWORDS];
+};
+
+thread_local const nnpiChannel *nnpiChannel::s_batch_chan = nullptr;
+static thread_local std::unique_ptr<nnpiSubmitBatch> s_batch;
+
 nnpiActiveContexts::nnpiActiveContexts()
 {
 }
@@ -121,6 +144,285 @@ void nnpiActiveContexts::wait_all()
 	}
 }
 
+#define RESPONSE_REACTOR_MAX_THREADS 64
+#define RESPONSE_REACTOR_MAX_EVENTS  32
+#define RESPONSE_REACTOR_STOP_KEY    0 /* channel keys start from 1 */
+
+struct nnpiReactorChan {
+	nnpiChannel *chan;
+	int          fd;
+};
+
+static nnpiWaitQueue s_reactor_waitq;
+static int s_reactor_epfd = -1;
+static int s_reactor_stopfd = -1;
+static std::vector<pthread_t> s_reactor_threads;
+static uint64_t s_reactor_next_key = 1;
+static std::unordered_map<uint64_t, nnpiReactorChan> s_reactor_chans;
+static std::unordered_set<uint64_t> s_reactor_busy;
+static thread_local uint64_t s_reactor_cur_key = 0;
+
+static uint32_t get_response_reactor_threads(void)
+{
+	static int val = -1;
+
+	if (val < 0) {
+		const char *env_str = getenv("NNPI_RESPONSE_REACTOR_THREADS");
+		if (env_str)
+			val = atoi(env_str);
+		if (val < 0)
+			val = 0;
+		else if (val > RESPONSE_REACTOR_MAX_THREADS)
+			val = RESPONSE_REACTOR_MAX_THREADS;
+	}
+
+	return val;
+}
+
+bool nnpiResponseReactor::enabled()
+{
+	return get_response_reactor_threads() > 0;
+}
+
+int nnpiResponseReactor::start_locked()
+{
+	uint32_t num_threads = get_response_reactor_threads();
+	struct epoll_event ev;
+	pthread_t thread;
+	int ret;
+
+	if (s_reactor_epfd >= 0)
+		return 0;
+
+	s_reactor_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (s_reactor_epfd < 0)
+		return errno;
+
+	/* level triggered, once signaled it wakes all reactor threads */
+	s_reactor_stopfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (s_reactor_stopfd < 0) {
+		ret = errno;
+		goto fail;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = RESPONSE_REACTOR_STOP_KEY;
+	if (epoll_ctl(s_reactor_epfd, EPOLL_CTL_ADD, s_reactor_stopfd, &ev) != 0) {
+		ret = errno;
+		goto fail;
+	}
+
+	for (uint32_t i = 0; i < num_threads; ++i) {
+		if (pthread_create(&thread, NULL, nnpiResponseReactor::reactor_thread, NULL) != 0)
+			break;
+		s_reactor_threads.push_back(thread);
+	}
+
+	if (s_reactor_threads.empty()) {
+		ret = ENOMEM;
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	if (s_reactor_stopfd >= 0)
+		close(s_reactor_stopfd);
+	s_reactor_stopfd = -1;
+	close(s_reactor_epfd);
+	s_reactor_epfd = -1;
+	return ret;
+}
+
+/*
+ * Stops and joins the reactor threads, called at exit once all
+ * channels are destroyed. A later channel starts the reactor again.
+ */
+void nnpiResponseReactor::stop()
+{
+	std::vector<pthread_t> threads;
+	uint64_t val = 1;
+
+	s_reactor_waitq.lock();
+	if (s_reactor_epfd < 0) {
+		s_reactor_waitq.unlock();
+		return;
+	}
+	if (write(s_reactor_stopfd, &val, sizeof(val)) != sizeof(val))
+		nnp_log_err(GENERAL_LOG, "Failed to stop response reactor errno=%d\n", errno);
+	else
+		threads.swap(s_reactor_threads);
+	s_reactor_waitq.unlock();
+
+	if (threads.empty())
+		return;
+
+	for (auto t = threads.begin(); t != threads.end(); ++t)
+		pthread_join(*t, NULL);
+
+	s_reactor_waitq.lock();
+	close(s_reactor_stopfd);
+	s_reactor_stopfd = -1;
+	close(s_reactor_epfd);
+	s_reactor_epfd = -1;
+	s_reactor_waitq.unlock();
+}
+
+int nnpiResponseReactor::add(nnpiChannel *chan, int fd, uint64_t &out_key)
+{
+	struct epoll_event ev;
+	uint64_t key;
+	int ret;
+
+	s_reactor_waitq.lock();
+	ret = start_locked();
+	if (ret != 0) {
+		s_reactor_waitq.unlock();
+		return ret;
+	}
+
+	key = s_reactor_next_key++;
+	s_reactor_chans[key] = { chan, fd };
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+	ev.data.u64 = key;
+	if (epoll_ctl(s_reactor_epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+		ret = errno;
+		s_reactor_chans.erase(key);
+	} else {
+		out_key = key;
+	}
+	s_reactor_waitq.unlock();
+
+	return ret;
+}
+
+/*
+ * Stops dispatching responses of a channel and waits for a dispatch
+ * that may be in progress on another reactor thread to finish.
+ */
+void nnpiResponseReactor::remove(uint64_t key)
+{
+	std::unordered_map<uint64_t, nnpiReactorChan>::iterator it;
+
+	s_reactor_waitq.lock();
+	it = s_reactor_chans.find(key);
+	if (it != s_reactor_chans.end()) {
+		epoll_ctl(s_reactor_epfd, EPOLL_CTL_DEL, it->second.fd, NULL);
+		s_reactor_chans.erase(it);
+	}
+	s_reactor_waitq.unlock();
+
+	if (key != s_reactor_cur_key)
+		s_reactor_waitq.wait([key] { return s_reactor_busy.count(key) == 0; });
+}
+
+void nnpiResponseReactor::lock()
+{
+	s_reactor_waitq.lock();
+}
+
+void nnpiResponseReactor::unlock()
+{
+	s_reactor_waitq.unlock();
+}
+
+void nnpiResponseReactor::fork_child_reset()
+{
+	/* reactor threads do not exist in the child process */
+	if (s_reactor_epfd >= 0)
+		close(s_reactor_epfd);
+	s_reactor_epfd = -1;
+	if (s_reactor_stopfd >= 0)
+		close(s_reactor_stopfd);
+	s_reactor_stopfd = -1;
+	s_reactor_threads.clear();
+	s_reactor_chans.clear();
+	s_reactor_busy.clear();
+
+	/* no thread of the child waits on it, drop the parent waiters state */
+	new (&s_reactor_waitq) nnpiWaitQueue();
+}
+
+void nnpiResponseReactor::dispatch(uint64_t key)
+{
+	std::unordered_map<uint64_t, nnpiReactorChan>::iterator it;
+	struct epoll_event ev;
+	nnpiChannel *chan;
+	bool abnormal;
+
+	s_reactor_waitq.lock();
+	it = s_reactor_chans.find(key);
+	if (it == s_reactor_chans.end()) {
+		s_reactor_waitq.unlock();
+		return;
+	}
+	chan = it->second.chan;
+	s_reactor_busy.insert(key);
+	s_reactor_waitq.unlock();
+
+	/*
+	 * The channel may get destroyed by the response handler,
+	 * the channel pointer is not used after the handler returns
+	 * unless the channel is still registered.
+	 */
+	s_reactor_cur_key = key;
+	if (chan->handle_response(abnormal)) {
+		s_reactor_waitq.lock();
+		it = s_reactor_chans.find(key);
+		if (it != s_reactor_chans.end()) {
+			epoll_ctl(s_reactor_epfd, EPOLL_CTL_DEL, it->second.fd, NULL);
+			s_reactor_chans.erase(it);
+			s_reactor_waitq.unlock();
+			chan->handleResponseHandlerExit(abnormal, false);
+		} else {
+			s_reactor_waitq.unlock();
+		}
+	}
+	s_reactor_cur_key = 0;
+
+	s_reactor_waitq.lock();
+	it = s_reactor_chans.find(key);
+	if (it != s_reactor_chans.end()) {
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+		ev.data.u64 = key;
+		epoll_ctl(s_reactor_epfd, EPOLL_CTL_MOD, it->second.fd, &ev);
+	}
+	s_reactor_busy.erase(key);
+	s_reactor_waitq.unlock_notify();
+}
+
+void *nnpiResponseReactor::reactor_thread(void *)
+{
+	struct epoll_event events[RESPONSE_REACTOR_MAX_EVENTS];
+	int epfd = s_reactor_epfd;
+	bool stop = false;
+	int n;
+
+	while (!stop) {
+		n = epoll_wait(epfd, events, RESPONSE_REACTOR_MAX_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			nnp_log_err(GENERAL_LOG, "response reactor epoll_wait failed errno=%d\n", errno);
+			break;
+		}
+
+		/* dispatch the whole batch, one-shot events are not reported again */
+		for (int i = 0; i < n; ++i) {
+			if (events[i].data.u64 == RESPONSE_REACTOR_STOP_KEY)
+				stop = true;
+			else
+				dispatch(events[i].data.u64);
+		}
+	}
+
+	return NULL;
+}
+
 int nnpiChannel::create(uint32_t                dev_num,
 			uint32_t                weight,
 			bool                    is_context,
@@ -134,12 +436,13 @@ int nnpiChannel::create(uint32_t                dev_num,
 	uint16_t id;
 	int fd;
 	int privileged;
+	uint32_t version;
 	int ret;
 
 	if (host.get() == nullptr || dev.get() == nullptr)
 		return ENODEV;
 
-	ret = dev->createChannel(host, weight, is_context, get_device_events, &id, &fd, &privileged);
+	ret = dev->createChannel(host, weight, is_context, get_device_events, &id, &fd, &privileged, &version);
 	if (ret != 0)
 		return ret;
 
@@ -149,6 +452,7 @@ int nnpiChannel::create(uint32_t                dev_num,
 					      is_context,
 					      fd,
 					      privileged != 0,
+					      version,
 					      get_device_events,
 					      response_handler,
 					      response_handler_ctx));
@@ -157,6 +461,12 @@ int nnpiChannel::create(uint32_t                dev_num,
 		out_channel_ptr->m_active_ref = nnpiActiveContexts::add(out_channel_ptr.get());
 
 	out_channel_ptr->m_this = out_channel_ptr;
+	if (nnpiResponseReactor::enabled() &&
+	    nnpiResponseReactor::add(out_channel_ptr.get(),
+				     fd,
+				     out_channel_ptr->m_reactor_key) == 0)
+		return 0;
+
 	if (pthread_create(&out_channel_ptr->m_resp_thread, NULL, nnpiChannel::response_handler, out_channel_ptr.get()) != 0)
 		goto fail;
 	out_channel_ptr->m_joined = false;
@@ -174,8 +484,12 @@ nnpiChannel::~nnpiChannel()
 	 * When we get here the response thread is either
 	 * canceled and joined, or is currently exiting.
 	 * if it did not joined, detach it.
+	 * In reactor mode, make sure no reactor thread
+	 * handles this channel anymore.
 	 */
-	if (!m_joined)
+	if (m_reactor_key != 0)
+		nnpiResponseReactor::remove(m_reactor_key);
+	else if (!m_joined)
 		pthread_detach(m_resp_thread);
 
 	for (unsigned int i = 0; i < MAX_CHANNEL_RINGBUFS; ++i) {
@@ -196,10 +510,15 @@ void nnpiChannel::kill(bool umd_only)
 		return;
 
 	if (!umd_only) {
-		/* cancel and wait for thread to terminate */
-		pthread_cancel(m_resp_thread);
-		pthread_join(m_resp_thread, NULL);
-		m_joined = true;
+		if (m_reactor_key != 0) {
+			/* stop dispatching and wait for current dispatch */
+			nnpiResponseReactor::remove(m_reactor_key);
+		} else {
+			/* cancel and wait for thread to terminate */
+			pthread_cancel(m_resp_thread);
+			pthread_join(m_resp_thread, NULL);
+			m_joined = true;
+		}
 
 		/*
 		 * Nothing else to do if thread was canceled after it
@@ -231,34 +550,115 @@ void nnpiChannel::handleResponseHandlerExit(bool abnormal, bool umd_only)
 	nnpi_utils_reset_m_this(m_this);
 }
 
-void *nnpiChannel::response_handler(void *ctx)
+#define RESP_READ_QWORDS   256
+#define RESP_BATCH_READS   16
+
+static uint32_t c2h_chan_msg_qwords(uint32_t opcode)
+{
+	switch (opcode) {
+	case NNP_IPC_C2H_OP_EVENT_REPORT:
+		return sizeof(union c2h_event_report) / sizeof(uint64_t);
+#define C2H_OPCODE(name, val, type) \
+	case C2H_OPCODE_NAME(name): \
+		return sizeof(type) / sizeof(uint64_t);
+#include "ipc_chan_c2h_opcodes.h"
+#undef C2H_OPCODE
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Reads and handles all available response messages.
+ * Wait queue wakeups caused by the handled messages are deferred and
+ * issued once for the whole batch.
+ * Returns true if response handling of the channel should stop,
+ * abnormal is set if it stopped due to read failure.
+ */
+bool nnpiChannel::handle_response(bool &abnormal)
 {
-	uint64_t msg[16];
+	uint64_t msg[RESP_READ_QWORDS];
+	struct pollfd pfd;
+	bool done = false;
+	uint32_t nreads = 0;
+	uint32_t qwords, len;
 	ssize_t n;
-	bool should_exit = false;
-	nnpiChannel *channel = (nnpiChannel *)ctx;
+
+	nnpiWaitQueue::beginNotifyBatch();
 
 	do {
-		n = read(channel->m_fd, msg, sizeof(msg));
-		if (n > 0) {
-			union c2h_chan_msg_header *cmd = (union c2h_chan_msg_header *)msg;
+		n = read(m_fd, msg, sizeof(msg));
+		if (n <= 0) {
+			if (n == 0 || errno != EINTR || m_killed) {
+				abnormal = true;
+				done = true;
+			}
+			break;
+		}
+		nreads++;
+
+		/* split the read buffer into messages */
+		qwords = n / sizeof(uint64_t);
+		for (uint32_t off = 0; off < qwords && !done; off += len) {
+			union c2h_chan_msg_header *cmd = (union c2h_chan_msg_header *)&msg[off];
+
+			len = c2h_chan_msg_qwords(cmd->opcode);
+			if (len == 0 || off + len > qwords)
+				len = qwords - off;
+
 			if (cmd->opcode == NNP_IPC_C2H_OP_CHANNEL_RB_UPDATE) {
-				channel->handle_ringbuff_head_update((union c2h_ChanRingBufUpdate *)cmd);
+				handle_ringbuff_head_update((union c2h_ChanRingBufUpdate *)cmd);
 				continue;
 			}
 
-			should_exit = (*channel->m_resp_handler)(channel->m_resp_handler_ctx,
-								 msg,
-								 n << 3);
-		} else if (n == 0 || errno != EINTR || channel->m_killed)
+			if ((*m_resp_handler)(m_resp_handler_ctx, &msg[off], (len * sizeof(uint64_t)) << 3)) {
+				abnormal = false;
+				done = true;
+			}
+		}
+
+		if (done || nreads >= RESP_BATCH_READS)
 			break;
-	} while(!should_exit);
 
-	channel->handleResponseHandlerExit(!should_exit, false);
+		/* continue draining while more responses are pending */
+		pfd.fd = m_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+	} while (poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN) != 0);
+
+	nnpiWaitQueue::endNotifyBatch();
+
+	return done;
+}
+
+void *nnpiChannel::response_handler(void *ctx)
+{
+	nnpiChannel *channel = (nnpiChannel *)ctx;
+	bool abnormal = false;
+
+	while (!channel->handle_response(abnormal))
+		;
+
+	channel->handleResponseHandlerExit(abnormal, false);
 
 	return NULL;
 }
 
+static bool get_lockless_cmd_ringbuf(void)
+{
+	static int val = -1;
+
+	if (val < 0) {
+		const char *env_str = getenv("NNPI_LOCKLESS_CMD_RINGBUF");
+		if (env_str)
+			val = atoi(env_str) ? 1 : 0;
+		else
+			val = 0;
+	}
+
+	return val != 0;
+}
+
 int nnpiChannel::createCommandRingBuffer(uint8_t  id,
 					 uint32_t byte_size)
 {
@@ -287,11 +687,117 @@ int nnpiChannel::createCommandRingBuffer(uint8_t  id,
 	if (ret != 0)
 		return ret;
 
-	m_cmd_ringbufs[id].reset(new nnpiRingBuffer(hostRes));
+	m_cmd_ringbufs[id].reset(new nnpiRingBuffer(hostRes, get_lockless_cmd_ringbuf()));
 
 	return 0;
 }
 
+void nnpiChannel::setCommandRingBufferAutoGrow(uint32_t max_size,
+					       uint32_t stall_threshold)
+{
+	m_rb_max_size = max_size;
+	m_rb_grow_threshold = stall_threshold;
+	for (unsigned int i = 0; i < MAX_CHANNEL_RINGBUFS; ++i)
+		if (m_cmd_ringbufs[i].get() != nullptr)
+			m_rb_grow_stalls[i] = m_cmd_ringbufs[i]->stalls();
+}
+
+/*
+ * Called by writers. Releases the ring memory left by the last grow and,
+ * if the ring stalled enough, allocates the grown ring memory for the
+ * response path to swap in once the card has drained the ring.
+ */
+void nnpiChannel::checkCommandRingBufferGrow(uint8_t id)
+{
+	nnpiRingBuffer::ptr ring;
+	uint32_t new_size, state;
+	int ret;
+
+	if (m_rb_max_size == 0 || id >= MAX_CHANNEL_RINGBUFS)
+		return;
+
+	ring = m_cmd_ringbufs[id];
+	if (ring.get() == nullptr)
+		return;
+
+	state = RB_GROW_DONE;
+	if (m_rb_grow_state[id].compare_exchange_strong(state, RB_GROW_ALLOC,
+							 std::memory_order_acquire)) {
+		m_rb_grow_res[id].reset();
+		m_rb_grow_stalls[id] = ring->stalls();
+		m_rb_grow_state[id].store(RB_GROW_IDLE, std::memory_order_release);
+		return;
+	}
+
+	if (state != RB_GROW_IDLE ||
+	    ring->size() >= m_rb_max_size ||
+	    ring->stalls() - m_rb_grow_stalls[id] < m_rb_grow_threshold)
+		return;
+
+	if (!m_rb_grow_state[id].compare_exchange_strong(state, RB_GROW_ALLOC,
+							  std::memory_order_acquire))
+		return;
+
+	new_size = ring->size() * 2;
+	if (new_size > m_rb_max_size || new_size < ring->size())
+		new_size = m_rb_max_size;
+
+	ret = nnpiHostRes::create(new_size,
+				  NNP_RESOURCE_USAGE_NN_INPUT,
+				  m_rb_grow_res[id]);
+	if (ret != 0) {
+		nnp_log_err(GENERAL_LOG, "Failed to grow command ringbuf %u to %u bytes\n", (uint32_t)id, new_size);
+		m_rb_grow_res[id].reset();
+		m_rb_grow_stalls[id] = ring->stalls();
+		m_rb_grow_state[id].store(RB_GROW_IDLE, std::memory_order_release);
+		return;
+	}
+
+	m_rb_grow_state[id].store(RB_GROW_READY, std::memory_order_release);
+}
+
+/*
+ * Response path, called after a head update of a command ring with
+ * grown ring memory ready. The ring is swapped only if it is empty and
+ * no writer holds it, otherwise the swap is retried on the next update.
+ * Either the old or the unused new ring memory is left for a writer to
+ * release.
+ */
+void nnpiChannel::growCommandRingBuffer(uint8_t id)
+{
+	nnpiRingBuffer::ptr ring = m_cmd_ringbufs[id];
+	nnpiHostRes::ptr old_res;
+	int ret;
+
+	if (!ring->tryLockEmpty())
+		return;
+
+	ret = m_dev->destroyChannelRingBuffer(m_id, id, true);
+	if (ret == 0) {
+		ret = m_dev->createChannelRingBuffer(m_id,
+						     id,
+						     true,
+						     m_rb_grow_res[id]);
+		if (ret == 0) {
+			old_res = ring->hostres();
+			ring->replaceBuffer(m_rb_grow_res[id]);
+			m_rb_grow_res[id] = old_res;
+			m_rb_grows++;
+		} else if (m_dev->createChannelRingBuffer(m_id, id, true, ring->hostres()) != 0) {
+			nnp_log_err(GENERAL_LOG, "Failed to restore command ringbuf %u\n", (uint32_t)id);
+			ring->setInvalid();
+		}
+	}
+
+	ring->unlockFreeSpace(0);
+
+	if (ret != 0)
+		nnp_log_err(GENERAL_LOG, "Failed to grow command ringbuf %u to %u bytes\n",
+			    (uint32_t)id, (uint32_t)m_rb_grow_res[id]->size());
+
+	m_rb_grow_state[id].store(RB_GROW_DONE, std::memory_order_release);
+}
+
 int nnpiChannel::createResponseRingBuffer(uint8_t  id,
 					  uint32_t byte_size)
 {
@@ -351,6 +857,243 @@ int nnpiChannel::destroyResponseRingBuffer(uint8_t id)
 	return m_dev->destroyChannelRingBuffer(m_id, id, false);
 }
 
+/*
+ * Drops the batch of the calling thread if its channel was killed or
+ * destroyed since the batch was opened. The pending messages are lost
+ * with the channel: a killed channel already woke its waiters with an
+ * error, and a destroyed one has nobody left to wait.
+ * Returns true if the batch was dropped.
+ */
+bool nnpiChannel::dropStaleBatch()
+{
+	if (s_batch_chan == nullptr)
+		return false;
+
+	nnpiChannel::ptr chan = s_batch->chan.lock();
+	if (chan.get() != nullptr && !chan->m_killed)
+		return false;
+
+	if (s_batch->num_msgs > 0)
+		nnp_log_err(GENERAL_LOG, "Dropped %u batched messages of a killed channel\n",
+			    s_batch->num_msgs);
+
+	s_batch_chan = nullptr;
+	s_batch->chan.reset();
+	s_batch->num_msgs = 0;
+	s_batch->num_qwords = 0;
+
+	return true;
+}
+
+/*
+ * Sends the pending messages of the batch opened by the calling thread,
+ * whichever channel it is on, the batch stays open.
+ */
+static std::vector<pthread_t> s_kill_threads; /* protected by nnpiGlobalLock */
+
+void *nnpiChannel::kill_thread(void *ctx)
+{
+	nnpiChannel::ptr *chan = (nnpiChannel::ptr *)ctx;
+
+	(*chan)->kill();
+	delete chan;
+
+	return NULL;
+}
+
+/*
+ * Kills the channel from a helper thread. A failed write may happen on
+ * a thread holding object locks which breaking the context takes.
+ * The helper threads are joined by joinDeferredKills.
+ */
+void nnpiChannel::killDeferred(const nnpiChannel::ptr &chan)
+{
+	nnpiChannel::ptr *arg;
+	pthread_t thread;
+
+	if (chan.get() == nullptr || chan->m_killed || chan->m_kill_deferred.exchange(true))
+		return;
+
+	arg = new (std::nothrow) nnpiChannel::ptr(chan);
+	if (arg == nullptr)
+		return;
+
+	nnpiGlobalLock();
+	if (pthread_create(&thread, NULL, nnpiChannel::kill_thread, arg) == 0)
+		s_kill_threads.push_back(thread);
+	else
+		delete arg;
+	nnpiGlobalUnlock();
+}
+
+void nnpiChannel::joinDeferredKills()
+{
+	std::vector<pthread_t> threads;
+
+	nnpiGlobalLock();
+	threads.swap(s_kill_threads);
+	nnpiGlobalUnlock();
+
+	for (size_t i = 0; i < threads.size(); ++i)
+		pthread_join(threads[i], NULL);
+}
+
+void nnpiChannel::fork_child_reset()
+{
+	/* the helper threads do not exist in the child process */
+	s_kill_threads.clear();
+}
+
+int nnpiChannel::flushThreadBatch()
+{
+	dropStaleBatch();
+	if (s_batch_chan == nullptr)
+		return 0;
+
+	nnpiChannel::ptr chan = s_batch->chan.lock();
+	if (chan.get() == nullptr)
+		return 0;
+
+	return chan->flushBatch();
+}
+
+int nnpiChannel::beginBatch(const nnpiChannel::ptr &chan)
+{
+	int ret;
+
+	dropStaleBatch();
+
+	if (s_batch_chan == chan.get())
+		return 0;
+
+	if (chan->m_killed)
+		return EPIPE;
+
+	if (s_batch_chan != nullptr) {
+		nnpiChannel::ptr prev = s_batch->chan.lock();
+
+		ret = prev.get() ? prev->submitBatch() : 0;
+		if (ret != 0)
+			return ret;
+	}
+
+	if (!s_batch.get()) {
+		s_batch.reset(new nnpiSubmitBatch);
+		if (!s_batch.get())
+			return ENOMEM;
+	}
+
+	s_batch->chan = chan;
+	s_batch->num_msgs = 0;
+	s_batch->num_qwords = 0;
+	s_batch_chan = chan.get();
+
+	return 0;
+}
+
+/*
+ * Writes the pending messages, resending the unsent remainder after a
+ * partial write. The schedule calls of the batched messages already
+ * succeeded, so if the messages cannot be written the channel is killed,
+ * which breaks the context and wakes its waiters with an error.
+ */
+int nnpiChannel::flushBatch()
+{
+	nnpiSubmitBatch *batch = s_batch.get();
+	uint32_t i = 0;
+	ssize_t n;
+
+	if (s_batch_chan == this && dropStaleBatch())
+		return EPIPE;
+
+	if (s_batch_chan != this || batch->num_msgs == 0)
+		return 0;
+
+	while (i < batch->num_msgs && !m_killed) {
+		n = ::writev(m_fd, &batch->iov[i], batch->num_msgs - i);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+
+		while (n > 0) {
+			struct iovec *iov = &batch->iov[i];
+
+			if ((size_t)n < iov->iov_len) {
+				iov->iov_base = (uint8_t *)iov->iov_base + n;
+				iov->iov_len -= n;
+				break;
+			}
+			n -= iov->iov_len;
+			i++;
+		}
+	}
+
+	if (i < batch->num_msgs) {
+		nnp_log_err(GENERAL_LOG, "Failed to write %u batched messages, killing channel %u\n",
+			    batch->num_msgs - i, (uint32_t)m_id);
+		killDeferred(batch->chan.lock());
+		s_batch_chan = nullptr;
+		batch->chan.reset();
+		batch->num_msgs = 0;
+		batch->num_qwords = 0;
+		return EIO;
+	}
+
+	batch->num_msgs = 0;
+	batch->num_qwords = 0;
+
+	return 0;
+}
+
+int nnpiChannel::submitBatch()
+{
+	int ret;
+
+	if (s_batch_chan == this && dropStaleBatch())
+		return EPIPE;
+
+	if (s_batch_chan != this)
+		return 0;
+
+	ret = flushBatch();
+
+	s_batch_chan = nullptr;
+	s_batch->chan.reset();
+
+	return ret;
+}
+
+ssize_t nnpiChannel::write_batched(const void *buf, size_t count)
+{
+	nnpiSubmitBatch *batch = s_batch.get();
+	uint32_t qwords = count / sizeof(uint64_t);
+
+	dropStaleBatch();
+
+	if (s_batch_chan != this ||
+	    (count % sizeof(uint64_t)) != 0 ||
+	    qwords > SUBMIT_BATCH_MAX_QWORDS)
+		return write(buf, count);
+
+	if (m_killed)
+		return 0;
+
+	if (batch->num_msgs >= SUBMIT_BATCH_MAX_MSGS ||
+	    batch->num_qwords + qwords > SUBMIT_BATCH_MAX_QWORDS) {
+		if (flushBatch() != 0)
+			return -1;
+	}
+
+	memcpy(&batch->buf[batch->num_qwords], buf, count);
+	batch->iov[batch->num_msgs].iov_base = &batch->buf[batch->num_qwords];
+	batch->iov[batch->num_msgs].iov_len = count;
+	batch->num_msgs++;
+	batch->num_qwords += qwords;
+
+	return count;
+}
+
 bool nnpiChannel::sendResponseRingBufferHeadUpdate(uint8_t rb_id, uint32_t size)
 {
 	union h2c_ChanRingBufUpdate cmd = {.reserved=0};
@@ -377,8 +1120,13 @@ void nnpiChannel::handle_ringbuff_head_update(union c2h_ChanRingBufUpdate *cmd)
 	if (m_killed)
 		return;
 
-	if (m_cmd_ringbufs[cmd->rb_id].get() == nullptr)
+	if (m_cmd_ringbufs[cmd->rb_id].get() == nullptr) {
 		nnp_log_err(GENERAL_LOG, "Got ringbuf update for not existence ringbuf %u\n", (uint32_t)cmd->rb_id);
-	else
-		m_cmd_ringbufs[cmd->rb_id]->updateHead(cmd->size);
+		return;
+	}
+
+	m_cmd_ringbufs[cmd->rb_id]->updateHead(cmd->size);
+
+	if (m_rb_grow_state[cmd->rb_id].load(std::memory_order_acquire) == RB_GROW_READY)
+		growCommandRingBuffer(cmd->rb_id);
 }
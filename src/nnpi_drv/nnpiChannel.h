@@ -13,12 +13,15 @@
 #include "nnpiHostProc.h"
 #include "nnpiUtils.h"
 #include <set>
+#include <mutex>
+#include <atomic>
 
 #define MAX_CHANNEL_RINGBUFS 2
 
 union c2h_ChanRingBufUpdate;
 
 class nnpiChannel;
+struct nnpiSubmitBatch;
 
 class nnpiActiveContexts {
 public:
@@ -43,6 +46,33 @@ private:
 	nnpiWaitQueue           m_waitq;
 };
 
+/*
+ * Response reactor.
+ * When enabled (NNPI_RESPONSE_REACTOR_THREADS > 0), channel responses
+ * are read by a small pool of threads multiplexing all channel fds
+ * with epoll, instead of a dedicated response thread per channel.
+ * Each channel fd is armed one-shot, so at most one reactor thread
+ * handles a given channel at a time and response ordering is kept.
+ */
+class nnpiResponseReactor {
+public:
+	static bool enabled();
+	static int add(nnpiChannel *chan, int fd, uint64_t &out_key);
+	static void remove(uint64_t key);
+
+	/* held across fork so the child does not inherit it locked */
+	static void lock();
+	static void unlock();
+	static void fork_child_reset();
+
+	static void stop();
+
+private:
+	static int start_locked();
+	static void *reactor_thread(void *);
+	static void dispatch(uint64_t key);
+};
+
 class nnpiChannel {
 public:
 	typedef std::shared_ptr<nnpiChannel> ptr;
@@ -66,6 +96,21 @@ public:
 
 	int destroyCommandRingBuffer(uint8_t id);
 
+	/*
+	 * Command ring growth.
+	 * When auto grow is set, writers call checkCommandRingBufferGrow
+	 * after writing to the ring, which requests to double the ring
+	 * size (up to max_size) once the ring stalled stall_threshold
+	 * times since the last resize. The writer which requests the grow
+	 * allocates the new ring memory, the response path only swaps it
+	 * in after a head update finds the ring drained, and the old memory
+	 * is released by a later writer. Writers never wait for the grow.
+	 */
+	void setCommandRingBufferAutoGrow(uint32_t max_size,
+					  uint32_t stall_threshold);
+	void checkCommandRingBufferGrow(uint8_t id);
+	uint32_t numCommandRingBufferGrows() const { return m_rb_grows; }
+
 	int createResponseRingBuffer(uint8_t  id,
 				     uint32_t byte_size);
 
@@ -74,14 +119,37 @@ public:
 	nnpiDevice::ptr device() { return m_dev; }
 	uint16_t id() const { return m_id; }
 	bool privileged() const { return m_privileged; }
+	/* channel protocol version the channel was created with */
+	uint32_t protocolVersion() const { return m_protocol_version; }
 
 	inline ssize_t write(const void *buf, size_t count)
 	{
 		if (m_killed)
 			return 0;
+		if (s_batch_chan == this && flushBatch() != 0)
+			return -1;
 		return ::write(m_fd, buf, count);
 	}
 
+	/*
+	 * Submission batching.
+	 * While the calling thread has an open batch on the channel,
+	 * write_batched() only appends the message to a per-thread buffer.
+	 * The buffer is written to the channel, in order, with a single
+	 * writev() call when the batch is submitted or gets full.
+	 * A direct write() from the batching thread flushes the pending
+	 * messages first, so message ordering is kept.
+	 * A batch does not keep its channel alive, the batch is dropped once
+	 * the channel is killed or destroyed. A batch which cannot be written
+	 * kills the channel, as its messages were already reported sent.
+	 */
+	ssize_t write_batched(const void *buf, size_t count);
+	static int beginBatch(const nnpiChannel::ptr &chan);
+	static int flushThreadBatch();
+	int submitBatch();
+	int flushBatch();
+	bool batching() const { return s_batch_chan == this; }
+
 	inline void set_kill_on_exit() { m_kill_on_exit = true; }
 
 	inline bool should_be_killed_on_exit() { return m_kill_on_exit; }
@@ -99,18 +167,40 @@ public:
 	bool sendResponseRingBufferHeadUpdate(uint8_t rb_id, uint32_t size);
 
 	bool killed() const { return m_killed; }
+
+	/* joins the helper threads of deferred kills, called at exit */
+	static void joinDeferredKills();
+	static void fork_child_reset();
 private:
+	friend class nnpiResponseReactor;
+
 	static void *response_handler(void *ctx);
+	bool handle_response(bool &abnormal);
+
+	static thread_local const nnpiChannel *s_batch_chan;
+	static bool dropStaleBatch();
+	static void killDeferred(const nnpiChannel::ptr &chan);
+	static void *kill_thread(void *ctx);
 
 	void handle_ringbuff_head_update(union c2h_ChanRingBufUpdate *cmd);
+	void growCommandRingBuffer(uint8_t id);
 	void handleResponseHandlerExit(bool abnormal, bool umd_only);
 
+	/* m_rb_grow_state values */
+	enum {
+		RB_GROW_IDLE,    /* no grow in progress */
+		RB_GROW_ALLOC,   /* a writer owns m_rb_grow_res */
+		RB_GROW_READY,   /* new ring memory waits for the response path */
+		RB_GROW_DONE     /* m_rb_grow_res holds memory for a writer to release */
+	};
+
 	nnpiChannel(const nnpiHostProc::ptr &proc,
 		    const nnpiDevice::ptr   &dev,
 		    uint16_t                 id,
 		    bool                     is_context,
 		    int                      fd,
 		    bool                     privileged,
+		    uint32_t                 protocol_version,
 		    bool                     get_device_events,
 		    nnpiChannel::handler_cb  handler,
 		    void                    *handler_ctx) :
@@ -120,13 +210,23 @@ private:
 		m_is_context(is_context),
 		m_fd(fd),
 		m_privileged(privileged),
+		m_protocol_version(protocol_version),
 		m_listen_device_events(get_device_events),
 		m_resp_handler(handler),
 		m_resp_handler_ctx(handler_ctx),
 		m_joined(true),
+		m_reactor_key(0),
 		m_killed(false),
-		m_kill_on_exit(false)
+		m_kill_on_exit(false),
+		m_kill_deferred(false),
+		m_rb_max_size(0),
+		m_rb_grow_threshold(0),
+		m_rb_grows(0)
 	{
+		for (unsigned int i = 0; i < MAX_CHANNEL_RINGBUFS; ++i) {
+			m_rb_grow_stalls[i] = 0;
+			m_rb_grow_state[i] = RB_GROW_IDLE;
+		}
 	}
 
 private:
@@ -139,14 +239,23 @@ private:
 	const bool     m_is_context;
 	const int m_fd;
 	const bool m_privileged;
+	const uint32_t m_protocol_version;
 	const bool m_listen_device_events;
 	const nnpiChannel::handler_cb m_resp_handler;
 	const void  *m_resp_handler_ctx;
 	bool m_joined;
+	uint64_t m_reactor_key; /* non zero when responses are handled by the reactor */
 	bool m_killed;
 	bool m_kill_on_exit;
+	std::atomic<bool> m_kill_deferred;
 	nnpiActiveContexts::ptr m_active_ref;
 	nnpiRingBuffer::ptr m_cmd_ringbufs[MAX_CHANNEL_RINGBUFS];
 	nnpiRingBuffer::ptr m_resp_ringbufs[MAX_CHANNEL_RINGBUFS];
 	pthread_t m_resp_thread;
+	uint32_t m_rb_max_size;
+	uint32_t m_rb_grow_threshold;
+	std::atomic<uint64_t> m_rb_grow_stalls[MAX_CHANNEL_RINGBUFS];
+	std::atomic<uint32_t> m_rb_grow_state[MAX_CHANNEL_RINGBUFS];
+	nnpiHostRes::ptr m_rb_grow_res[MAX_CHANNEL_RINGBUFS];       /* owned as m_rb_grow_state tells */
+	std::atomic<uint32_t> m_rb_grows;
 };
@@ -5,6 +5,19 @@
 
 #include "nnpiCommandList.h"
 #include "nnpiContextObjDB.h"
+#include <errno.h>
+#include <unordered_map>
+
+static bool accesses_conflict(const nnpiResAccess::vec &a,
+			      const nnpiResAccess::vec &b)
+{
+	for (auto i = a.begin(); i != a.end(); ++i)
+		for (auto j = b.begin(); j != b.end(); ++j)
+			if (i->res == j->res && (i->write || j->write))
+				return true;
+
+	return false;
+}
 
 NNPError nnpiCommandList::create(nnpiInfContext::ptr   ctx,
 				 nnpiCommandList::ptr &out_cmdlist)
@@ -25,16 +38,33 @@ NNPError nnpiCommandList::create(nnpiInfContext::ptr   ctx,
 	return NNP_NO_ERROR;
 }
 
+void *nnpiInfCommandSchedParams::operator new(size_t size, nnpiArena &arena)
+{
+	return arena.alloc(size);
+}
+
+/* the arena memory is released with the command list */
+void nnpiInfCommandSchedParams::operator delete(void *)
+{
+}
+
+void nnpiInfCommandSchedParams::operator delete(void *, nnpiArena &)
+{
+}
+
 nnpiCommandList::~nnpiCommandList()
 {
 	for (uint16_t i = 0; i < m_vec.size(); ++i)
 		delete m_vec[i];
 	m_vec.clear();
+	for (uint16_t i = 0; i < m_dropped.size(); ++i)
+		delete m_dropped[i];
+	m_dropped.clear();
 }
 
 NNPError nnpiCommandList::append(nnpiInfCommandSchedParams *sched_cmd)
 {
-	if (m_finalized)
+	if (m_finalized || m_create_pending)
 		return NNP_DEVICE_BUSY;
 
 	if (!sched_cmd)
@@ -52,21 +82,233 @@ NNPError nnpiCommandList::append(nnpiInfCommandSchedParams *sched_cmd)
 	return NNP_NO_ERROR;
 }
 
-nnpiInfCommandSchedParams *nnpiCommandList::get_cmd_for_overwrite(uint16_t usr_idx)
+/*
+ * m_waitq mutex must be held.
+ * Before the list is created each command is a single entry of m_vec.
+ */
+bool nnpiCommandList::find_cmd(uint16_t usr_idx, uint16_t &vec_idx, uint16_t &sub_idx) const
 {
+	if (m_user_map.empty()) {
+		if (usr_idx >= m_vec.size())
+			return false;
+
+		vec_idx = usr_idx;
+		sub_idx = 0;
+
+		return true;
+	}
+
+	/* dropped commands are not sent to the device and cannot be edited */
+	if (usr_idx >= m_user_map.size() || m_user_map[usr_idx].first == UINT16_MAX)
+		return false;
+
+	vec_idx = m_user_map[usr_idx].first;
+	sub_idx = m_user_map[usr_idx].second;
+
+	return true;
+}
+
+NNPError nnpiCommandList::overwrite(const NNPCommandListEdit *edits,
+				    uint32_t                  num_edits)
+{
+	/* send_to_card reads the edits without m_waitq */
+	std::lock_guard<std::mutex> sched_lock(m_sched_mutex);
 	std::lock_guard<std::mutex> lock(m_waitq.mutex());
-	uint16_t i;
+	uint16_t vec_idx, sub_idx;
+
+	for (uint32_t i = 0; i < num_edits; ++i) {
+		if (!find_cmd(edits[i].index, vec_idx, sub_idx))
+			return NNP_INVALID_ARGUMENT;
+
+		CmdListCommandType type = m_vec[vec_idx]->type() == CMDLIST_CMD_COPYLIST ?
+			CMDLIST_CMD_COPY : m_vec[vec_idx]->type();
+
+		if (edits[i].isInferReq && type != CMDLIST_CMD_INFREQ)
+			return NNP_NO_SUCH_INFREQ_HANDLE;
+		if (!edits[i].isInferReq && type != CMDLIST_CMD_COPY)
+			return NNP_NO_SUCH_COPY_HANDLE;
+	}
+
+	for (uint32_t i = 0; i < num_edits; ++i) {
+		find_cmd(edits[i].index, vec_idx, sub_idx);
+
+		if (!m_vec[vec_idx]->is_edited())
+			++m_num_edits;
+
+		nnpiInfCommandSchedParams *cmd = m_vec[vec_idx]->get_cmd_for_overwrite(sub_idx);
+
+		if (edits[i].isInferReq) {
+			static_cast<nnpiInfReqSchedParams *>(cmd)->overwrite(edits[i].schedParams);
+		} else {
+			uint64_t size = edits[i].byteSize;
+
+			if (size == 0)
+				size = UINT64_MAX;
+			if ((edits[i].flags & NNP_SCHEDULE_SKIP_EXECUTION) != 0)
+				size = 0;
+			static_cast<nnpiInfCopyCommandSchedParams *>(cmd)->overwrite(edits[i].priority, size);
+		}
+	}
+
+	return NNP_NO_ERROR;
+}
+
+/* m_waitq mutex must be held */
+nnpiInfCommandSchedParams *nnpiCommandList::leaf_cmd(uint16_t vec_idx, uint16_t sub_idx) const
+{
+	if (m_vec[vec_idx]->type() == CMDLIST_CMD_COPYLIST)
+		return static_cast<nnpiCopyListParams *>(m_vec[vec_idx])->copies()[sub_idx];
+
+	return m_vec[vec_idx];
+}
+
+bool nnpiCommandList::command_type(uint16_t usr_idx, CmdListCommandType &out_type)
+{
+	std::lock_guard<std::mutex> lock(m_waitq.mutex());
+	uint16_t vec_idx, sub_idx;
+
+	if (!find_cmd(usr_idx, vec_idx, sub_idx))
+		return false;
+
+	out_type = leaf_cmd(vec_idx, sub_idx)->type();
+
+	return true;
+}
+
+/*
+ * m_waitq mutex must be held.
+ * Swaps the bound object of each command with the one in its binding,
+ * calling it again with reverse set restores the previous bindings.
+ */
+void nnpiCommandList::swap_bindings(std::vector<Binding> &bindings, bool reverse)
+{
+	uint16_t vec_idx, sub_idx;
+
+	for (size_t n = 0; n < bindings.size(); ++n) {
+		Binding *b = &bindings[reverse ? bindings.size() - 1 - n : n];
+
+		find_cmd(b->index, vec_idx, sub_idx);
+		nnpiInfCommandSchedParams *cmd = leaf_cmd(vec_idx, sub_idx);
+
+		if (cmd->type() == CMDLIST_CMD_COPY) {
+			nnpiInfCopyCommandSchedParams *copy_cmd =
+				static_cast<nnpiInfCopyCommandSchedParams *>(cmd);
+			nnpiCopyCommand::ptr prev = copy_cmd->copy();
+
+			copy_cmd->rebind(b->copy);
+			b->copy = prev;
+		} else {
+			nnpiInfReqSchedParams *infreq_cmd = static_cast<nnpiInfReqSchedParams *>(cmd);
+			nnpiInfReq::ptr prev = infreq_cmd->infreq();
+
+			infreq_cmd->rebind(b->infreq);
+			b->infreq = prev;
+		}
+	}
+}
+
+/*
+ * m_waitq mutex must be held, the bindings are applied.
+ * The optimizer ordered the commands by the resources they accessed
+ * when the list was created. A rebound command must not conflict with
+ * a command whose order relative to it was changed.
+ */
+bool nnpiCommandList::bindings_keep_order(const std::vector<Binding> &bindings) const
+{
+	nnpiResAccess::vec acc, other_acc;
+
+	for (auto b = bindings.begin(); b != bindings.end(); ++b) {
+		const std::pair<uint16_t, uint16_t> &pos = m_user_map[b->index];
+
+		acc.clear();
+		if (!m_user_cmds[b->index]->get_accesses(acc))
+			return false;
+
+		for (uint16_t v = 0; v < m_user_cmds.size(); ++v) {
+			const std::pair<uint16_t, uint16_t> &other_pos = m_user_map[v];
+
+			if (v == b->index || (v < b->index) == (other_pos < pos))
+				continue;
+
+			other_acc.clear();
+			if (!m_user_cmds[v]->get_accesses(other_acc) ||
+			    accesses_conflict(acc, other_acc))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+NNPError nnpiCommandList::rebind(const std::vector<Binding> &bindings)
+{
+	std::lock_guard<std::mutex> sched_lock(m_sched_mutex);
+	std::lock_guard<std::mutex> lock(m_waitq.mutex());
+	std::vector<Binding> swapped(bindings);
+	uint16_t vec_idx, sub_idx;
+
+	if (!m_context->has_feature(NNP_IPC_CTX_FEATURE_CMDLIST_REBIND))
+		return NNP_NOT_SUPPORTED;
 
-	for (i = 0; i < m_vec.size() && usr_idx >= m_vec[i]->num_of_subcmds(); ++i)
-		usr_idx -= m_vec[i]->num_of_subcmds();
+	if (!m_finalized)
+		return NNP_DEVICE_BUSY;
+
+	/* completions release host resource locks through the bound copies */
+	if (m_scheduled != m_completed)
+		return NNP_DEVICE_BUSY;
+
+	/* a copy was dropped as it repeated the same bound copy */
+	if (!m_dropped.empty())
+		return NNP_NOT_SUPPORTED;
 
-	if (i >= m_vec.size())
-		return NULL;
+	for (auto b = bindings.begin(); b != bindings.end(); ++b) {
+		if (!find_cmd(b->index, vec_idx, sub_idx))
+			return NNP_INVALID_ARGUMENT;
+
+		nnpiInfCommandSchedParams *cmd = leaf_cmd(vec_idx, sub_idx);
+
+		if (cmd->type() == CMDLIST_CMD_COPY) {
+			if (!b->copy.get())
+				return NNP_NO_SUCH_COPY_HANDLE;
+			if (!static_cast<nnpiInfCopyCommandSchedParams *>(cmd)->copy()->same_shape(*b->copy))
+				return NNP_INVALID_ARGUMENT;
+		} else {
+			if (!b->infreq.get())
+				return NNP_NO_SUCH_INFREQ_HANDLE;
+			if (!static_cast<nnpiInfReqSchedParams *>(cmd)->infreq()->same_shape(*b->infreq))
+				return NNP_INVALID_ARGUMENT;
+		}
+	}
 
-	if (!m_vec[i]->is_edited())
-		++m_num_edits;
+	/* a new object is still used by a command list being created */
+	if (m_context->test_create_refs([&bindings] {
+			for (auto b = bindings.begin(); b != bindings.end(); ++b)
+				if (b->copy.get() ? b->copy->create_refs() > 0 :
+						    b->infreq->create_refs() > 0)
+					return true;
+			return false;
+		}))
+		return NNP_DEVICE_BUSY;
 
-	return m_vec[i]->get_cmd_for_overwrite(usr_idx);
+	swap_bindings(swapped, false);
+
+	if (!m_user_cmds.empty() && !bindings_keep_order(bindings)) {
+		swap_bindings(swapped, true);
+		return NNP_INVALID_ARGUMENT;
+	}
+
+	for (auto b = bindings.begin(); b != bindings.end(); ++b) {
+		find_cmd(b->index, vec_idx, sub_idx);
+
+		if (!m_vec[vec_idx]->is_edited())
+			++m_num_edits;
+		m_vec[vec_idx]->get_cmd_for_overwrite(sub_idx);
+
+		if (m_vec[vec_idx]->type() == CMDLIST_CMD_COPYLIST)
+			static_cast<nnpiCopyListParams *>(m_vec[vec_idx])->update_need_prepare();
+	}
+
+	return NNP_NO_ERROR;
 }
 
 static int get_cmdlist_opt_dependencies(void)
@@ -84,7 +326,9 @@ static int get_cmdlist_opt_dependencies(void)
 	return val;
 }
 
-NNPError nnpiCommandList::send_to_card(uint8_t opcode)
+NNPError nnpiCommandList::send_to_card(uint8_t   opcode,
+				       uint8_t   priority,
+				       uint64_t *out_stall_us)
 {
 	NNPError ret = NNP_NO_ERROR;
 	union h2c_ChanInferenceCmdListOp msg;
@@ -110,42 +354,61 @@ NNPError nnpiCommandList::send_to_card(uint8_t opcode)
 	}
 
 	if (m_num_edits == 0) {
-		if (m_context->chan()->write(&msg, sizeof(msg)) != sizeof(msg))
+		if (m_context->chan()->write_batched(&msg, sizeof(msg)) != sizeof(msg))
 			return NNP_IO_ERROR;
 		return NNP_NO_ERROR;
 	}
 
+	/* all commands are edited, the arena is the payload */
+	bool bulk = m_enc_full;
+	size_t unit = 0;
+	auto it = m_vec.begin();
+	auto done = [&] { return bulk ? unit + 1 >= m_enc_units.size() : it == m_vec.end(); };
+
 	nnpiRingBuffer::ptr cmd_ring(m_context->chan()->commandRingBuffer(rb_id));
 
-	for (auto it = m_vec.begin(); it != m_vec.end(); ) {
-		uint32_t cont;
-		uint8_t *ptr = (uint8_t *)cmd_ring->lockFreeSpace(NNP_PAGE_SIZE, cont);
+	/*
+	 * Uploads to the execute ring are granted in submit queue priority
+	 * order, so a high priority schedule does not wait behind queued
+	 * large uploads of lower priority queues.
+	 */
+	if (rb_id == 1) {
+		uint64_t stall_us = m_context->execRingLock().lock(priority);
+
+		if (out_stall_us)
+			*out_stall_us += stall_us;
+	}
+
+	while (!done()) {
+		uint8_t *ptr = (uint8_t *)cmd_ring->lockPayload(cmd_ring->maxPayload());
 		if (ptr == NULL) {
 			ret = NNP_IO_ERROR;
 			break;
-		} else if (cont != NNP_PAGE_SIZE) {
-			cmd_ring->unlockFreeSpace(0);
-			ret = NNP_IO_ERROR;
-			break;
 		}
 
 		uint8_t *p = ptr;
-		uint8_t *buf_end = ptr + NNP_PAGE_SIZE;
+		uint8_t *buf_end = ptr + cmd_ring->maxPayload();
 
 		if (msg.is_first == 1) {
 			*((uint32_t *)p) = (uint32_t)m_num_edits;
 			p += 4;
 		}
 
-		while (it != m_vec.end() && p < buf_end) {
-			if ((*it)->pack(p, buf_end - p))
-				++it;
-			else
-				break;
+		if (bulk) {
+			pack_encoded(unit, p, buf_end);
+		} else {
+			while (it != m_vec.end() && p < buf_end) {
+				if ((*it)->pack(p, buf_end - p))
+					++it;
+				else
+					break;
+			}
 		}
 
 		msg.size = p - ptr;
-		msg.is_last = (it == m_vec.end() ? 1 : 0);
+		msg.is_last = (done() ? 1 : 0);
+
+		cmd_ring->setPayloadSize(msg.size);
 
 		if (m_context->chan()->write(&msg, sizeof(msg)) != sizeof(msg)) {
 			cmd_ring->unlockFreeSpace(0);
@@ -153,19 +416,71 @@ NNPError nnpiCommandList::send_to_card(uint8_t opcode)
 			break;
 		}
 
-		cmd_ring->unlockFreeSpace(NNP_PAGE_SIZE);
+		cmd_ring->unlockPayload(msg.size);
 		msg.is_first = 0;
 	}
 
-	if (ret != NNP_NO_ERROR) {
+	if (rb_id == 1)
+		m_context->execRingLock().unlock();
+
+	if (ret != NNP_NO_ERROR || bulk) {
 		for (auto it = m_vec.begin(); it != m_vec.end(); ++it)
 			(*it)->clear_edits();
 	}
 	m_num_edits = 0;
+	m_enc_full = false;
+
+	m_context->chan()->checkCommandRingBufferGrow(rb_id);
 
 	return ret;
 }
 
+/*
+ * Copies the whole encoding units of the arena, starting at unit,
+ * which fit in the page.
+ */
+void nnpiCommandList::pack_encoded(size_t &unit, uint8_t *&p, uint8_t *buf_end)
+{
+	size_t end = unit;
+	uint32_t len;
+
+	while (end + 1 < m_enc_units.size() &&
+	       m_enc_units[end + 1] - m_enc_units[unit] <= (size_t)(buf_end - p))
+		++end;
+
+	len = m_enc_units[end] - m_enc_units[unit];
+	memcpy(p, m_enc.data() + m_enc_units[unit], len);
+	p += len;
+	unit = end;
+}
+
+/* m_waitq mutex must be held, the commands order is final */
+void nnpiCommandList::build_encoding()
+{
+	uint32_t size = 0, off = 0;
+
+	for (auto it = m_vec.begin(); it != m_vec.end(); ++it) {
+		size += (*it)->enc_size();
+		if ((*it)->type() == CMDLIST_CMD_COPYLIST) {
+			const std::vector<nnpiInfCopyCommandSchedParams *> &copies =
+				static_cast<nnpiCopyListParams *>(*it)->copies();
+
+			for (auto c = copies.begin(); c != copies.end(); ++c)
+				size += (*c)->enc_size();
+		}
+	}
+
+	m_enc.resize(size);
+	m_enc_units.clear();
+	m_enc_units.reserve(m_vec.size() + 1);
+	for (auto it = m_vec.begin(); it != m_vec.end(); ++it)
+		(*it)->bind_encoding(&m_enc, off, m_enc_units);
+	m_enc_units.push_back(off);
+
+	/* every command is edited, unless a previous create request failed */
+	m_enc_full = (m_num_edits == m_vec.size());
+}
+
 nnpiInfCommandSchedParams* nnpiCommandList::getCommand(uint16_t idx)
 {
 	return m_vec.at(idx);
@@ -176,23 +491,138 @@ NNPError nnpiCommandList::finalize(uint32_t optFlags)
 	std::lock_guard<std::mutex> lock(m_waitq.mutex());
 	NNPError ret;
 
+	ret = send_create(optFlags);
+	if (ret != NNP_NO_ERROR)
+		return ret;
+
+	return wait_create();
+}
+
+NNPError nnpiCommandList::finalize_all(const std::vector<nnpiCommandList::ptr> &cmdlists,
+				       uint32_t                                 optFlags)
+{
+	NNPError ret = NNP_NO_ERROR;
+	size_t n_sent;
+
+	for (n_sent = 0; n_sent < cmdlists.size(); ++n_sent) {
+		std::lock_guard<std::mutex> lock(cmdlists[n_sent]->m_waitq.mutex());
+
+		ret = cmdlists[n_sent]->send_create(optFlags);
+		if (ret != NNP_NO_ERROR)
+			break;
+	}
+
+	/* replies of all sent requests are consumed even if a send failed */
+	for (size_t i = 0; i < n_sent; ++i) {
+		std::lock_guard<std::mutex> lock(cmdlists[i]->m_waitq.mutex());
+		NNPError rc = cmdlists[i]->wait_create();
+
+		if (ret == NNP_NO_ERROR)
+			ret = rc;
+	}
+
+	return ret;
+}
+
+NNPError nnpiCommandList::finalize_async(uint32_t optFlags)
+{
+	std::lock_guard<std::mutex> lock(m_waitq.mutex());
+
+	return send_create(optFlags);
+}
+
+NNPError nnpiCommandList::wait_created(uint32_t timeoutUs)
+{
+	std::lock_guard<std::mutex> lock(m_waitq.mutex());
+
+	if (m_create_pending)
+		return wait_create(timeoutUs);
+
+	return m_finalized ? NNP_NO_ERROR : m_create_status;
+}
+
+void nnpiCommandList::release_create_refs()
+{
+	if (!m_holds_create_refs)
+		return;
+
+	for (auto it = m_vec.begin(); it != m_vec.end(); ++it)
+		(*it)->add_create_refs(-1);
+	m_holds_create_refs = false;
+}
+
+/* context waitq must be held */
+bool nnpiCommandList::has_create_refs()
+{
+	for (auto it = m_vec.begin(); it != m_vec.end(); ++it)
+		if ((*it)->has_create_refs())
+			return true;
+
+	return false;
+}
+
+/*
+ * m_waitq mutex must be held.
+ * Until the device replies, schedules of the copies and infer requests
+ * of the list wait, other schedules on the context are not held.
+ */
+NNPError nnpiCommandList::send_create(uint32_t optFlags)
+{
+	NNPError ret;
+
+	if (m_finalized || m_create_pending)
+		return NNP_DEVICE_BUSY;
+
+	if ((optFlags & (REORDER_COPIES | DROP_REDUNDANT_COPIES)) != 0)
+		optimize_reorder_copies((optFlags & REORDER_COPIES) != 0,
+					(optFlags & DROP_REDUNDANT_COPIES) != 0);
 	if ((optFlags & BATCH_COPIES) != 0)
 		optimize_batch_copies();
+	build_user_map();
+	build_encoding();
 
-	m_context->cmdlist_finalized_add(1);
+	m_context->update_create_refs([this] {
+		for (auto it = m_vec.begin(); it != m_vec.end(); ++it)
+			(*it)->add_create_refs(1);
+		m_holds_create_refs = true;
+	});
 
 	ret = send_to_card(NNP_IPC_H2C_OP_CHAN_INF_CMDLIST);
 	if (ret != NNP_NO_ERROR) {
-		m_context->cmdlist_finalized_add(-1);
+		m_context->update_create_refs([this] { release_create_refs(); });
+		m_create_status = ret;
 		return ret;
 	}
 
+	m_create_pending = true;
+
+	return NNP_NO_ERROR;
+}
+
+/* m_waitq mutex must be held */
+NNPError nnpiCommandList::wait_create(uint32_t timeout_us)
+{
 	union c2h_event_report reply;
 	int rc = m_context->wait_create_command(InfContextObjID(INF_OBJ_TYPE_CMD, m_protocolID),
-						reply);
-	if (rc != 0)
-		return NNP_IO_ERROR;
+						reply,
+						timeout_us);
+	if (rc == -ETIMEDOUT)
+		return NNP_TIMED_OUT;
+
+	m_create_pending = false;
+	m_create_status = (rc != 0 ? NNP_IO_ERROR : create_reply_status(reply));
+	if (m_create_status != NNP_NO_ERROR)
+		return m_create_status;
+
+	m_context->send_user_handle(INF_OBJ_TYPE_CMD, m_protocolID, 0, m_user_hdl);
+
+	m_finalized = true;
+
+	return NNP_NO_ERROR;
+}
 
+NNPError nnpiCommandList::create_reply_status(const union c2h_event_report &reply)
+{
 	if (reply.event_code == NNP_IPC_CREATE_CMD_FAILED)
 		return event_valToNNPError(reply.event_val);
 	else if (is_context_fatal_event(reply.event_code))
@@ -200,11 +630,7 @@ NNPError nnpiCommandList::finalize(uint32_t optFlags)
 	else if (reply.event_code != NNP_IPC_CREATE_CMD_SUCCESS)
 		return NNP_IO_ERROR;
 
-	m_context->send_user_handle(INF_OBJ_TYPE_CMD, m_protocolID, 0, m_user_hdl);
-
-	m_finalized = true;
-
-	return ret;
+	return NNP_NO_ERROR;
 }
 
 NNPError nnpiCommandList::destroy()
@@ -212,6 +638,9 @@ NNPError nnpiCommandList::destroy()
 	std::lock_guard<std::mutex> lock(m_waitq.mutex());
 	union h2c_ChanInferenceCmdListOp msg;
 
+	if (m_create_pending)
+		wait_create();
+
 	if (!m_finalized) {
 		m_context->objdb()->removeCommandList(m_protocolID);
 		return NNP_NO_ERROR;
@@ -232,47 +661,158 @@ NNPError nnpiCommandList::destroy()
 	return NNP_NO_ERROR;
 }
 
-NNPError nnpiCommandList::schedule()
+NNPError nnpiCommandList::schedule(uint8_t   priority,
+				   uint64_t *out_stall_us,
+				   uint64_t *out_instance)
 {
+	std::lock_guard<std::mutex> sched_lock(m_sched_mutex);
+	uint64_t instance;
 	NNPError ret;
 
+	if (m_context->capturing() && capture(ret))
+		return ret;
+
 	m_waitq.lock();
-	if (!m_finalized || m_in_flight ||
+	if (m_create_pending)
+		wait_create(0);
+
+	if (!m_finalized || m_scheduled - m_completed >= m_depth ||
 	    m_failed_commands > 0 || m_errorList.numErrors() > 0) {
 		m_waitq.unlock();
 		return NNP_DEVICE_BUSY;
 	}
 
-	if (!m_context->wait_can_schedule()) {
-		m_waitq.unlock();
+	/*
+	 * Reserve the instance before waiting on the context gate, the
+	 * response thread needs m_waitq to complete earlier instances.
+	 */
+	instance = ++m_scheduled;
+	m_waitq.unlock();
+
+	if (!m_context->wait_can_schedule([this] { return !has_create_refs(); })) {
+		cancel_instance();
 		return NNP_CONTEXT_BROKEN;
 	}
 
-	m_in_flight = true;
-	m_waitq.unlock();
-
 	for (uint16_t i = 0; i < m_vec.size(); ++i)
 		if (!m_vec[i]->prepare_schedule()) {
 			while (i > 0)
 				m_vec[--i]->schedule_done();
-			m_waitq.update_and_notify([this]{ m_in_flight = false; });
+			cancel_instance();
 			return NNP_DEVICE_BUSY;
 		}
 
-	ret = send_to_card(NNP_IPC_H2C_OP_CHAN_SCHEDULE_CMDLIST);
+	ret = send_to_card(NNP_IPC_H2C_OP_CHAN_SCHEDULE_CMDLIST, priority, out_stall_us);
 
 	if (ret != NNP_NO_ERROR) {
 		for (uint16_t i = 0; i < m_vec.size(); ++i)
 			m_vec[i]->schedule_done();
-		m_waitq.update_and_notify([this]{ m_in_flight = false; });
+		cancel_instance();
+	} else if (out_instance) {
+		*out_instance = instance;
 	}
 
 	return ret;
 }
 
+/*
+ * Drops an instance reserved by schedule which was not sent,
+ * complete_all may have already counted it as completed.
+ */
+void nnpiCommandList::cancel_instance()
+{
+	m_waitq.update_and_notify([this]{
+					m_scheduled--;
+					if (m_completed > m_scheduled)
+						m_completed = m_scheduled;
+				  });
+}
+
+/*
+ * Appends a copy of each command to the context capture list,
+ * returns false if the context is not capturing.
+ */
+bool nnpiCommandList::capture(NNPError &ret)
+{
+	bool finalized;
+
+	{
+		std::lock_guard<std::mutex> lock(m_waitq.mutex());
+
+		if (m_create_pending)
+			wait_create(0);
+		finalized = m_finalized;
+	}
+
+	if (!finalized) {
+		ret = NNP_DEVICE_BUSY;
+		return true;
+	}
+
+	return m_context->capture([this](nnpiArena                                &arena,
+					 std::vector<nnpiInfCommandSchedParams *> &cmds) {
+		for_each_command([&arena, &cmds](nnpiInfCommandSchedParams *cmd) {
+			if (cmd->type() == CMDLIST_CMD_COPY) {
+				cmds.push_back(new (arena) nnpiInfCopyCommandSchedParams(
+					*static_cast<nnpiInfCopyCommandSchedParams *>(cmd)));
+			} else {
+				nnpiInfReqSchedParams *infreq_cmd = static_cast<nnpiInfReqSchedParams *>(cmd);
+				nnpdrvinfSchedParams params;
+				bool has_params = infreq_cmd->get_params(&params);
+
+				cmds.push_back(new (arena) nnpiInfReqSchedParams(infreq_cmd->infreq(),
+										 has_params ? &params : NULL));
+			}
+		});
+	}, ret);
+}
+
 void nnpiCommandList::complete()
 {
-	m_waitq.update_and_notify([this]{ m_in_flight = false; });
+	uint32_t num_errors;
+
+	m_waitq.update_and_notify([this, &num_errors]{
+					if (m_completed < m_scheduled)
+						m_completed++;
+					num_errors = m_failed_commands + m_errorList.numErrors();
+				  });
+	m_event.signal(m_user_hdl, num_errors);
+}
+
+void nnpiCommandList::complete_all()
+{
+	uint32_t num_errors;
+
+	m_waitq.update_and_notify([this, &num_errors]{
+					m_completed = m_scheduled;
+					num_errors = m_failed_commands + m_errorList.numErrors();
+				  });
+	m_event.signal(m_user_hdl, num_errors);
+}
+
+NNPError nnpiCommandList::set_depth(uint32_t depth)
+{
+	std::lock_guard<std::mutex> lock(m_waitq.mutex());
+
+	if (depth == 0)
+		return NNP_INVALID_ARGUMENT;
+
+	if (depth > 1 && !m_context->has_feature(NNP_IPC_CTX_FEATURE_CMDLIST_PIPELINE))
+		return NNP_NOT_SUPPORTED;
+
+	m_depth = depth;
+
+	return NNP_NO_ERROR;
+}
+
+void nnpiCommandList::query_instances(uint64_t *out_scheduled, uint64_t *out_completed)
+{
+	std::lock_guard<std::mutex> lock(m_waitq.mutex());
+
+	if (out_scheduled)
+		*out_scheduled = m_scheduled;
+	if (out_completed)
+		*out_completed = m_completed;
 }
 
 void nnpiCommandList::addError(union c2h_event_report *ev)
@@ -303,29 +843,32 @@ NNPError nnpiCommandList::clearErrors()
 
 NNPError nnpiCommandList::wait(uint32_t              timeout_us,
 			       NNPCriticalErrorInfo *out_errors,
-			       uint32_t             *num_errors)
+			       uint32_t             *num_errors,
+			       uint64_t              instance)
 {
 	NNPError ret = NNP_NO_ERROR;
 
 	if (!num_errors)
 		return NNP_INVALID_ARGUMENT;
 
-	auto cond = [this] {
-		bool rc = !m_in_flight || (m_context->broken() && !m_context->aborted());
+	if (m_context->chan()->flushBatch() != 0)
+		return NNP_IO_ERROR;
+
+	auto cond = [this, instance] {
+		bool rc = m_completed >= (instance ? instance : m_scheduled) ||
+			  (m_context->broken() && !m_context->aborted());
 		return rc;
 	};
 
-	bool found;
-
-	if (timeout_us == UINT32_MAX) {
-		m_waitq.wait_lock(cond);
-		found = true;
-	} else {
-		found = m_waitq.wait_timeout_lock(timeout_us, cond);
-	}
+	bool found = m_waitq.wait_policy_lock(m_context->waitPolicy(),
+					      timeout_us,
+					      &m_context->waitStats(),
+					      cond);
 
 	if (!found)
 		ret = NNP_TIMED_OUT;
+	else if (instance > m_scheduled)
+		ret = NNP_INVALID_ARGUMENT;
 	else if (m_context->broken())
 		ret = NNP_CONTEXT_BROKEN;
 
@@ -395,8 +938,8 @@ void nnpiCommandList::optimize_batch_copies()
 				++new_idx;
 			} else {
 				nnpiCopyListParams *listp =
-					new nnpiCopyListParams((nnpiInfCopyCommandSchedParams**)&m_vec[batch_start_idx],
-							       batch_size);
+					new (m_cmd_arena) nnpiCopyListParams((nnpiInfCopyCommandSchedParams**)&m_vec[batch_start_idx],
+									     batch_size);
 				new_list.push_back(listp);
 				new_list.back()->set_index(new_idx);
 				++new_idx;
@@ -415,3 +958,186 @@ void nnpiCommandList::optimize_batch_copies()
 	m_vec = new_list;
 	m_num_edits = m_vec.size();
 }
+
+static bool is_batchable_copy(const nnpiInfCommandSchedParams *cmd)
+{
+	return cmd->type() == CMDLIST_CMD_COPY &&
+	       !static_cast<const nnpiInfCopyCommandSchedParams *>(cmd)->copy()->is_d2d();
+}
+
+/*
+ * A copy is redundant if the same copy, with the same size and
+ * priority, is found earlier in the list and no command in between
+ * writes a resource the copy reads or writes.
+ */
+bool nnpiCommandList::is_redundant_copy(uint16_t                                  idx,
+					const std::vector<nnpiResAccess::vec>    &acc,
+					const std::vector<bool>                  &known) const
+{
+	const uint16_t MAX_SCAN_DISTANCE = 256;
+	const nnpiInfCopyCommandSchedParams *copy_cmd;
+
+	if (m_vec[idx]->type() != CMDLIST_CMD_COPY || !known[idx])
+		return false;
+
+	copy_cmd = static_cast<const nnpiInfCopyCommandSchedParams *>(m_vec[idx]);
+
+	for (uint16_t n = 0, j = idx; j > 0 && n < MAX_SCAN_DISTANCE; ++n) {
+		const nnpiInfCommandSchedParams *prev = m_vec[--j];
+
+		if (prev->type() == CMDLIST_CMD_COPY) {
+			const nnpiInfCopyCommandSchedParams *prev_copy =
+				static_cast<const nnpiInfCopyCommandSchedParams *>(prev);
+
+			if (prev_copy->copy() == copy_cmd->copy() &&
+			    prev_copy->requested_size() == copy_cmd->requested_size() &&
+			    prev_copy->priority() == copy_cmd->priority())
+				return true;
+		}
+
+		if (!known[j])
+			return false;
+
+		for (auto a = acc[j].begin(); a != acc[j].end(); ++a) {
+			if (!a->write)
+				continue;
+			for (auto b = acc[idx].begin(); b != acc[idx].end(); ++b)
+				if (a->res == b->res)
+					return false;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * If reorder is set, moves each host copy back to right after the
+ * closest preceding copy of the same direction, if no command it passes
+ * accesses a resource of the copy in a conflicting way (at least one of
+ * them writes it). Independent copies interleaved with infer requests
+ * are grouped, so optimize_batch_copies sends them to the device as one
+ * copy list. Conflicting commands keep their relative order.
+ * If drop_redundant is set, drops copies which repeat an earlier copy
+ * whose resources were not written since.
+ *
+ * Only copies are moved: infer requests keep their order, moving a copy
+ * past an infer request already covers the grouping. Adjacent copies of
+ * contiguous ranges are not merged, the ranges of a copy are fixed by
+ * its copy handle on the device, so merging would need a device copy
+ * object per merged range.
+ */
+void nnpiCommandList::optimize_reorder_copies(bool reorder, bool drop_redundant)
+{
+	const uint16_t MAX_REORDER_DISTANCE = 256;
+	std::vector<nnpiResAccess::vec> acc(m_vec.size());
+	std::vector<bool> known(m_vec.size());
+	std::vector<uint16_t> order;
+	nnpiInfCommandSchedParams::vec user_cmds;
+	bool changed = false;
+
+	/* the first optimization already recorded the append order */
+	if (!m_user_cmds.empty())
+		return;
+
+	for (uint16_t i = 0; i < m_vec.size(); i++)
+		known[i] = m_vec[i]->get_accesses(acc[i]);
+
+	order.reserve(m_vec.size());
+	for (uint16_t i = 0; i < m_vec.size(); i++) {
+		size_t pos = order.size();
+
+		if (drop_redundant && is_redundant_copy(i, acc, known)) {
+			changed = true;
+			continue;
+		}
+
+		if (reorder && known[i] && is_batchable_copy(m_vec[i])) {
+			bool c2h = static_cast<nnpiInfCopyCommandSchedParams *>(m_vec[i])->copy()->is_c2h();
+
+			for (size_t k = order.size(), n = 0; k > 0 && n < MAX_REORDER_DISTANCE; --k, ++n) {
+				uint16_t j = order[k - 1];
+
+				if (is_batchable_copy(m_vec[j]) &&
+				    static_cast<nnpiInfCopyCommandSchedParams *>(m_vec[j])->copy()->is_c2h() == c2h) {
+					pos = k;
+					break;
+				}
+
+				if (!known[j] || accesses_conflict(acc[j], acc[i]))
+					break;
+			}
+		}
+
+		if (pos != order.size())
+			changed = true;
+		order.insert(order.begin() + pos, i);
+	}
+
+	if (!changed)
+		return;
+
+	for (auto it = m_vec.begin(); it != m_vec.end(); ++it) {
+		if ((*it)->type() == CMDLIST_CMD_COPYLIST) {
+			const std::vector<nnpiInfCopyCommandSchedParams *> &copies =
+				static_cast<nnpiCopyListParams *>(*it)->copies();
+
+			user_cmds.insert(user_cmds.end(), copies.begin(), copies.end());
+		} else {
+			user_cmds.push_back(*it);
+		}
+	}
+
+	nnpiInfCommandSchedParams::vec new_list;
+	std::vector<bool> kept(m_vec.size(), false);
+
+	for (uint16_t i = 0; i < order.size(); i++) {
+		new_list.push_back(m_vec[order[i]]);
+		new_list.back()->set_index(i);
+		kept[order[i]] = true;
+	}
+
+	for (uint16_t i = 0; i < m_vec.size(); i++)
+		if (!kept[i])
+			m_dropped.push_back(m_vec[i]);
+
+	m_user_cmds = user_cmds;
+	m_vec = new_list;
+	m_num_edits = m_vec.size();
+}
+
+/* maps the append order index of each command to its place in m_vec */
+void nnpiCommandList::build_user_map()
+{
+	std::unordered_map<nnpiInfCommandSchedParams *, std::pair<uint16_t, uint16_t> > place;
+
+	m_user_map.clear();
+
+	/* the order did not change, commands are only batched */
+	if (m_user_cmds.empty()) {
+		for (uint16_t i = 0; i < m_vec.size(); i++)
+			for (uint16_t j = 0; j < m_vec[i]->num_of_subcmds(); j++)
+				m_user_map.push_back(std::make_pair(i, j));
+		return;
+	}
+
+	for (uint16_t i = 0; i < m_vec.size(); i++) {
+		if (m_vec[i]->type() == CMDLIST_CMD_COPYLIST) {
+			const std::vector<nnpiInfCopyCommandSchedParams *> &copies =
+				static_cast<nnpiCopyListParams *>(m_vec[i])->copies();
+
+			for (uint16_t j = 0; j < copies.size(); j++)
+				place[copies[j]] = std::make_pair(i, j);
+		} else {
+			place[m_vec[i]] = std::make_pair(i, (uint16_t)0);
+		}
+	}
+
+	for (auto it = m_user_cmds.begin(); it != m_user_cmds.end(); ++it) {
+		auto p = place.find(*it);
+
+		if (p != place.end())
+			m_user_map.push_back(p->second);
+		else
+			m_user_map.push_back(std::make_pair((uint16_t)UINT16_MAX, (uint16_t)0));
+	}
+}
@@ -13,7 +13,17 @@
 #include <mutex>
 #include <memory>
 #include <assert.h>
+#include <string.h>
 #include "nnpiExecErrorList.h"
+#include "nnpiUtils.h"
+
+/* a device or host resource read or written by a command */
+struct nnpiResAccess {
+	typedef std::vector<nnpiResAccess> vec;
+
+	const void *res;
+	bool        write;
+};
 
 class nnpiInfCommandSchedParams {
 public:
@@ -23,12 +33,70 @@ public:
 	{
 	}
 
+	/*
+	 * Commands are placed in the command arena of the list they are
+	 * appended to, new (cmdlist->cmd_arena()) T(...), and delete only
+	 * destructs them.
+	 */
+	static void *operator new(size_t size) = delete;
+	static void *operator new(size_t size, nnpiArena &arena);
+	static void operator delete(void *p);
+	static void operator delete(void *p, nnpiArena &arena);
+
 	CmdListCommandType type() const { return m_type; }
+	uint8_t priority() const { return m_priority; }
+
+	/* wire encoding of the command, as written to the command ring */
+	virtual uint32_t enc_size() const = 0;
+	virtual void encode(uint8_t *p) const = 0;
+
+	/*
+	 * Encodes the command at off in the command list arena and keeps it
+	 * bound there, edits then update the encoded bytes in place.
+	 * units receives the offset of each unit which may start a ring page.
+	 */
+	virtual void bind_encoding(std::vector<uint8_t>  *arena,
+				   uint32_t              &off,
+				   std::vector<uint32_t> &units)
+	{
+		units.push_back(off);
+		m_arena = arena;
+		m_enc_off = off;
+		m_enc_len = enc_size();
+		encode(arena->data() + off);
+		off += m_enc_len;
+	}
+
+	virtual bool pack(uint8_t *&p, uint32_t size)
+	{
+		uint32_t len;
+
+		if (!m_edited)
+			return true;
+
+		len = enc_size();
+		if (size < len)
+			return false;
+
+		if (m_arena)
+			memcpy(p, m_arena->data() + m_enc_off, len);
+		else
+			encode(p);
+		p += len;
+
+		m_edited = false;
+
+		return true;
+	}
 
-	virtual bool pack(uint8_t *&ptr, uint32_t size) = 0;
 	virtual bool prepare_schedule() = 0;
 	virtual void schedule_done(nnpiExecErrorList *error_list = nullptr) = 0;
-	virtual void set_index(uint16_t idx) { m_idx = idx; }
+	/* context waitq must be held */
+	virtual void add_create_refs(int delta) = 0;
+	virtual bool has_create_refs() = 0;
+	/* returns false if the accessed resources are not known */
+	virtual bool get_accesses(nnpiResAccess::vec &out) const = 0;
+	virtual void set_index(uint16_t idx) { m_idx = idx; update_encoding(); }
 	virtual bool is_edited() { return m_edited; }
 	virtual void clear_edits() { m_edited = false; }
 	virtual uint16_t num_of_subcmds() { return 1; }
@@ -48,14 +116,33 @@ protected:
 		m_type(cmdType),
 		m_priority(priority),
 		m_idx(USHRT_MAX),
-		m_edited(true)
+		m_edited(true),
+		m_arena(NULL),
+		m_enc_off(0),
+		m_enc_len(0)
 	{
 	}
 
+	/* refreshes the arena encoding after an edit */
+	void update_encoding()
+	{
+		if (!m_arena)
+			return;
+
+		/* an edit which grows the encoding unbinds, pack then encodes */
+		if (enc_size() > m_enc_len)
+			m_arena = NULL;
+		else
+			encode(m_arena->data() + m_enc_off);
+	}
+
 	const CmdListCommandType m_type;
 	uint8_t                  m_priority;
 	uint16_t                 m_idx;
 	bool                     m_edited;
+	std::vector<uint8_t>    *m_arena;
+	uint32_t                 m_enc_off;
+	uint32_t                 m_enc_len;
 };
 
 
@@ -66,6 +153,7 @@ public:
 				      size_t               size) :
 		nnpiInfCommandSchedParams(CMDLIST_CMD_COPY, priority),
 		m_copy(copy),
+		m_req_size(size),
 		m_size(std::min(size, copy->max_size()))
 	{
 	}
@@ -73,6 +161,7 @@ public:
 	nnpiInfCopyCommandSchedParams(nnpiInfCopyCommandSchedParams &other) :
 		nnpiInfCommandSchedParams(CMDLIST_CMD_COPY, other.m_priority),
 		m_copy(other.m_copy),
+		m_req_size(other.m_req_size),
 		m_size(other.m_size)
 	{
 	}
@@ -80,32 +169,34 @@ public:
 	virtual void overwrite(uint8_t priority, size_t size)
 	{
 		m_priority = priority;
+		m_req_size = size;
 		m_size = std::min(size, m_copy->max_size());
+		update_encoding();
 	}
 
 	virtual ~nnpiInfCopyCommandSchedParams()
 	{
 	}
 
-	nnpiCopyCommand::ptr copy() { return m_copy; }
+	nnpiCopyCommand::ptr copy() const { return m_copy; }
+	size_t requested_size() const { return m_req_size; }
 
-	virtual bool pack(uint8_t *&p, uint32_t size)
+	/* copy must have the same shape as the bound copy */
+	void rebind(const nnpiCopyCommand::ptr &copy)
 	{
-		if (!m_edited)
-			return true;
+		m_copy = copy;
+		update_encoding();
+	}
 
-		if (size < 16)
-			return false;
+	virtual uint32_t enc_size() const { return 16; }
 
+	virtual void encode(uint8_t *p) const
+	{
 		*((uint32_t *)p) = m_idx; p += 4;
 		*((uint8_t *)p) = m_type; p += 1;
 		*((uint16_t *)p) = m_copy->id(); p += 2;
 		*((uint8_t *)p) = m_priority; p += 1;
-		*((uint64_t *)p) = m_size; p += 8;
-
-		m_edited = false;
-
-		return true;
+		*((uint64_t *)p) = m_size;
 	}
 
 	bool is_need_prepare()
@@ -123,8 +214,36 @@ public:
 		m_copy->postSchedule(error_list);
 	}
 
+	virtual void add_create_refs(int delta)
+	{
+		m_copy->create_refs() += delta;
+	}
+
+	virtual bool has_create_refs()
+	{
+		return m_copy->create_refs() > 0;
+	}
+
+	virtual bool get_accesses(nnpiResAccess::vec &out) const
+	{
+		/* the host resource of a sub-resource copy is given at schedule */
+		if (m_copy->is_subres())
+			return false;
+
+		if (m_copy->is_d2d()) {
+			out.push_back({ m_copy->src_devres().get(), false });
+			out.push_back({ m_copy->devres().get(), true });
+		} else {
+			out.push_back({ m_copy->hostres().get(), m_copy->is_c2h() });
+			out.push_back({ m_copy->devres().get(), !m_copy->is_c2h() });
+		}
+
+		return true;
+	}
+
 private:
 	nnpiCopyCommand::ptr m_copy;
+	size_t               m_req_size;
 	size_t               m_size;
 };
 
@@ -151,18 +270,40 @@ public:
 		m_copy_params.clear();
 	}
 
+	/* the header, copies are encoded separately */
+	virtual uint32_t enc_size() const { return 7; }
+
+	virtual void encode(uint8_t *p) const
+	{
+		*((uint32_t *)p) = m_idx; p += 4;
+		*((uint8_t *)p) = m_type; p += 1;
+		*((uint16_t *)p) = (uint16_t)m_num_edits;
+	}
+
+	virtual void bind_encoding(std::vector<uint8_t>  *arena,
+				   uint32_t              &off,
+				   std::vector<uint32_t> &units)
+	{
+		/* the edit count in the header changes, it is encoded on pack */
+		units.push_back(off);
+		encode(arena->data() + off);
+		off += enc_size();
+
+		for (uint16_t i = 0; i < m_copy_params.size(); ++i)
+			m_copy_params[i]->bind_encoding(arena, off, units);
+	}
+
 	virtual bool pack(uint8_t *&p, uint32_t size)
 	{
 		if (m_edited) {
 			assert(m_num_edits > 0);
 
-			if (size < 7)
+			if (size < enc_size())
 				return false;
 
-			size -= 7;
-			*((uint32_t *)p) = m_idx; p += 4;
-			*((uint8_t *)p) = m_type; p += 1;
-			*((uint16_t *)p) = (uint16_t)m_num_edits; p += 2;
+			size -= enc_size();
+			encode(p);
+			p += enc_size();
 
 			m_edited = false;
 		}
@@ -207,6 +348,30 @@ public:
 		}
 	}
 
+	virtual void add_create_refs(int delta)
+	{
+		for (uint16_t i = 0; i < m_copy_params.size(); ++i)
+			m_copy_params[i]->add_create_refs(delta);
+	}
+
+	virtual bool has_create_refs()
+	{
+		for (uint16_t i = 0; i < m_copy_params.size(); ++i)
+			if (m_copy_params[i]->has_create_refs())
+				return true;
+
+		return false;
+	}
+
+	virtual bool get_accesses(nnpiResAccess::vec &out) const
+	{
+		for (uint16_t i = 0; i < m_copy_params.size(); ++i)
+			if (!m_copy_params[i]->get_accesses(out))
+				return false;
+
+		return true;
+	}
+
 	virtual void clear_edits()
 	{
 		if (m_num_edits == 0) {
@@ -225,6 +390,17 @@ public:
 		return m_copy_params.size();
 	}
 
+	const std::vector<nnpiInfCopyCommandSchedParams *> &copies() const { return m_copy_params; }
+
+	/* called after a copy of the list was rebound */
+	void update_need_prepare()
+	{
+		m_need_prepare = false;
+		for (uint16_t i = 0; i < m_copy_params.size(); ++i)
+			if (m_copy_params[i]->is_need_prepare())
+				m_need_prepare = true;
+	}
+
 	virtual nnpiInfCommandSchedParams *get_cmd_for_overwrite(uint16_t idx)
 	{
 		if (idx >= num_of_subcmds())
@@ -266,21 +442,41 @@ public:
 			m_debugOn = schedParams->debugOn;
 			m_collectInfo = schedParams->collectInfo;
 		}
+		update_encoding();
 	}
 
 	virtual ~nnpiInfReqSchedParams()
 	{
 	}
 
-	virtual bool pack(uint8_t *&p, uint32_t size)
+	const nnpiInfReq::ptr &infreq() const { return m_infreq; }
+
+	/* infreq must have the same shape as the bound request */
+	void rebind(const nnpiInfReq::ptr &infreq)
 	{
-		if (!m_edited)
-			return true;
+		m_infreq = infreq;
+		update_encoding();
+	}
 
-		if (size < 10 ||
-		    (!m_null_params && size < 15))
+	/* returns false if the request was appended without schedule params */
+	bool get_params(nnpdrvinfSchedParams *out_params) const
+	{
+		if (m_null_params)
 			return false;
 
+		memset(out_params, 0, sizeof(*out_params));
+		out_params->batchSize = m_batchSize;
+		out_params->priority = m_priority;
+		out_params->debugOn = m_debugOn;
+		out_params->collectInfo = m_collectInfo;
+
+		return true;
+	}
+
+	virtual uint32_t enc_size() const { return m_null_params ? 10 : 15; }
+
+	virtual void encode(uint8_t *p) const
+	{
 		*((uint32_t *)p) = m_idx; p += 4;
 		*((uint8_t *)p) = m_type; p += 1;
 		*((uint16_t *)p) = m_infreq->network()->id(); p += 2;
@@ -290,12 +486,8 @@ public:
 			*((uint16_t *)p) = m_batchSize; p += 2;
 			*((uint8_t *)p) = m_priority; p += 1;
 			*((uint8_t *)p) = m_debugOn; p += 1;
-			*((uint8_t *)p) = m_collectInfo; p += 1;
+			*((uint8_t *)p) = m_collectInfo;
 		}
-
-		m_edited = false;
-
-		return true;
 	}
 
 	virtual bool prepare_schedule()
@@ -307,6 +499,29 @@ public:
 	{
 	}
 
+	virtual void add_create_refs(int delta)
+	{
+		m_infreq->create_refs() += delta;
+	}
+
+	virtual bool has_create_refs()
+	{
+		return m_infreq->create_refs() > 0;
+	}
+
+	virtual bool get_accesses(nnpiResAccess::vec &out) const
+	{
+		const nnpiDevRes::vec &inputs = m_infreq->inputs();
+		const nnpiDevRes::vec &outputs = m_infreq->outputs();
+
+		for (auto it = inputs.begin(); it != inputs.end(); ++it)
+			out.push_back({ it->get(), false });
+		for (auto it = outputs.begin(); it != outputs.end(); ++it)
+			out.push_back({ it->get(), true });
+
+		return true;
+	}
+
 private:
 	nnpiInfReq::ptr  m_infreq;
 	bool             m_null_params;
@@ -319,7 +534,9 @@ class nnpiCommandList {
 public:
 	typedef std::shared_ptr<nnpiCommandList> ptr;
 	enum opt_flags {
-		BATCH_COPIES = (1 << 0)
+		BATCH_COPIES          = (1 << 0),
+		REORDER_COPIES        = (1 << 1),
+		DROP_REDUNDANT_COPIES = (1 << 2)
 	};
 
 	static NNPError create(nnpiInfContext::ptr   ctx,
@@ -328,22 +545,101 @@ public:
 	~nnpiCommandList();
 
 	uint16_t id() const { return m_protocolID; }
+	const nnpiInfContext::ptr &context() const { return m_context; }
 
+	/* commands to append are allocated from the list command arena */
+	nnpiArena &cmd_arena() { return m_cmd_arena; }
 	NNPError append(nnpiInfCommandSchedParams *sched_cmd);
-	nnpiInfCommandSchedParams *get_cmd_for_overwrite(uint16_t usr_idx);
+
+	/* applies all edits, or none if one is not valid, under one lock */
+	NNPError overwrite(const NNPCommandListEdit *edits,
+			   uint32_t                  num_edits);
+
+	/* replaces the copy or infer request bound to the command at index */
+	struct Binding {
+		uint16_t             index;
+		nnpiCopyCommand::ptr copy;
+		nnpiInfReq::ptr      infreq;
+	};
+
+	/* returns false if usr_idx is not a command of the list */
+	bool command_type(uint16_t usr_idx, CmdListCommandType &out_type);
+
+	/* applies all bindings, or none if one is not valid */
+	NNPError rebind(const std::vector<Binding> &bindings);
 	NNPError finalize(uint32_t optFlags);
+
+	/*
+	 * Sends the create request without waiting for the device reply,
+	 * wait_created() returns the create status.
+	 */
+	NNPError finalize_async(uint32_t optFlags);
+	NNPError wait_created(uint32_t timeoutUs);
+
+	/* called on the device reply with the context waitq held */
+	void release_create_refs();
+
+	/*
+	 * Finalizes several command lists, all create requests are sent
+	 * before the replies are waited for.
+	 */
+	static NNPError finalize_all(const std::vector<nnpiCommandList::ptr> &cmdlists,
+				     uint32_t                                 optFlags);
+
+	/*
+	 * Calls f for each command in append order, commands batched into
+	 * copy lists are visited one by one.
+	 */
+	template <class F>
+	void for_each_command(F f)
+	{
+		std::lock_guard<std::mutex> lock(m_waitq.mutex());
+
+		if (!m_user_cmds.empty()) {
+			for (auto it = m_user_cmds.begin(); it != m_user_cmds.end(); ++it)
+				f(*it);
+			return;
+		}
+
+		for (auto it = m_vec.begin(); it != m_vec.end(); ++it) {
+			if ((*it)->type() == CMDLIST_CMD_COPYLIST) {
+				const std::vector<nnpiInfCopyCommandSchedParams *> &copies =
+					static_cast<nnpiCopyListParams *>(*it)->copies();
+
+				for (auto c = copies.begin(); c != copies.end(); ++c)
+					f(*c);
+			} else {
+				f(*it);
+			}
+		}
+	}
 	nnpiInfCommandSchedParams* getCommand(uint16_t idx);
-	NNPError schedule();
+	NNPError schedule(uint8_t   priority = 0,
+			  uint64_t *out_stall_us = nullptr,
+			  uint64_t *out_instance = nullptr);
 	void addError(union c2h_event_report *ev);
 	NNPError clearErrors();
 
 	nnpiExecErrorList *getErrorList() { return &m_errorList; }
 
+	/* waits for instance, or for all scheduled instances if zero */
 	NNPError wait(uint32_t              timeoutUs,
 		      NNPCriticalErrorInfo *out_errors,
-		      uint32_t             *num_errors);
+		      uint32_t             *num_errors,
+		      uint64_t              instance = 0);
+
+	/*
+	 * Number of schedules which may be in flight at once. Instances are
+	 * numbered by schedule order, starting from one, and complete in
+	 * that order.
+	 */
+	NNPError set_depth(uint32_t depth);
+	void query_instances(uint64_t *out_scheduled, uint64_t *out_completed);
 
 	void complete();
+	void complete_all();
+
+	nnpiCompletionEvent &completionEvent() { return m_event; }
 
 	NNPError destroy();
 
@@ -351,7 +647,9 @@ public:
 	uint64_t user_hdl() const { return m_user_hdl; }
 
 protected:
-	NNPError send_to_card(uint8_t opcode);
+	NNPError send_to_card(uint8_t   opcode,
+			      uint8_t   priority = 0,
+			      uint64_t *out_stall_us = nullptr);
 
 private:
 	nnpiCommandList(uint16_t              protocol_id,
@@ -359,7 +657,13 @@ private:
 		m_protocolID(protocol_id),
 		m_context(ctx),
 		m_finalized(false),
-		m_in_flight(false),
+		m_create_pending(false),
+		m_holds_create_refs(false),
+		m_create_status(NNP_INVALID_ARGUMENT),
+		m_depth(1),
+		m_scheduled(0),
+		m_completed(0),
+		m_enc_full(false),
 		m_num_edits(0),
 		m_failed_commands(0),
 		m_user_hdl(0)
@@ -367,16 +671,60 @@ private:
 	}
 
 	void optimize_batch_copies();
+	void optimize_reorder_copies(bool reorder, bool drop_redundant);
+	bool is_redundant_copy(uint16_t                                  idx,
+			       const std::vector<nnpiResAccess::vec>    &acc,
+			       const std::vector<bool>                  &known) const;
+	void build_user_map();
+	bool find_cmd(uint16_t usr_idx, uint16_t &vec_idx, uint16_t &sub_idx) const;
+	nnpiInfCommandSchedParams *leaf_cmd(uint16_t vec_idx, uint16_t sub_idx) const;
+	void swap_bindings(std::vector<Binding> &bindings, bool reverse);
+	bool bindings_keep_order(const std::vector<Binding> &bindings) const;
+	void build_encoding();
+	void pack_encoded(size_t &unit, uint8_t *&p, uint8_t *buf_end);
+	NNPError send_create(uint32_t optFlags);
+	bool capture(NNPError &ret);
+	void cancel_instance();
+	NNPError wait_create(uint32_t timeout_us = UINT32_MAX);
+	NNPError create_reply_status(const union c2h_event_report &reply);
+	bool has_create_refs();
 
 private:
 	const uint16_t      m_protocolID;
 	nnpiInfContext::ptr m_context;
 	bool                m_finalized;
-	bool                m_in_flight;
+	bool                m_create_pending;
+	bool                m_holds_create_refs; /* protected by the context waitq */
+	NNPError            m_create_status;
+	uint32_t            m_depth;
+	uint64_t            m_scheduled;  /* instances scheduled, protected by m_waitq */
+	uint64_t            m_completed;  /* instances completed, protected by m_waitq */
+	std::mutex          m_sched_mutex; /* serializes schedules and edits, taken before m_waitq */
 	nnpiWaitQueue       m_waitq;
+	nnpiArena           m_cmd_arena;  /* storage of the list commands */
 	nnpiInfCommandSchedParams::vec m_vec;
+	/*
+	 * m_user_cmds is set once the optimizer changed the command order,
+	 * it holds the commands in append order. m_user_map is built when
+	 * the list is created and holds, for each append order index, the
+	 * m_vec index and sub command index, UINT16_MAX if the command was
+	 * dropped.
+	 */
+	nnpiInfCommandSchedParams::vec m_user_cmds;
+	std::vector<std::pair<uint16_t, uint16_t> > m_user_map;
+	nnpiInfCommandSchedParams::vec m_dropped;
+	/*
+	 * Encoding arena - the wire encoding of all commands, in m_vec
+	 * order, built when the list is created. While m_enc_full is set
+	 * every command is edited, and the create request is sent by
+	 * copying the arena to the command ring.
+	 */
+	std::vector<uint8_t>  m_enc;
+	std::vector<uint32_t> m_enc_units; /* unit offsets, ends with m_enc.size() */
+	bool                  m_enc_full;
 	uint16_t            m_num_edits;
 	uint32_t            m_failed_commands;
 	nnpiExecErrorList   m_errorList;
 	uint64_t            m_user_hdl;
+	nnpiCompletionEvent m_event;
 };
@@ -0,0 +1,87 @@
+/*******************************************
+ * Copyright (C) 2017-2020 Intel Corporation
+ * SPDX-License-Identifier: Apache-2.0
+ *******************************************/
+
+#include "nnpiCommandListTemplate.h"
+
+NNPError nnpiCommandListTemplate::create(const nnpiCommandList::ptr   &cmdlist,
+					 nnpiCommandListTemplate::ptr &out_tmpl)
+{
+	nnpiCommandListTemplate::ptr tmpl(new nnpiCommandListTemplate(cmdlist->context()));
+
+	cmdlist->for_each_command([&tmpl](nnpiInfCommandSchedParams *cmd) {
+		Command c;
+
+		c.type = cmd->type();
+		c.priority = cmd->priority();
+		c.size = 0;
+		c.has_params = false;
+		memset(&c.params, 0, sizeof(c.params));
+
+		if (c.type == CMDLIST_CMD_COPY) {
+			nnpiInfCopyCommandSchedParams *copy_cmd =
+				static_cast<nnpiInfCopyCommandSchedParams *>(cmd);
+
+			c.copy = copy_cmd->copy();
+			c.size = copy_cmd->requested_size();
+		} else {
+			nnpiInfReqSchedParams *infreq_cmd =
+				static_cast<nnpiInfReqSchedParams *>(cmd);
+
+			c.infreq = infreq_cmd->infreq();
+			c.has_params = infreq_cmd->get_params(&c.params);
+		}
+
+		tmpl->m_cmds.push_back(c);
+	});
+
+	if (tmpl->m_cmds.empty())
+		return NNP_INVALID_ARGUMENT;
+
+	out_tmpl = tmpl;
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpiCommandListTemplate::instantiate(const Subst          *subst,
+					      nnpiCommandList::ptr &out_cmdlist) const
+{
+	nnpiCommandList::ptr cmdlist;
+	NNPError ret;
+
+	ret = nnpiCommandList::create(m_ctx, cmdlist);
+	if (ret != NNP_NO_ERROR)
+		return ret;
+
+	for (uint32_t i = 0; i < m_cmds.size() && ret == NNP_NO_ERROR; ++i) {
+		const Command &c = m_cmds[i];
+		nnpiInfCommandSchedParams *cmd;
+
+		if (c.type == CMDLIST_CMD_COPY) {
+			const nnpiCopyCommand::ptr &copy =
+				(subst && subst[i].copy.get()) ? subst[i].copy : c.copy;
+
+			cmd = new (cmdlist->cmd_arena()) nnpiInfCopyCommandSchedParams(copy, c.priority, c.size);
+		} else {
+			const nnpiInfReq::ptr &infreq =
+				(subst && subst[i].infreq.get()) ? subst[i].infreq : c.infreq;
+
+			cmd = new (cmdlist->cmd_arena()) nnpiInfReqSchedParams(infreq,
+										c.has_params ? &c.params : NULL);
+		}
+
+		ret = cmdlist->append(cmd);
+		if (ret != NNP_NO_ERROR)
+			delete cmd;
+	}
+
+	if (ret != NNP_NO_ERROR) {
+		cmdlist->destroy();
+		return ret;
+	}
+
+	out_cmdlist = cmdlist;
+
+	return NNP_NO_ERROR;
+}
@@ -0,0 +1,63 @@
+/*******************************************
+ * Copyright (C) 2017-2020 Intel Corporation
+ * SPDX-License-Identifier: Apache-2.0
+ *******************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include "nnpdrvInference.h"
+#include "nnpiInfContext.h"
+#include "nnpiCopyCommand.h"
+#include "nnpiInfReq.h"
+#include "nnpiCommandList.h"
+
+/*
+ * Command list template.
+ * Records the commands of a command list, in append order, and creates
+ * new command lists with the same commands where each copy or infer
+ * request may be substituted by another object of the same context.
+ * The template holds references to the recorded objects.
+ */
+class nnpiCommandListTemplate {
+public:
+	typedef std::shared_ptr<nnpiCommandListTemplate> ptr;
+
+	/* substitution of one recorded command, an empty pointer keeps the recorded object */
+	struct Subst {
+		nnpiCopyCommand::ptr copy;
+		nnpiInfReq::ptr      infreq;
+	};
+
+	static NNPError create(const nnpiCommandList::ptr   &cmdlist,
+			       nnpiCommandListTemplate::ptr &out_tmpl);
+
+	const nnpiInfContext::ptr &context() const { return m_ctx; }
+	uint32_t numCommands() const { return (uint32_t)m_cmds.size(); }
+	CmdListCommandType commandType(uint32_t idx) const { return m_cmds[idx].type; }
+
+	/* subst is either NULL or holds numCommands() entries */
+	NNPError instantiate(const Subst          *subst,
+			     nnpiCommandList::ptr &out_cmdlist) const;
+
+private:
+	struct Command {
+		CmdListCommandType   type;
+		nnpiCopyCommand::ptr copy;
+		uint8_t              priority;
+		size_t               size;
+		nnpiInfReq::ptr      infreq;
+		bool                 has_params;
+		nnpdrvinfSchedParams params;
+	};
+
+	explicit nnpiCommandListTemplate(const nnpiInfContext::ptr &ctx) :
+		m_ctx(ctx)
+	{
+	}
+
+	const nnpiInfContext::ptr m_ctx;
+	std::vector<Command> m_cmds;
+};
@@ -0,0 +1,263 @@
+/*******************************************
+ * Copyright (C) 2017-2020 Intel Corporation
+ * SPDX-License-Identifier: Apache-2.0
+ *******************************************/
+
+#include "nnpiCompletion.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <chrono>
+#include <new>
+#include <vector>
+#include "nnpiWaitQueue.h"
+
+#define CALLBACK_POOL_MAX_THREADS 16
+#define CALLBACK_POOL_MAX_QUEUED  4096
+
+struct nnpiCallbackWork {
+	nnpiCompletionCb cb;
+	uint64_t         handle;
+	uint32_t         num_errors;
+	void            *user_data;
+};
+
+static nnpiWaitQueue s_pool_waitq;
+static std::deque<nnpiCallbackWork> s_pool_queue;
+static std::vector<pthread_t> s_pool_threads;
+static bool s_pool_stopping = false;
+
+static uint32_t get_callback_workers(void)
+{
+	static int val = -1;
+
+	if (val < 0) {
+		const char *env_str = getenv("NNPI_CALLBACK_WORKERS");
+		if (env_str)
+			val = atoi(env_str);
+		else
+			val = 2;
+		if (val < 1)
+			val = 1;
+		else if (val > CALLBACK_POOL_MAX_THREADS)
+			val = CALLBACK_POOL_MAX_THREADS;
+	}
+
+	return val;
+}
+
+bool nnpiCallbackPool::submit(nnpiCompletionCb cb,
+			      uint64_t         handle,
+			      uint32_t         num_errors,
+			      void            *user_data)
+{
+	nnpiCallbackWork work = { cb, handle, num_errors, user_data };
+	pthread_t thread;
+
+	s_pool_waitq.lock();
+	while (!s_pool_stopping && s_pool_threads.size() < get_callback_workers()) {
+		if (pthread_create(&thread, NULL, nnpiCallbackPool::worker_thread, NULL) != 0)
+			break;
+		s_pool_threads.push_back(thread);
+	}
+
+	if (s_pool_stopping || s_pool_threads.empty() ||
+	    s_pool_queue.size() >= CALLBACK_POOL_MAX_QUEUED) {
+		s_pool_waitq.unlock();
+		return false;
+	}
+
+	s_pool_queue.push_back(work);
+	s_pool_waitq.unlock_notify();
+
+	return true;
+}
+
+void nnpiCallbackPool::lock()
+{
+	s_pool_waitq.lock();
+}
+
+void nnpiCallbackPool::unlock()
+{
+	s_pool_waitq.unlock();
+}
+
+/*
+ * Runs the queued callbacks and joins the worker threads, called at
+ * exit. Callbacks submitted meanwhile run inline, a later submit
+ * starts the workers again.
+ */
+void nnpiCallbackPool::stop()
+{
+	std::vector<pthread_t> threads;
+
+	s_pool_waitq.lock();
+	s_pool_stopping = true;
+	threads.swap(s_pool_threads);
+	s_pool_waitq.unlock_notify();
+
+	for (auto t = threads.begin(); t != threads.end(); ++t)
+		pthread_join(*t, NULL);
+
+	s_pool_waitq.lock();
+	s_pool_stopping = false;
+	s_pool_waitq.unlock();
+}
+
+void nnpiCallbackPool::fork_child_reset()
+{
+	/* worker threads do not exist in the child process */
+	s_pool_queue.clear();
+	s_pool_threads.clear();
+	s_pool_stopping = false;
+
+	/* no thread of the child waits on it, drop the parent waiters state */
+	new (&s_pool_waitq) nnpiWaitQueue();
+}
+
+void *nnpiCallbackPool::worker_thread(void *)
+{
+	nnpiCallbackWork work;
+
+	while (true) {
+		s_pool_waitq.wait_lock([] { return !s_pool_queue.empty() || s_pool_stopping; });
+		if (s_pool_queue.empty()) {
+			s_pool_waitq.unlock();
+			break;
+		}
+		work = s_pool_queue.front();
+		s_pool_queue.pop_front();
+		s_pool_waitq.unlock();
+
+		(*work.cb)(work.handle, work.num_errors, work.user_data);
+	}
+
+	return NULL;
+}
+
+void nnpiCompletionQueue::post(const entry &e)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (m_destroyed)
+		return;
+
+	m_entries.push_back(e);
+	if (m_waiters > 0)
+		m_cv.notify_all();
+}
+
+uint32_t nnpiCompletionQueue::wait(entry    *out_entries,
+				   uint32_t  max_entries,
+				   uint32_t  min_entries,
+				   uint32_t  timeout_us)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	uint32_t n = 0;
+
+	auto cond = [this, min_entries] {
+		return m_entries.size() >= min_entries || m_destroyed;
+	};
+
+	if (!cond() && timeout_us > 0) {
+		m_waiters++;
+		if (timeout_us == UINT32_MAX)
+			m_cv.wait(lock, cond);
+		else
+			m_cv.wait_for(lock, std::chrono::microseconds(timeout_us), cond);
+		m_waiters--;
+	}
+
+	while (n < max_entries && !m_entries.empty()) {
+		out_entries[n++] = m_entries.front();
+		m_entries.pop_front();
+	}
+
+	return n;
+}
+
+void nnpiCompletionQueue::destroy()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_destroyed = true;
+	m_entries.clear();
+	m_cv.notify_all();
+}
+
+nnpiCompletionEvent::~nnpiCompletionEvent()
+{
+	int fd = m_efd.load(std::memory_order_relaxed);
+
+	if (fd >= 0)
+		close(fd);
+}
+
+int nnpiCompletionEvent::fd()
+{
+	int fd = m_efd.load(std::memory_order_acquire);
+
+	if (fd >= 0)
+		return fd;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	fd = m_efd.load(std::memory_order_relaxed);
+	if (fd < 0) {
+		fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fd >= 0)
+			m_efd.store(fd, std::memory_order_release);
+	}
+
+	return fd;
+}
+
+void nnpiCompletionEvent::setCallback(nnpiCompletionCb cb, void *user_data, bool on_worker)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_cb = cb;
+	m_cb_data = user_data;
+	m_cb_worker = on_worker;
+	m_has_hooks.store(m_cb != nullptr || m_cq.get() != nullptr, std::memory_order_release);
+}
+
+void nnpiCompletionEvent::setQueue(const nnpiCompletionQueue::ptr &cq,
+				   uint32_t                        entry_type,
+				   uint64_t                        user_data)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_cq = cq;
+	m_cq_type = entry_type;
+	m_cq_data = user_data;
+	m_has_hooks.store(m_cb != nullptr || m_cq.get() != nullptr, std::memory_order_release);
+}
+
+void nnpiCompletionEvent::invokeHooks(uint64_t handle, uint32_t num_errors)
+{
+	nnpiCompletionQueue::ptr cq;
+	nnpiCompletionQueue::entry e;
+	nnpiCompletionCb cb;
+	void *user_data;
+	bool on_worker;
+
+	m_mutex.lock();
+	cb = m_cb;
+	user_data = m_cb_data;
+	on_worker = m_cb_worker;
+	cq = m_cq;
+	e.type = m_cq_type;
+	e.userData = m_cq_data;
+	m_mutex.unlock();
+
+	if (cq.get() != nullptr) {
+		e.numErrors = num_errors;
+		e.handle = handle;
+		cq->post(e);
+	}
+
+	if (cb)
+		nnpiCallbackPool::run(cb, handle, num_errors, user_data, on_worker);
+}
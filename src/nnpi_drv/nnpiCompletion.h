@@ -0,0 +1,166 @@
+/*******************************************
+ * Copyright (C) 2017-2020 Intel Corporation
+ * SPDX-License-Identifier: Apache-2.0
+ *******************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <unistd.h>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <deque>
+#include <condition_variable>
+#include "nnpdrvInference.h"
+
+typedef void (*nnpiCompletionCb)(uint64_t  handle,
+				 uint32_t  num_errors,
+				 void     *user_data);
+
+/*
+ * Callback worker pool.
+ * Runs completion callbacks off the response path on a small pool of
+ * threads (NNPI_CALLBACK_WORKERS, default 2) with a bounded queue.
+ */
+class nnpiCallbackPool {
+public:
+	/* returns false if the callback could not be queued */
+	static bool submit(nnpiCompletionCb cb,
+			   uint64_t         handle,
+			   uint32_t         num_errors,
+			   void            *user_data);
+
+	/* held across fork so the child does not inherit it locked */
+	static void lock();
+	static void unlock();
+	static void fork_child_reset();
+
+	static void stop();
+
+	/* runs cb on the pool if on_worker is set and the pool accepts it, else inline */
+	static inline void run(nnpiCompletionCb cb,
+			       uint64_t         handle,
+			       uint32_t         num_errors,
+			       void            *user_data,
+			       bool             on_worker)
+	{
+		if (!on_worker || !submit(cb, handle, num_errors, user_data))
+			(*cb)(handle, num_errors, user_data);
+	}
+
+private:
+	static void *worker_thread(void *);
+};
+
+/*
+ * Completion queue.
+ * Collects completion entries posted by the response path of any
+ * context until harvested by wait(). Uses its own lock and condition
+ * variable, not an nnpiWaitQueue, so that posting is never deferred
+ * by a notify batch, the queue may be released right after posting.
+ */
+class nnpiCompletionQueue {
+public:
+	typedef std::shared_ptr<nnpiCompletionQueue> ptr;
+
+	typedef NNPCompletionEntry entry;
+
+	static ptr create() { return ptr(new nnpiCompletionQueue()); }
+
+	void post(const entry &e);
+
+	/*
+	 * Waits up to timeout_us until at least min_entries entries are
+	 * queued, then harvests up to max_entries of them.
+	 * Returns the number of harvested entries, which is less than
+	 * min_entries on timeout or when the queue is destroyed.
+	 */
+	uint32_t wait(entry    *out_entries,
+		      uint32_t  max_entries,
+		      uint32_t  min_entries,
+		      uint32_t  timeout_us);
+
+	/* wakes all waiters, further waits return immediately */
+	void destroy();
+	bool destroyed() const { return m_destroyed; }
+
+private:
+	nnpiCompletionQueue() :
+		m_waiters(0),
+		m_destroyed(false)
+	{
+	}
+
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::deque<entry> m_entries;
+	uint32_t m_waiters;
+	std::atomic<bool> m_destroyed;
+};
+
+/*
+ * Completion event.
+ * Signalled by the response thread each time the owning object
+ * completes. Signalling writes the object's eventfd, if one was
+ * requested, invokes the object's completion callback, if set,
+ * either inline or on the callback worker pool, and posts an entry
+ * to the attached completion queue, if any.
+ * The eventfd is created on first request and is owned, and closed,
+ * by the completion event.
+ */
+class nnpiCompletionEvent {
+public:
+	nnpiCompletionEvent() :
+		m_efd(-1),
+		m_has_hooks(false),
+		m_cb(nullptr),
+		m_cb_data(nullptr),
+		m_cb_worker(false),
+		m_cq_type(0),
+		m_cq_data(0)
+	{
+	}
+
+	~nnpiCompletionEvent();
+
+	/* returns the event fd, creating it if needed, or -1 on failure */
+	int fd();
+
+	/* sets, or clears if cb is NULL, the completion callback */
+	void setCallback(nnpiCompletionCb cb, void *user_data, bool on_worker);
+
+	/* attaches, or detaches if cq is NULL, a completion queue */
+	void setQueue(const nnpiCompletionQueue::ptr &cq,
+		      uint32_t                        entry_type,
+		      uint64_t                        user_data);
+
+	inline void signal(uint64_t handle = 0, uint32_t num_errors = 0)
+	{
+		int fd = m_efd.load(std::memory_order_acquire);
+		uint64_t one = 1;
+
+		if (fd >= 0) {
+			/* can fail only on counter overflow, reader is woken anyway */
+			ssize_t rc = ::write(fd, &one, sizeof(one));
+			(void)rc;
+		}
+
+		if (m_has_hooks.load(std::memory_order_acquire))
+			invokeHooks(handle, num_errors);
+	}
+
+private:
+	void invokeHooks(uint64_t handle, uint32_t num_errors);
+
+private:
+	std::atomic<int> m_efd;
+	std::atomic<bool> m_has_hooks;
+	nnpiCompletionCb m_cb;
+	void *m_cb_data;
+	bool m_cb_worker;
+	nnpiCompletionQueue::ptr m_cq;
+	uint32_t m_cq_type;
+	uint64_t m_cq_data;
+	std::mutex m_mutex;
+};
@@ -5,96 +5,86 @@
 
 #pragma once
 
-#include <map>
-#include <mutex>
+#include "nnpiObjTable.h"
 #include "nnpiCopyCommand.h"
 #include "nnpiDevNet.h"
 #include "nnpiInfReq.h"
 #include "nnpiCommandList.h"
 
+/*
+ * Per context protocol ID to object tables.
+ * Lookups, done by the response handler for every completion event,
+ * are lock free and do not allocate, a lookup of a missing ID returns
+ * an empty pointer.
+ */
 class nnpiContextObjDB {
 public:
-	typedef std::pair<uint16_t, uint16_t> id_pair;
-
 	nnpiContextObjDB()
 	{
 	}
 
 	void insertCopy(uint16_t id, nnpiCopyCommand::ptr copy)
 	{
-		std::lock_guard<std::mutex> lock(m_lock);
-		m_copies[id] = copy;
+		m_copies.insert(id, copy);
 	}
 
 	void removeCopy(uint16_t id)
 	{
-		std::lock_guard<std::mutex> lock(m_lock);
-		m_copies.erase(id);
+		m_copies.remove(id);
 	}
 
 	nnpiCopyCommand::ptr getCopy(uint16_t id)
 	{
-		std::lock_guard<std::mutex> lock(m_lock);
-		return m_copies[id];
+		return m_copies.get(id);
 	}
 
 	void insertDevNet(uint16_t id, nnpiDevNet::ptr devnet)
 	{
-		std::lock_guard<std::mutex> lock(m_lock);
-		m_networks[id] = devnet;
+		m_networks.insert(id, devnet);
 	}
 
 	void removeDevNet(uint16_t id)
 	{
-		std::lock_guard<std::mutex> lock(m_lock);
-		m_networks.erase(id);
+		m_networks.remove(id);
 	}
 
 	nnpiDevNet::ptr getDevNet(uint16_t id)
 	{
-		std::lock_guard<std::mutex> lock(m_lock);
-		return m_networks[id];
+		return m_networks.get(id);
 	}
 
 	void insertInfReq(uint16_t id, nnpiInfReq::ptr infreq)
 	{
-		std::lock_guard<std::mutex> lock(m_lock);
-		m_infreqs[id_pair(infreq->network()->id(), id)] = infreq;
+		m_infreqs.insert(infreq_key(infreq->network()->id(), id), infreq);
 	}
 
 	void removeInfReq(uint16_t net_id, uint16_t id)
 	{
-		std::lock_guard<std::mutex> lock(m_lock);
-		m_infreqs.erase(id_pair(net_id, id));
+		m_infreqs.remove(infreq_key(net_id, id));
 	}
 
 	nnpiInfReq::ptr getInfReq(uint16_t net_id, uint16_t id)
 	{
-		std::lock_guard<std::mutex> lock(m_lock);
-		return m_infreqs[id_pair(net_id, id)];
+		return m_infreqs.get(infreq_key(net_id, id));
 	}
 
 	void insertCommandList(uint16_t id, nnpiCommandList::ptr cmdlist)
 	{
-		std::lock_guard<std::mutex> lock(m_lock);
-		m_cmdlists[id] = cmdlist;
+		m_cmdlists.insert(id, cmdlist);
 	}
 
 	void removeCommandList(uint16_t id)
 	{
-		std::lock_guard<std::mutex> lock(m_lock);
-		m_cmdlists.erase(id);
+		m_cmdlists.remove(id);
 	}
 
 	nnpiCommandList::ptr getCommandList(uint16_t id)
 	{
-		std::lock_guard<std::mutex> lock(m_lock);
-		return m_cmdlists[id];
+		return m_cmdlists.get(id);
 	}
 
 	void clearAll()
 	{
-		std::lock_guard<std::mutex> lock(m_lock);
 		m_cmdlists.clear();
 		m_infreqs.clear();
 		m_networks.clear();
@@ -104,29 +94,23 @@ public:
 	template <class CB_FUNC>
 	void for_each_copy(CB_FUNC cb)
 	{
-		std::lock_guard<std::mutex> lock(m_lock);
-
-		for (std::map<uint16_t, nnpiCopyCommand::ptr>::iterator c = m_copies.begin();
-		     c != m_copies.end();
-		     c++)
-			cb((*c).second);
+		m_copies.for_each(cb);
 	}
 
 	template <class CB_FUNC>
 	void for_each_cmdlist(CB_FUNC cb)
 	{
-		std::lock_guard<std::mutex> lock(m_lock);
-
-		for (std::map<uint16_t, nnpiCommandList::ptr>::iterator c = m_cmdlists.begin();
-		     c != m_cmdlists.end();
-		     c++)
-			cb((*c).second);
+		m_cmdlists.for_each(cb);
 	}
 
 private:
-	std::mutex m_lock;
-	std::map<uint16_t, nnpiCopyCommand::ptr> m_copies;
-	std::map<uint16_t, nnpiDevNet::ptr> m_networks;
-	std::map<id_pair, nnpiInfReq::ptr> m_infreqs;
-	std::map<uint16_t, nnpiCommandList::ptr> m_cmdlists;
+	static inline uint32_t infreq_key(uint16_t net_id, uint16_t id)
+	{
+		return ((uint32_t)net_id << NNP_IPC_INF_REQ_BITS) | id;
+	}
+
+	nnpiObjTable<nnpiCopyCommand, NNP_IPC_INF_COPY_BITS> m_copies;
+	nnpiObjTable<nnpiDevNet, NNP_IPC_INF_DEVNET_BITS> m_networks;
+	nnpiObjTable<nnpiInfReq, NNP_IPC_INF_DEVNET_BITS + NNP_IPC_INF_REQ_BITS> m_infreqs;
+	nnpiObjTable<nnpiCommandList, NNP_IPC_INF_CMDS_BITS> m_cmdlists;
 };
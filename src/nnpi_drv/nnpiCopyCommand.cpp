@@ -282,3 +282,21 @@ NNPError nnpiCopyCommand::destroy()
 {
 	return m_ctx->destroyCopy(m_id);
 }
+
+bool nnpiCopyCommand::capture(uint64_t  size,
+			      uint8_t   priority,
+			      NNPError &ret)
+{
+	if (size > max_size()) {
+		ret = NNP_INVALID_ARGUMENT;
+		return true;
+	}
+
+	/* a command list copy of size zero skips execution */
+	return m_ctx->capture([this, size, priority](nnpiArena                                &arena,
+						     std::vector<nnpiInfCommandSchedParams *> &cmds) {
+		cmds.push_back(new (arena) nnpiInfCopyCommandSchedParams(shared_from_this(),
+									 priority,
+									 size == 0 ? UINT64_MAX : size));
+	}, ret);
+}
@@ -8,7 +8,7 @@
 #include "nnpiInfContext.h"
 #include "nnpiDevRes.h"
 
-class nnpiCopyCommand {
+class nnpiCopyCommand : public std::enable_shared_from_this<nnpiCopyCommand> {
 public:
 	typedef std::shared_ptr<nnpiCopyCommand> ptr;
 
@@ -31,6 +31,7 @@ public:
 	uint16_t id() const { return m_id; }
 	bool is_c2h() const { return m_c2h; }
 	bool is_d2d() const { return m_is_d2d; }
+	bool is_subres() const { return m_is_subres; }
 	uint64_t max_size() const
 	{
 		if (m_is_d2d) {
@@ -39,12 +40,31 @@ public:
 			return std::min(m_devres->size(), m_hostres->size());
 		}
 	}
-	nnpiInfContext::ptr context() const { return m_ctx; }
+	const nnpiInfContext::ptr &context() const { return m_ctx; }
 	nnpiHostRes::ptr hostres() const { return m_hostres; }
+	const nnpiDevRes::ptr &devres() const { return m_devres; }
+	const nnpiDevRes::ptr &src_devres() const { return m_src_devres; }
 
 	void set_user_hdl(uint64_t user_hdl) { m_user_hdl = user_hdl; }
 	uint64_t user_hdl() const { return m_user_hdl; }
 
+	/* signalled when a copy scheduled outside of a command list completes */
+	nnpiCompletionEvent &completionEvent() { return m_event; }
+
+	/* true if other may replace this copy in a created command list */
+	bool same_shape(const nnpiCopyCommand &other) const
+	{
+		return other.m_ctx == m_ctx &&
+		       other.m_c2h == m_c2h &&
+		       other.m_is_d2d == m_is_d2d &&
+		       !other.m_is_subres && !m_is_subres &&
+		       other.m_devres->size() == m_devres->size() &&
+		       other.max_size() == max_size();
+	}
+
+	/* command lists being created with this copy, protected by the context waitq */
+	uint32_t &create_refs() { return m_create_refs; }
+
 
 	bool preSchedule()
 	{
@@ -53,7 +73,7 @@ public:
 
 		NNPError ret = m_hostres->lock_device_access(m_c2h);
 		if (ret == NNP_NO_ERROR)
-			m_scheduled = true;
+			m_scheduled++;
 
 		return ret == NNP_NO_ERROR;
 	}
@@ -65,17 +85,20 @@ public:
 
 		NNPError ret = hostres->lock_device_access(m_c2h);
 		if (ret == NNP_NO_ERROR)
-			m_scheduled = true;
+			m_scheduled++;
 
 		return ret == NNP_NO_ERROR;
 	}
 
 	void postSchedule(nnpiExecErrorList *error_list = nullptr)
 	{
-		if (!m_scheduled)
-			return;
-		else
-			m_scheduled = false;
+		/* one per schedule, a copy may be in flight in several command list instances */
+		uint32_t n = m_scheduled.load(std::memory_order_relaxed);
+
+		do {
+			if (n == 0)
+				return;
+		} while (!m_scheduled.compare_exchange_weak(n, n - 1));
 
 		if (m_is_d2d)
 			return;
@@ -97,7 +120,10 @@ public:
 	{
 		NNPError ret;
 
-		if (!m_ctx->wait_can_schedule())
+		if (m_ctx->capturing() && capture(size, priority, ret))
+			return ret;
+
+		if (!m_ctx->wait_can_schedule([this] { return m_create_refs == 0; }))
 			return NNP_CONTEXT_BROKEN;
 
 		if (size == 0)
@@ -138,7 +164,11 @@ public:
 		if (!m_is_subres)
 			return NNP_INVALID_ARGUMENT;
 
-		if (!m_ctx->wait_can_schedule())
+		/* the host resource is not known to a command list */
+		if (m_ctx->capturing())
+			return NNP_NOT_SUPPORTED;
+
+		if (!m_ctx->wait_can_schedule([this] { return m_create_refs == 0; }))
 			return NNP_CONTEXT_BROKEN;
 
 		if (!hostres.get() ||
@@ -188,7 +218,8 @@ private:
 		m_user_hdl(0),
 		m_need_prepare(true),
 		m_is_d2d(false),
-		m_scheduled(false)
+		m_scheduled(0),
+		m_create_refs(0)
 	{
 		if (hostres->usageFlags() & NNP_RESOURECE_USAGE_LOCKLESS)
 			m_need_prepare = false;
@@ -206,7 +237,8 @@ private:
 		m_user_hdl(0),
 		m_need_prepare(true),
 		m_is_d2d(false),
-		m_scheduled(false)
+		m_scheduled(0),
+		m_create_refs(0)
 	{
 	}
 
@@ -223,12 +255,18 @@ private:
 		m_user_hdl(0),
 		m_need_prepare(false),
 		m_is_d2d(true),
-		m_scheduled(false),
+		m_scheduled(0),
+		m_create_refs(0),
 		m_src_devres(src_devres)
 	{
 	}
 
 	static NNPError update_peers(nnpiDevRes::ptr dst_devres, nnpiDevRes::ptr src_devres);
+
+	/* returns false if the context is not capturing */
+	bool capture(uint64_t  size,
+		     uint8_t   priority,
+		     NNPError &ret);
 private:
 	nnpiInfContext::ptr m_ctx;
 	const uint16_t m_id;
@@ -240,6 +278,8 @@ private:
 	uint64_t        m_user_hdl;
 	bool            m_need_prepare;
 	const bool     m_is_d2d;
-	bool            m_scheduled;
+	std::atomic<uint32_t> m_scheduled;
+	uint32_t        m_create_refs;
 	nnpiDevRes::ptr m_src_devres;
+	nnpiCompletionEvent m_event;
 };
@@ -47,15 +47,15 @@ static NNPError send_create_or_add(nnpiInfContext::ptr     ctx,
 	msg.num_res = devres_vec.size();
 	msg.size = total_data_size - 1;
 	msg.start_res_idx = 0;
-	msg.chained = (total_data_size > NNP_PAGE_SIZE ? 1 : 0);
+	msg.chained = (total_data_size > cmd_ring->maxPayload() ? 1 : 0);
 
 	uint32_t sent = 0;
 	uint32_t sent_conf = 0;
-	uint32_t max_devres_per_page = (NNP_PAGE_SIZE / sizeof(uint16_t));
+	uint32_t max_payload = cmd_ring->maxPayload();
+	uint32_t max_devres_per_page = (max_payload / sizeof(uint16_t));
 
 	do {
-		uint32_t cont;
-		uint8_t *ptr = (uint8_t *)cmd_ring->lockFreeSpace(NNP_PAGE_SIZE, cont);
+		uint8_t *ptr = (uint8_t *)cmd_ring->lockPayload(max_payload);
 		if (!ptr) {
 			ret = NNP_IO_ERROR;
 			break;
@@ -72,7 +72,8 @@ static NNPError send_create_or_add(nnpiInfContext::ptr     ctx,
 		sent += n_res;
 		ptr += (n_res * sizeof(uint16_t));
 
-		uint32_t space_left = NNP_PAGE_SIZE - (n_res * sizeof(uint16_t));
+		uint32_t payload_size = n_res * sizeof(uint16_t);
+		uint32_t space_left = max_payload - payload_size;
 		if (space_left > 0 && sent_conf < config_data_size) {
 			uint32_t n_conf = config_data_size - sent_conf;
 			if (n_conf > space_left)
@@ -80,20 +81,25 @@ static NNPError send_create_or_add(nnpiInfContext::ptr     ctx,
 
 			memcpy_s(ptr, space_left, ((uint8_t *)config_data) + sent_conf, n_conf);
 			sent_conf += n_conf;
+			payload_size += n_conf;
 		}
 
+		cmd_ring->setPayloadSize(payload_size);
+
 		if (ctx->chan()->write(&msg, sizeof(msg)) != sizeof(msg)) {
 			cmd_ring->unlockFreeSpace(0);
 			ret = NNP_IO_ERROR;
 			break;
 		}
 
-		cmd_ring->unlockFreeSpace(NNP_PAGE_SIZE);
+		cmd_ring->unlockPayload(payload_size);
 
 		msg.start_res_idx += n_res;
 
 	} while(sent < devres_vec.size() || sent_conf < config_data_size);
 
+	ctx->chan()->checkCommandRingBufferGrow(0);
+
 	if (ret == NNP_NO_ERROR) {
 		rc = ctx->wait_create_command(InfContextObjID(INF_OBJ_TYPE_DEVNET, protocol_id),
 					      reply);
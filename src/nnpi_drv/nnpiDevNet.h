@@ -27,7 +27,7 @@ public:
 	}
 
 	uint16_t id() const { return m_id; }
-	nnpiInfContext::ptr context() { return m_ctx; }
+	const nnpiInfContext::ptr &context() const { return m_ctx; }
 	bool valid() const { return m_devres_vec.size() > 0; }
 
 	void set_user_hdl(uint64_t user_hdl) { m_user_hdl = user_hdl; }
@@ -56,6 +56,11 @@ public:
 		m_infreq_ida.free(protocol_id);
 	}
 
+	void queryIdUsage(NNPIdUsage *out_usage)
+	{
+		m_infreq_ida.get_usage(out_usage);
+	}
+
 private:
 	explicit nnpiDevNet(nnpiInfContext::ptr     ctx,
 			    uint16_t                protocol_id,
@@ -268,9 +268,11 @@ int nnpiDevice::createChannel(const nnpiHostProc::ptr &host,
 			      bool                     get_device_events,
 			      uint16_t                *out_id,
 			      int                     *out_fd,
-			      int                     *out_privileged)
+			      int                     *out_privileged,
+			      uint32_t                *out_version)
 {
 	struct ioctl_nnpi_create_channel req;
+	uint32_t version = NNP_IPC_CHAN_PROTOCOL_VERSION;
 	int ret;
 
 	if (!out_id || !out_fd)
@@ -280,16 +282,24 @@ int nnpiDevice::createChannel(const nnpiHostProc::ptr &host,
 		return ENODEV;
 
 	std::unique_lock<std::mutex> lock(m_mutex);
-	do {
-		memset(&req, 0, sizeof(req));
-		req.i_host_fd = host->fd();
-		req.i_min_id = (is_context ? 0 : 256);
-		req.i_max_id = (is_context ? 255 : (1 << NNP_IPC_CHANNEL_BITS) - 1);
-		req.i_get_device_events = get_device_events;
-		req.i_protocol_version = NNP_IPC_CHAN_PROTOCOL_VERSION;
-
-		ret = ioctl(m_fd, IOCTL_NNPI_DEVICE_CREATE_CHANNEL, &req);
-	} while (ret < 0 && errno == EINTR);
+	for (;;) {
+		do {
+			memset(&req, 0, sizeof(req));
+			req.i_host_fd = host->fd();
+			req.i_min_id = (is_context ? 0 : 256);
+			req.i_max_id = (is_context ? 255 : (1 << NNP_IPC_CHANNEL_BITS) - 1);
+			req.i_get_device_events = get_device_events;
+			req.i_protocol_version = version;
+
+			ret = ioctl(m_fd, IOCTL_NNPI_DEVICE_CREATE_CHANNEL, &req);
+		} while (ret < 0 && errno == EINTR);
+
+		/* retry with the oldest version for a card which does not speak this one */
+		if (ret != 0 || req.o_errno != NNPER_VERSIONS_MISMATCH ||
+		    version == NNP_IPC_CHAN_PROTOCOL_MIN_VERSION)
+			break;
+		version = NNP_IPC_CHAN_PROTOCOL_MIN_VERSION;
+	}
 
 	if (ret != 0)
 		return errno;
@@ -303,6 +313,8 @@ int nnpiDevice::createChannel(const nnpiHostProc::ptr &host,
 	*out_id = req.o_channel_id;
 	*out_fd = req.o_fd;
 	*out_privileged = (getuid() == 0);
+	if (out_version)
+		*out_version = version;
 
 	return 0;
 }
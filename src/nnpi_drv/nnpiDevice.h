@@ -74,7 +74,8 @@ public:
 			  bool                     get_device_events,
 			  uint16_t                *out_id,
 			  int                     *out_fd,
-			  int                     *out_privileged);
+			  int                     *out_privileged,
+			  uint32_t                *out_version);
 
 	void closeChannel(int fd);
 
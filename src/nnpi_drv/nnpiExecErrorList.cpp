@@ -7,21 +7,110 @@
 #include <stdlib.h>
 #include <string.h>
 #include "ipc_c2h_events.h"
+#include "nnp_log.h"
 #include "safe_lib.h"
 
+void nnpiResponsePages::init(nnpiRingBuffer::ptr rb, nnpiChannel::ptr chan)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_rb = rb;
+	m_chan = chan;
+	m_max_held = rb->size() / NNP_PAGE_SIZE - 1;
+}
+
+void nnpiResponsePages::shutdown()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_pages.clear();
+	m_max_held = 0;
+	m_rb.reset();
+	m_chan.reset();
+}
+
+const void *nnpiResponsePages::next()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	uint32_t off = (uint32_t)m_pages.size() * NNP_PAGE_SIZE;
+
+	if (!m_rb.get() || m_rb->getAvailBytes() < off + NNP_PAGE_SIZE)
+		return NULL;
+
+	return m_rb->buf() + (m_rb->head() + off) % m_rb->size();
+}
+
+void nnpiResponsePages::consume(nnpiExecErrorList *holder)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (!m_rb.get())
+		return;
+
+	m_pages.push_back(holder);
+
+	/* keep at least one ring page free for the device */
+	if (m_pages.size() > m_max_held && m_pages.front() != NULL) {
+		m_pages.front()->evictPage();
+		m_pages.front() = NULL;
+	}
+
+	advanceHead();
+}
+
+void nnpiResponsePages::release(nnpiExecErrorList *holder)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (std::deque<nnpiExecErrorList *>::iterator i = m_pages.begin();
+	     i != m_pages.end();
+	     i++)
+		if (*i == holder)
+			*i = NULL;
+
+	if (m_rb.get())
+		advanceHead();
+}
+
+/* m_mutex must be held */
+void nnpiResponsePages::advanceHead()
+{
+	uint32_t size = 0;
+
+	while (!m_pages.empty() && m_pages.front() == NULL) {
+		m_pages.pop_front();
+		size += NNP_PAGE_SIZE;
+	}
+
+	if (size == 0)
+		return;
+
+	m_rb->updateHead(size);
+	if (!m_chan->sendResponseRingBufferHeadUpdate(0, size))
+		nnp_log_err(GENERAL_LOG, "FATAL: failed to update response ring bufer head!!!\n");
+}
+
 nnpiExecErrorList::~nnpiExecErrorList()
 {
+	if (m_pages)
+		m_pages->release(this);
 	clearFailedHostRes();
 	free(m_buf);
 }
 
 void nnpiExecErrorList::clear()
 {
+	if (m_pages) {
+		m_pages->release(this);
+		m_pages = NULL;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	/* the buffer and descriptor vector are kept for the next query */
 	m_desc_vec.clear();
-	free(m_buf);
-	m_buf = NULL;
+	m_data = NULL;
 	m_size = 0;
-	m_buf_size = 0;
 	m_complete_eventVal = 0;
 	m_state = STATE_CLEARED;
 }
@@ -32,14 +121,43 @@ void nnpiExecErrorList::startQuery()
 	m_state = STATE_QUERY_STARTED;
 }
 
+bool nnpiExecErrorList::reserveBuf(uint32_t size)
+{
+	void *buf;
+
+	if (size <= m_buf_size)
+		return true;
+
+	buf = realloc(m_buf, size);
+	if (!buf)
+		return false;
+
+	m_buf = buf;
+	m_buf_size = size;
+
+	return true;
+}
+
+/*
+ * Called by nnpiResponsePages from the response thread, the buffer was
+ * reserved when the page was taken, so this never fails.
+ */
+void nnpiExecErrorList::evictPage()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	memcpy_s(m_buf, m_buf_size, m_data, m_size);
+	m_data = (const uint8_t *)m_buf;
+}
+
 void nnpiExecErrorList::completeQuery(nnpiWaitQueue &waitq, uint16_t event_val)
 {
 	if (event_val == 0) {
 		uint32_t pos = 0;
 		while (pos < m_size) {
-			struct ipc_exec_error_desc *desc = (struct ipc_exec_error_desc *)((uintptr_t)m_buf + pos);
+			const struct ipc_exec_error_desc *desc = (const struct ipc_exec_error_desc *)(m_data + pos);
 
-			m_desc_vec.push_back(desc);
+			m_desc_vec.push_back(pos);
 			pos += sizeof(struct ipc_exec_error_desc);
 			pos += desc->error_msg_size;
 		}
@@ -49,7 +167,7 @@ void nnpiExecErrorList::completeQuery(nnpiWaitQueue &waitq, uint16_t event_val)
 }
 
 void nnpiExecErrorList::appendErrorListPacket(nnpiWaitQueue &waitq,
-					      void    *packet,
+					      const void *packet,
 					      uint32_t packet_size,
 					      uint32_t total_size,
 					      uint16_t error_eventVal)
@@ -58,12 +176,10 @@ void nnpiExecErrorList::appendErrorListPacket(nnpiWaitQueue &waitq,
 		return;
 
 	if (packet && packet_size > 0) {
-		if (!m_buf) {
-			m_buf = malloc(total_size);
-			m_buf_size = total_size;
-		}
+		if (m_size == 0 && reserveBuf(total_size))
+			m_data = (const uint8_t *)m_buf;
 
-		if (m_buf && m_size + packet_size <= m_buf_size) {
+		if (m_data != NULL && m_data == m_buf && m_size + packet_size <= total_size) {
 			memcpy_s((void *)((uintptr_t)m_buf + m_size), total_size-m_size, packet, packet_size);
 			m_size += packet_size;
 			if (m_size == total_size)
@@ -75,6 +191,33 @@ void nnpiExecErrorList::appendErrorListPacket(nnpiWaitQueue &waitq,
 	}
 }
 
+void nnpiExecErrorList::appendErrorListPage(nnpiWaitQueue     &waitq,
+					    nnpiResponsePages &pages,
+					    const void        *packet,
+					    uint32_t           packet_size,
+					    uint32_t           total_size)
+{
+	/*
+	 * A list which fits in one page is parsed in place, the buffer is
+	 * still reserved so the page can be evicted at any time.
+	 */
+	if (m_state == STATE_QUERY_STARTED &&
+	    m_size == 0 &&
+	    packet_size == total_size &&
+	    pages.canHold() &&
+	    reserveBuf(total_size)) {
+		m_data = (const uint8_t *)packet;
+		m_size = packet_size;
+		m_pages = &pages;
+		pages.consume(this);
+		completeQuery(waitq, 0);
+		return;
+	}
+
+	appendErrorListPacket(waitq, packet, packet_size, total_size);
+	pages.consume(NULL);
+}
+
 void nnpiExecErrorList::clearRequestSucceeded(nnpiWaitQueue &waitq)
 {
 	clear();
@@ -82,15 +225,29 @@ void nnpiExecErrorList::clearRequestSucceeded(nnpiWaitQueue &waitq)
 	waitq.update_and_notify([this]{ m_state = STATE_COMPLETED; m_complete_eventVal = 0; });
 }
 
+bool nnpiExecErrorList::getDesc(uint32_t idx, struct ipc_exec_error_desc *out_desc) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (idx >= m_desc_vec.size())
+		return false;
+
+	memcpy_s(out_desc, sizeof(*out_desc), m_data + m_desc_vec[idx], sizeof(*out_desc));
+
+	return true;
+}
+
 NNPError nnpiExecErrorList::getErrorMessage(uint32_t  idx,
 					    void     *buf,
 					    uint32_t  buf_size,
 					    uint32_t *out_buf_size) const
 {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
 	if (idx >= m_desc_vec.size())
 		return NNP_INVALID_ARGUMENT;
 
-	struct ipc_exec_error_desc *desc = m_desc_vec[idx];
+	const struct ipc_exec_error_desc *desc = (const struct ipc_exec_error_desc *)(m_data + m_desc_vec[idx]);
 
 	if (desc->error_msg_size == 0)
 		return NNP_INVALID_ARGUMENT;
@@ -98,7 +255,7 @@ NNPError nnpiExecErrorList::getErrorMessage(uint32_t  idx,
 	if (out_buf_size)
 		*out_buf_size = desc->error_msg_size;
 
-	void *msg_buf = (void *)(desc + 1);
+	const void *msg_buf = (const void *)(desc + 1);
 	if (buf && buf_size > 0) {
 		if (buf_size >= desc->error_msg_size)
 			memcpy_s(buf, buf_size, msg_buf, desc->error_msg_size);
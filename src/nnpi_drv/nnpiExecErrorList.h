@@ -10,9 +10,55 @@
 #include "nnpdrvInference.h"
 #include "nnpiWaitQueue.h"
 #include "nnpiHostProc.h"
+#include "nnpiChannel.h"
 #include <vector>
+#include <deque>
 #include <mutex>
 
+class nnpiExecErrorList;
+
+/*
+ * Tracks the pages of the context response ring that were filled by
+ * the device with error list packets.
+ * The ring head is advanced, and reported to the device, only when the
+ * oldest outstanding page has been consumed. An error list which fits
+ * in a single page is parsed in place and holds its page until the list
+ * is cleared. To never stall the device, held pages are evicted (copied
+ * to the list own buffer) once all but one of the ring pages are
+ * outstanding.
+ * next() and consume() are called only from the response thread.
+ */
+class nnpiResponsePages {
+public:
+	nnpiResponsePages() :
+		m_max_held(0)
+	{
+	}
+
+	void init(nnpiRingBuffer::ptr rb, nnpiChannel::ptr chan);
+	void shutdown();
+
+	bool canHold() const { return m_max_held > 0; }
+
+	/* returns the oldest filled page which was not consumed yet */
+	const void *next();
+
+	/* consumes the page returned by next(), keeps it held by holder if not NULL */
+	void consume(nnpiExecErrorList *holder);
+
+	/* releases all pages held by holder */
+	void release(nnpiExecErrorList *holder);
+
+private:
+	void advanceHead();
+
+	nnpiRingBuffer::ptr m_rb;
+	nnpiChannel::ptr    m_chan;
+	uint32_t            m_max_held;
+	std::deque<nnpiExecErrorList *> m_pages; /* holder of each outstanding page */
+	std::mutex          m_mutex;
+};
+
 class nnpiExecErrorList {
 public:
 	enum ErrorListState {
@@ -24,7 +70,9 @@ public:
 	nnpiExecErrorList() :
 		m_buf(NULL),
 		m_buf_size(0),
+		m_data(NULL),
 		m_size(0),
+		m_pages(NULL),
 		m_complete_eventVal(0),
 		m_state(STATE_CLEARED)
 	{
@@ -39,18 +87,21 @@ public:
 	void clear();
 	void startQuery();
 	void appendErrorListPacket(nnpiWaitQueue &waitq,
-				   void    *packet,
+				   const void *packet,
 				   uint32_t packet_size,
 				   uint32_t total_size,
 				   uint16_t error_eventVal = 0);
 
+	/* appends the packet in the next page of pages and consumes the page */
+	void appendErrorListPage(nnpiWaitQueue     &waitq,
+				 nnpiResponsePages &pages,
+				 const void        *packet,
+				 uint32_t           packet_size,
+				 uint32_t           total_size);
+
 	void clearRequestSucceeded(nnpiWaitQueue &waitq);
 
-	const struct ipc_exec_error_desc *getDesc(uint32_t idx) const {
-		if (idx < m_desc_vec.size())
-			return m_desc_vec[idx];
-		return NULL;
-	}
+	bool getDesc(uint32_t idx, struct ipc_exec_error_desc *out_desc) const;
 
 	NNPError getErrorMessage(uint32_t  idx,
 				 void     *buf,
@@ -66,6 +117,8 @@ public:
 	}
 
 private:
+	friend class nnpiResponsePages;
+
 	void clearFailedHostRes()
 	{
 		std::lock_guard<std::mutex> lock(m_mutex);
@@ -78,15 +131,19 @@ private:
 		m_failed_hostres.clear();
 	}
 
+	bool reserveBuf(uint32_t size);
+	void evictPage();
 	void completeQuery(nnpiWaitQueue &waitq, uint16_t event_val);
 
 private:
-	void          *m_buf;
+	void          *m_buf;      /* owned buffer, kept across queries */
 	uint32_t       m_buf_size;
+	const uint8_t *m_data;     /* m_buf or a held response ring page */
 	uint32_t       m_size;
+	nnpiResponsePages *m_pages; /* set while a response page may be held */
 	uint16_t       m_complete_eventVal;
 	ErrorListState m_state;
-	std::vector<struct ipc_exec_error_desc *> m_desc_vec;
+	std::vector<uint32_t> m_desc_vec; /* descriptor offsets in m_data */
 	std::vector<nnpiHostRes::ptr> m_failed_hostres;
-	std::mutex     m_mutex;
+	mutable std::mutex m_mutex;
 };
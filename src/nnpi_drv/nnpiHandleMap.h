@@ -6,81 +6,358 @@
 #pragma once
 
 #include <stdint.h>
-#include <map>
+#include <new>
 #include <memory>
-#include <algorithm>
+#include <atomic>
 #include <mutex>
+#include <sched.h>
+
+/*
+ * Generational slot table mapping public handles to objects.
+ *
+ * A handle encodes the slot generation in its upper 32 bits, and the
+ * map type tag, shard and slot index in its lower 32 bits. A handle of
+ * one map is never resolved by a map with another tag. find() is lock free: it
+ * pins the slot by bumping the slot reader count only while the slot
+ * generation still matches the handle, copies the object pointer and
+ * unpins. A removed or reused slot has a different generation, so stale
+ * handles are never resolved to a new object.
+ *
+ * Writers (makeHandle/remove) take only the mutex of one shard. Each
+ * thread allocates handles from its own shard, chosen round robin on
+ * first use, and slot chunks are allocated on demand and never moved
+ * or freed while the table exists, so readers never take a lock.
+ */
+
+/* handle type tags, one per map */
+enum nnpiHandleTag {
+	NNPI_HANDLE_TAG_HOSTRES = 1,
+	NNPI_HANDLE_TAG_CONTEXT,
+	NNPI_HANDLE_TAG_DEVRES,
+	NNPI_HANDLE_TAG_COPY,
+	NNPI_HANDLE_TAG_NETWORK,
+	NNPI_HANDLE_TAG_INFREQ,
+	NNPI_HANDLE_TAG_CMDLIST,
+	NNPI_HANDLE_TAG_CQ,
+	NNPI_HANDLE_TAG_SQUEUE,
+	NNPI_HANDLE_TAG_CMDLIST_TMPL
+};
 
 template <class T, class Key>
 class nnpiHandleMap {
 public:
-	typedef std::map<Key, std::shared_ptr<T>> map;
 	typedef void (*cb_func)(T *iter);
 
+	explicit nnpiHandleMap(nnpiHandleTag tag) :
+		m_tag(tag)
+	{
+		for (uint32_t s = 0; s < NUM_SHARDS; ++s) {
+			m_shards[s].num_slots = 0;
+			m_shards[s].free_head = NO_SLOT;
+			for (uint32_t c = 0; c < MAX_CHUNKS; ++c)
+				m_shards[s].chunks[c].store(nullptr, std::memory_order_relaxed);
+		}
+	}
+
+	~nnpiHandleMap()
+	{
+		for (uint32_t s = 0; s < NUM_SHARDS; ++s)
+			for (uint32_t c = 0; c < MAX_CHUNKS; ++c)
+				delete [] m_shards[s].chunks[c].load(std::memory_order_relaxed);
+	}
+
+	/* returns zero if obj is NULL or the table is full */
 	inline Key makeHandle(std::shared_ptr<T> obj)
 	{
-		std::lock_guard<std::mutex> lock(m_mutex);
-		Key hdl = (Key)((uintptr_t)obj.get());
-		if (obj.get()) {
-			while(m_map.find(hdl) != m_map.end())
-				hdl++;
-			m_map[hdl] = obj;
+		uint32_t first = thread_shard();
+		uint32_t idx;
+
+		if (!obj.get())
+			return (Key)0;
+
+		for (uint32_t i = 0; i < NUM_SHARDS; ++i) {
+			uint32_t s = (first + i) % NUM_SHARDS;
+			Shard &shard = m_shards[s];
+			std::lock_guard<std::mutex> lock(shard.mutex);
+
+			if (!alloc_slot(shard, idx))
+				continue;
+
+			Slot &slot = get_slot(shard, idx);
+			uint64_t gen = slot_gen(slot.state.load(std::memory_order_relaxed));
+
+			slot.obj = std::move(obj);
+			slot.state.store((gen << 32) | VALID, std::memory_order_release);
+
+			return make_handle(gen, s, idx);
 		}
-		return hdl;
+
+		return (Key)0;
 	}
 
 	inline std::shared_ptr<T> find(Key hdl)
 	{
-		std::lock_guard<std::mutex> lock(m_mutex);
 		std::shared_ptr<T> ret;
-		auto it = m_map.find(hdl);
+		Slot *slot = lookup((uint64_t)hdl);
+		uint64_t gen = (uint64_t)hdl >> 32;
+		uint64_t state;
+
+		if (!slot)
+			return ret;
 
-		if (it != m_map.end())
-			ret = it->second;
+		state = slot->state.load(std::memory_order_acquire);
+		do {
+			if (!(state & VALID) || slot_gen(state) != gen)
+				return ret;
+		} while (!slot->state.compare_exchange_weak(state, state + 1,
+							    std::memory_order_acquire,
+							    std::memory_order_acquire));
+
+		ret = slot->obj;
+		slot->state.fetch_sub(1, std::memory_order_release);
 
 		return ret;
 	}
 
 	inline bool remove(Key hdl)
 	{
-		std::lock_guard<std::mutex> lock(m_mutex);
-		size_t n = m_map.erase(hdl);
-		return n > 0;
+		std::shared_ptr<T> obj;
+		uint64_t h = (uint64_t)hdl;
+		Shard &shard = m_shards[(h >> INDEX_BITS) & (NUM_SHARDS - 1)];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		Slot *slot = lookup(h);
+
+		if (!slot || !invalidate(*slot, h >> 32))
+			return false;
+
+		obj = std::move(slot->obj);
+		free_slot(shard, (uint32_t)(h & INDEX_MASK));
+
+		/* obj is declared before the lock, it is released after unlocking */
+		return true;
 	}
 
+	/* removes all handles, waits for current readers like remove() */
 	void clear()
 	{
-		std::lock_guard<std::mutex> lock(m_mutex);
-		m_map.clear();
+		clear_slots(true);
+	}
+
+	/*
+	 * Removes all handles ignoring reader pins. Only for the child after
+	 * fork: pins taken by parent threads which were inside find() at
+	 * fork time are never released, as those threads do not exist in the
+	 * child, so waiting for them as clear() does would never return.
+	 */
+	void fork_child_clear()
+	{
+		clear_slots(false);
 	}
 
 	bool get_first(Key &out_hdl)
 	{
-		std::lock_guard<std::mutex> lock(m_mutex);
-		if (m_map.size() > 0) {
-			out_hdl = m_map.begin()->first;
-			return true;
+		for (uint32_t s = 0; s < NUM_SHARDS; ++s) {
+			Shard &shard = m_shards[s];
+			std::lock_guard<std::mutex> lock(shard.mutex);
+
+			for (uint32_t idx = 0; idx < shard.num_slots; ++idx) {
+				uint64_t state = get_slot(shard, idx).state.load(std::memory_order_acquire);
+
+				if (state & VALID) {
+					out_hdl = make_handle(slot_gen(state), s, idx);
+					return true;
+				}
+			}
 		}
 
 		return false;
 	}
 
-	std::mutex &mutex() { return m_mutex; }
+	/* locks out all writers, used around fork */
+	void lock()
+	{
+		for (uint32_t s = 0; s < NUM_SHARDS; ++s)
+			m_shards[s].mutex.lock();
+	}
 
-	void for_each_obj(cb_func user_cb)
+	void unlock()
 	{
-		std::lock_guard<std::mutex> lock(m_mutex);
+		for (uint32_t s = NUM_SHARDS; s > 0; --s)
+			m_shards[s - 1].mutex.unlock();
+	}
 
+	void for_each_obj(cb_func user_cb)
+	{
 		if (user_cb == nullptr)
 			return;
-		std::for_each(m_map.begin(), m_map.end(), [user_cb](std::pair<const Key, std::shared_ptr<T>>& pair)
-									{
-										user_cb(pair.second.get());
-									});
+
+		for (uint32_t s = 0; s < NUM_SHARDS; ++s) {
+			Shard &shard = m_shards[s];
+			std::lock_guard<std::mutex> lock(shard.mutex);
+
+			for (uint32_t idx = 0; idx < shard.num_slots; ++idx) {
+				Slot &slot = get_slot(shard, idx);
+
+				if (slot.state.load(std::memory_order_acquire) & VALID)
+					user_cb(slot.obj.get());
+			}
+		}
 	}
 
 private:
-	map m_map;
-	std::mutex m_mutex;
-};
+	static const uint32_t NUM_SHARDS = 16;
+	static const uint32_t INDEX_BITS = 16;
+	static const uint64_t INDEX_MASK = (1ULL << INDEX_BITS) - 1;
+	static const uint32_t CHUNK_SLOTS = 256;
+	static const uint32_t MAX_CHUNKS = (1U << INDEX_BITS) / CHUNK_SLOTS;
+	static const uint32_t NO_SLOT = UINT32_MAX;
+	static const uint32_t TAG_SHIFT = 24;
+	static const uint32_t SHARD_MASK = (1U << (TAG_SHIFT - INDEX_BITS)) - 1;
+
+	/* slot state: generation (32) | valid (1) | reader count (31) */
+	static const uint64_t VALID = 1ULL << 31;
+
+	struct Slot {
+		Slot() : state(1ULL << 32), next_free(NO_SLOT) {}
+
+		std::atomic<uint64_t> state;
+		std::shared_ptr<T>    obj;
+		uint32_t              next_free; /* protected by the shard mutex */
+	};
+
+	struct Shard {
+		std::mutex          mutex;
+		uint32_t            num_slots;
+		uint32_t            free_head;
+		std::atomic<Slot *> chunks[MAX_CHUNKS];
+	};
+
+	static inline uint64_t slot_gen(uint64_t state) { return state >> 32; }
+
+	static inline uint64_t next_gen(uint64_t gen)
+	{
+		gen = (gen + 1) & 0xffffffff;
+		return gen ? gen : 1;
+	}
+
+	static uint32_t thread_shard()
+	{
+		static std::atomic<uint32_t> s_next(0);
+		static thread_local uint32_t s_shard = NO_SLOT;
+
+		if (s_shard == NO_SLOT)
+			s_shard = s_next.fetch_add(1, std::memory_order_relaxed) % NUM_SHARDS;
+
+		return s_shard;
+	}
+
+	inline Key make_handle(uint64_t gen, uint32_t s, uint32_t idx) const
+	{
+		return (Key)((gen << 32) | ((uint64_t)m_tag << TAG_SHIFT) |
+			     ((uint64_t)s << INDEX_BITS) | idx);
+	}
+
+	static inline Slot &get_slot(Shard &shard, uint32_t idx)
+	{
+		return shard.chunks[idx / CHUNK_SLOTS].load(std::memory_order_relaxed)[idx % CHUNK_SLOTS];
+	}
+
+	inline Slot *lookup(uint64_t hdl)
+	{
+		uint32_t s = (hdl >> INDEX_BITS) & (NUM_SHARDS - 1);
+		uint32_t idx = hdl & INDEX_MASK;
+		Slot *chunk;
+
+		if (((hdl >> TAG_SHIFT) & 0xff) != m_tag ||
+		    ((hdl >> INDEX_BITS) & SHARD_MASK) >= NUM_SHARDS)
+			return nullptr;
+
+		chunk = m_shards[s].chunks[idx / CHUNK_SLOTS].load(std::memory_order_acquire);
+		if (!chunk)
+			return nullptr;
+
+		return &chunk[idx % CHUNK_SLOTS];
+	}
+
+	/* shard mutex must be held */
+	bool alloc_slot(Shard &shard, uint32_t &out_idx)
+	{
+		if (shard.free_head != NO_SLOT) {
+			out_idx = shard.free_head;
+			shard.free_head = get_slot(shard, out_idx).next_free;
+			return true;
+		}
 
+		if (shard.num_slots >= (1U << INDEX_BITS))
+			return false;
+
+		if (shard.num_slots % CHUNK_SLOTS == 0) {
+			Slot *chunk = new (std::nothrow) Slot[CHUNK_SLOTS];
+
+			if (!chunk)
+				return false;
+			shard.chunks[shard.num_slots / CHUNK_SLOTS].store(chunk, std::memory_order_release);
+		}
+
+		out_idx = shard.num_slots++;
+		return true;
+	}
+
+	/* shard mutex must be held */
+	void free_slot(Shard &shard, uint32_t idx)
+	{
+		get_slot(shard, idx).next_free = shard.free_head;
+		shard.free_head = idx;
+	}
+
+	/*
+	 * Clears the valid bit and moves to the next generation so no new
+	 * reader can pin the slot, then waits for current readers, which
+	 * only copy the object pointer, to unpin.
+	 */
+	bool invalidate(Slot &slot, uint64_t gen)
+	{
+		uint64_t state = slot.state.load(std::memory_order_relaxed);
+
+		do {
+			if (!(state & VALID) || slot_gen(state) != gen)
+				return false;
+		} while (!slot.state.compare_exchange_weak(state,
+							   (next_gen(gen) << 32) | (state & (VALID - 1)),
+							   std::memory_order_acq_rel,
+							   std::memory_order_relaxed));
+
+		while ((slot.state.load(std::memory_order_acquire) & (VALID - 1)) != 0)
+			sched_yield();
+
+		return true;
+	}
+
+	void clear_slots(bool wait_readers)
+	{
+		for (uint32_t s = 0; s < NUM_SHARDS; ++s) {
+			Shard &shard = m_shards[s];
+			std::lock_guard<std::mutex> lock(shard.mutex);
+
+			for (uint32_t idx = 0; idx < shard.num_slots; ++idx) {
+				Slot &slot = get_slot(shard, idx);
+				uint64_t state = slot.state.load(std::memory_order_relaxed);
+
+				if (!(state & VALID))
+					continue;
+				if (wait_readers) {
+					if (!invalidate(slot, slot_gen(state)))
+						continue;
+				} else {
+					slot.state.store(next_gen(slot_gen(state)) << 32,
+							 std::memory_order_release);
+				}
+				slot.obj.reset();
+				free_slot(shard, idx);
+			}
+		}
+	}
+
+	const uint32_t m_tag;
+	Shard m_shards[NUM_SHARDS];
+};
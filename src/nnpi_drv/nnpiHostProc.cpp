@@ -15,13 +15,15 @@
 #include <string.h>
 #include <misc/intel_nnpi.h>
 #include "nnpiDevice.h"
+#include "nnpiChannel.h"
 #include "nnp_log.h"
 #include <misc/nnp_error.h>
 
 static pthread_mutex_t s_global_mutex = PTHREAD_MUTEX_INITIALIZER;
 nnpiHostProc::weakptr nnpiHostProc::s_theProcHost;
 
-nnpiHandleMap<nnpiHostRes, uint64_t> nnpiHostRes::handle_map;
+nnpiHandleMap<nnpiHostRes, uint64_t> nnpiHostRes::handle_map(NNPI_HANDLE_TAG_HOSTRES);
+nnpiWaitStats nnpiHostRes::cpu_wait_stats;
 
 void nnpiGlobalLock()
 {
@@ -193,15 +195,20 @@ NNPError nnpiHostRes::lock_cpu_access(uint32_t timeoutUs, bool for_write)
 	if (m_cpu_locked)
 		return NNP_INVALID_ARGUMENT;
 
+	/* a copy of the resource may still be pending in the thread batch */
+	if (nnpiChannel::flushThreadBatch() != 0)
+		return NNP_IO_ERROR;
+
 	auto cond = [this, for_write] {
 		return (for_write ? m_readers == 0 : m_readers >= 0);
 	};
 
-	if (timeoutUs == UINT32_MAX) {
-		m_waitq.wait_lock(cond);
-		locked = true;
-	} else
-		locked = m_waitq.wait_timeout_lock(timeoutUs, cond);
+	/* host resources have no wait policy of their own */
+	nnpiWaitPolicy policy = { 0, 0 };
+	if (nnpiWaitQueue::threadWaitPolicy())
+		policy = *nnpiWaitQueue::threadWaitPolicy();
+
+	locked = m_waitq.wait_policy_lock(policy, timeoutUs, &cpu_wait_stats, cond);
 
 	if (!locked)
 		return NNP_TIMED_OUT;
@@ -282,6 +289,7 @@ void nnpiHostRes::unlock_device_access(bool for_write)
 					else
 						m_readers--;
 				  });
+	m_event.signal();
 }
 
 nnpiHostRes::~nnpiHostRes()
@@ -10,6 +10,7 @@
 #include <atomic>
 #include "nnpdrvInference.h"
 #include "nnpiWaitQueue.h"
+#include "nnpiCompletion.h"
 #include "nnpiHandleMap.h"
 
 extern "C" {
@@ -56,6 +57,7 @@ public:
 	~nnpiHostRes();
 
 	static nnpiHandleMap<nnpiHostRes, uint64_t> handle_map;
+	static nnpiWaitStats cpu_wait_stats; /* lock_cpu_access wait phases */
 
 	NNPError lock_cpu_access(uint32_t timeoutUs, bool for_write);
 	NNPError unlock_cpu_access();
@@ -76,6 +78,9 @@ public:
 	}
 	bool broken() const { return std::atomic_load(&m_failed_copy_ops) > 0; }
 
+	/* signalled when a device access to the resource is released */
+	nnpiCompletionEvent &completionEvent() { return m_event; }
+
 	void set_user_hdl(uint64_t user_hdl) { m_user_hdl = user_hdl; }
 	uint64_t get_user_hdl() { return m_user_hdl; }
 
@@ -142,4 +147,5 @@ private:
 	int              m_cpu_locked; /* locked for cpu access */
 	bool             m_cpu_sync_needed;
 	uint64_t         m_user_hdl;
+	nnpiCompletionEvent m_event;
 };
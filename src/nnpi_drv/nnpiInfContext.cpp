@@ -18,6 +18,7 @@
 
 static const uint32_t H2C_RINGBUF_SIZE = 2 * NNP_PAGE_SIZE;
 static const uint32_t C2H_RINGBUF_SIZE = 2 * NNP_PAGE_SIZE;
+static const uint32_t H2C_RINGBUF_GROW_STALLS = 16;
 
 
 NNPError event_valToNNPError(uint32_t event_val)
@@ -71,16 +72,23 @@ NNPError event_valToNNPError(uint32_t event_val)
 
 nnpiInfContext::~nnpiInfContext()
 {
+	m_resp_pages.shutdown();
 	delete m_objdb;
 }
 
 int nnpiInfContext::wait_create_command(const InfContextObjID &id,
-					union c2h_event_report &reply)
+					union c2h_event_report &reply,
+					uint32_t timeout_us)
 {
-	m_waitq.wait_lock([this,id]{
-			  return m_create_reply.find(id) != m_create_reply.end() ||
-				 broken();
-			  });
+	auto cond = [this,id]{
+		return m_create_reply.find(id) != m_create_reply.end() ||
+		       broken();
+	};
+
+	if (timeout_us == UINT32_MAX)
+		m_waitq.wait_lock(cond);
+	else if (!m_waitq.wait_timeout_lock(timeout_us, cond))
+		return -ETIMEDOUT;
 
 	if (broken()) {
 		reply.value = m_critical_error.value;
@@ -147,10 +155,15 @@ bool nnpiInfContext::process_create_reply(const union c2h_event_report *ev)
 			   ev->obj_valid ? ev->obj_id : -1,
 			   ev->obj_valid_2 ? ev->obj_id_2 : -1);
 
-	m_waitq.update_and_notify([this,id,ev,t]{
+	nnpiCommandList::ptr cmdlist;
+
+	if (t == INF_OBJ_TYPE_CMD && ev->obj_valid)
+		cmdlist = m_objdb->getCommandList(ev->obj_id);
+
+	m_waitq.update_and_notify([this,id,ev,&cmdlist]{
 		m_create_reply[id].value = ev->value;
-		if (t == INF_OBJ_TYPE_CMD && m_cmdlist_finalized_in_progress > 0)
-			m_cmdlist_finalized_in_progress--;
+		if (cmdlist.get())
+			cmdlist->release_create_refs();
 		});
 
 	return true;
@@ -174,12 +187,32 @@ int nnpiInfContext::send_create_command(const void            *buf,
 NNPError nnpiInfContext::create(uint32_t                dev_num,
 				uint8_t                 flags,
 				nnpiInfContext::ptr    &out_ctx)
+{
+	NNPInferContextOptions options;
+
+	memset(&options, 0, sizeof(options));
+	options.flags = flags;
+
+	return create(dev_num, options, out_ctx);
+}
+
+NNPError nnpiInfContext::create(uint32_t                      dev_num,
+				const NNPInferContextOptions &options,
+				nnpiInfContext::ptr          &out_ctx)
 {
 	int ret;
 	NNPError err = NNP_IO_ERROR;
 	nnpiInfContext::ptr ctx;
 	union h2c_ChanInferenceContextOp msg;
 	union c2h_event_report reply;
+	uint8_t flags = options.flags;
+	uint32_t h2c_size = options.cmdRingSize ? options.cmdRingSize : H2C_RINGBUF_SIZE;
+	uint32_t c2h_size = options.respRingSize ? options.respRingSize : C2H_RINGBUF_SIZE;
+
+	if ((h2c_size % NNP_PAGE_SIZE) != 0 ||
+	    (c2h_size % NNP_PAGE_SIZE) != 0 ||
+	    (options.maxCmdRingSize % NNP_PAGE_SIZE) != 0)
+		return NNP_INVALID_ARGUMENT;
 
 	ctx.reset(new nnpiInfContext(new nnpiContextObjDB()));
 
@@ -200,27 +233,42 @@ NNPError nnpiInfContext::create(uint32_t                dev_num,
 	//
 	// Create H2C and C2H ring buffers
 	//
-	ret = ctx->m_chan->createCommandRingBuffer(0, H2C_RINGBUF_SIZE);
+	ret = ctx->m_chan->createCommandRingBuffer(0, h2c_size);
 	if (ret != 0)
 		goto fail;
 
 	// execute RB
-	ret = ctx->m_chan->createCommandRingBuffer(1, H2C_RINGBUF_SIZE);
+	ret = ctx->m_chan->createCommandRingBuffer(1, h2c_size);
 	if (ret != 0)
 		goto fail;
 
-	ret = ctx->m_chan->createResponseRingBuffer(0, C2H_RINGBUF_SIZE);
+	ret = ctx->m_chan->createResponseRingBuffer(0, c2h_size);
 	if (ret != 0)
 		goto fail;
 
+	if (options.maxCmdRingSize > h2c_size)
+		ctx->m_chan->setCommandRingBufferAutoGrow(options.maxCmdRingSize,
+							  options.cmdRingGrowStalls ?
+							  options.cmdRingGrowStalls :
+							  H2C_RINGBUF_GROW_STALLS);
+
 	ctx->m_cmd_rb = ctx->m_chan->commandRingBuffer(0);
 	ctx->m_resp_rb = ctx->m_chan->responseRingBuffer(0);
+	ctx->m_resp_pages.init(ctx->m_resp_rb, ctx->m_chan);
 
 	msg.value = 0;
 	msg.opcode = NNP_IPC_H2C_OP_CHAN_INF_CONTEXT;
 	msg.chan_id = ctx->m_chan->id();
 	msg.rb_id = 0;
-	msg.cflags = flags;
+	msg.cflags = flags & (NNP_IPC_CTX_CFLAG_ULT | NNP_IPC_CTX_CFLAG_ULT_LAST);
+	if (ctx->m_chan->protocolVersion() >= NNP_IPC_CHAN_CTX_FEATURES_VERSION) {
+		if (flags & NNP_CMDLIST_PIPELINE_CONTEXT)
+			msg.cflags |= NNP_IPC_CTX_FEATURE_CMDLIST_PIPELINE;
+		if (flags & NNP_CMDLIST_REBIND_CONTEXT)
+			msg.cflags |= NNP_IPC_CTX_FEATURE_CMDLIST_REBIND;
+		if (flags & NNP_PACKED_RINGBUF_CONTEXT)
+			msg.cflags |= NNP_IPC_CTX_FEATURE_PACKED_RB;
+	}
 
 	ret = ctx->send_create_command(&msg,
 				       sizeof(msg),
@@ -236,6 +284,18 @@ NNPError nnpiInfContext::create(uint32_t                dev_num,
 		goto fail;
 	}
 
+	/* features the card enabled, nothing is written to the rings yet */
+	ctx->m_features = reply.event_val & msg.cflags & NNP_IPC_CTX_CFLAG_FEATURES_MASK;
+
+	if (flags & NNP_PACKED_RINGBUF_CONTEXT) {
+		if (!ctx->has_feature(NNP_IPC_CTX_FEATURE_PACKED_RB)) {
+			err = NNP_NOT_SUPPORTED;
+			goto fail;
+		}
+		ctx->m_chan->commandRingBuffer(0)->setPacked(true);
+		ctx->m_chan->commandRingBuffer(1)->setPacked(true);
+	}
+
 	out_ctx = ctx;
 
 	return NNP_NO_ERROR;
@@ -522,7 +582,7 @@ NNPError nnpiInfContext::scheduleCopy(uint16_t copy_id,
 		msg.priority = priority;
 		msg.copySize = byteSize;
 
-		n = m_chan->write(&msg, sizeof(msg));
+		n = m_chan->write_batched(&msg, sizeof(msg));
 		if (n != sizeof(msg))
 			return NNP_IO_ERROR;
 	} else {
@@ -534,7 +594,7 @@ NNPError nnpiInfContext::scheduleCopy(uint16_t copy_id,
 		msg.priority = priority;
 		msg.copySize = byteSize;
 
-		n = m_chan->write(&msg, sizeof(msg));
+		n = m_chan->write_batched(&msg, sizeof(msg));
 		if (n != sizeof(msg))
 			return NNP_IO_ERROR;
 	}
@@ -562,13 +622,115 @@ NNPError nnpiInfContext::scheduleCopySubres(uint16_t copy_id,
 	msg.hostres_id = hostres_map_id;
 	msg.copySize = (uint16_t)(byteSize - 1);
 	msg.dstOffset = devres_offset;
-	n = m_chan->write(&msg, sizeof(msg));
+	n = m_chan->write_batched(&msg, sizeof(msg));
 	if (n != sizeof(msg))
 		return NNP_IO_ERROR;
 
 	return NNP_NO_ERROR;
 }
 
+void nnpiInfContext::queryRingInfo(NNPInferContextRingInfo *out_info)
+{
+	nnpiRingBuffer::ptr create_rb(m_chan->commandRingBuffer(0));
+	nnpiRingBuffer::ptr exec_rb(m_chan->commandRingBuffer(1));
+
+	memset(out_info, 0, sizeof(*out_info));
+	if (create_rb.get()) {
+		out_info->createRingSize = create_rb->size();
+		out_info->createRingStalls = create_rb->stalls();
+	}
+	if (exec_rb.get()) {
+		out_info->executeRingSize = exec_rb->size();
+		out_info->executeRingStalls = exec_rb->stalls();
+	}
+	if (m_resp_rb.get())
+		out_info->responseRingSize = m_resp_rb->size();
+	out_info->numRingGrows = m_chan->numCommandRingBufferGrows();
+}
+
+void nnpiInfContext::queryIdUsage(NNPInferContextIdUsage *out_usage)
+{
+	m_devres_ida.get_usage(&out_usage->deviceResources);
+	m_copy_ida.get_usage(&out_usage->copies);
+	m_devnet_ida.get_usage(&out_usage->networks);
+	m_cmdlist_ida.get_usage(&out_usage->commandLists);
+}
+
+NNPError nnpiInfContext::beginSubmitBatch()
+{
+	int ret;
+
+	if (broken())
+		return NNP_CONTEXT_BROKEN;
+
+	ret = nnpiChannel::beginBatch(m_chan);
+	if (ret == ENOMEM)
+		return NNP_OUT_OF_MEMORY;
+	else if (ret != 0)
+		return NNP_IO_ERROR;
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpiInfContext::submitBatch()
+{
+	if (m_chan->submitBatch() != 0)
+		return broken() ? NNP_CONTEXT_BROKEN : NNP_IO_ERROR;
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpiInfContext::beginCapture(const std::shared_ptr<nnpiCommandList> &cmdlist)
+{
+	std::lock_guard<std::mutex> lock(m_capture_mutex);
+
+	if (broken())
+		return NNP_CONTEXT_BROKEN;
+
+	if (m_capture.get())
+		return NNP_DEVICE_BUSY;
+
+	m_capture = cmdlist;
+	m_capture_thread = std::this_thread::get_id();
+	m_capturing = true;
+
+	return NNP_NO_ERROR;
+}
+
+std::shared_ptr<nnpiCommandList> nnpiInfContext::endCapture()
+{
+	std::lock_guard<std::mutex> lock(m_capture_mutex);
+	std::shared_ptr<nnpiCommandList> cmdlist;
+
+	if (m_capture_thread != std::this_thread::get_id())
+		return cmdlist;
+
+	cmdlist.swap(m_capture);
+	m_capture_thread = std::thread::id();
+	m_capturing = false;
+
+	return cmdlist;
+}
+
+nnpiArena &nnpiInfContext::capture_arena()
+{
+	return m_capture->cmd_arena();
+}
+
+NNPError nnpiInfContext::capture_append(const std::vector<nnpiInfCommandSchedParams *> &cmds)
+{
+	NNPError ret = NNP_NO_ERROR;
+
+	for (size_t i = 0; i < cmds.size(); ++i) {
+		if (ret == NNP_NO_ERROR)
+			ret = m_capture->append(cmds[i]);
+		if (ret != NNP_NO_ERROR)
+			delete cmds[i];
+	}
+
+	return ret;
+}
+
 NNPError nnpiInfContext::createMarker(uint32_t &out_marker)
 {
 	std::lock_guard<std::mutex> lock(m_mutex);
@@ -581,7 +743,15 @@ NNPError nnpiInfContext::createMarker(uint32_t &out_marker)
 	msg.chan_id = m_chan->id();
 	msg.syncSeq = marker;
 
-	if (m_chan->write(&msg, sizeof(msg)) != sizeof(msg))
+	if (m_chan->write_batched(&msg, sizeof(msg)) != sizeof(msg))
+		return NNP_IO_ERROR;
+
+	/*
+	 * sync points must reach the card in sequence order, so a pending
+	 * submission batch is flushed together with the marker while
+	 * the context lock is held.
+	 */
+	if (m_chan->flushBatch() != 0)
 		return NNP_IO_ERROR;
 
 	out_marker = m_sync_point.getMarker();
@@ -589,12 +759,122 @@ NNPError nnpiInfContext::createMarker(uint32_t &out_marker)
 	return NNP_NO_ERROR;
 }
 
+NNPError nnpiInfContext::addMarkerWatch(uint32_t                        marker,
+					const nnpiCompletionQueue::ptr &cq,
+					uint64_t                        user_data)
+{
+	MarkerWatch w;
+
+	w.sp = SyncPoint(marker);
+	w.cq = cq;
+	w.user_data = user_data;
+	w.cb = nullptr;
+	w.cb_data = nullptr;
+	w.cb_worker = false;
+
+	return addMarkerWatch(w);
+}
+
+NNPError nnpiInfContext::addMarkerCallback(uint32_t          marker,
+					   nnpiCompletionCb  cb,
+					   void             *user_data,
+					   bool              on_worker)
+{
+	MarkerWatch w;
+
+	w.sp = SyncPoint(marker);
+	w.user_data = 0;
+	w.cb = cb;
+	w.cb_data = user_data;
+	w.cb_worker = on_worker;
+
+	return addMarkerWatch(w);
+}
+
+NNPError nnpiInfContext::addMarkerWatch(const MarkerWatch &w)
+{
+	std::deque<MarkerWatch>::iterator it;
+	SyncPoint sp(w.sp);
+
+	if (m_chan->flushBatch() != 0)
+		return NNP_IO_ERROR;
+
+	/* keep watches ordered, markers are usually watched in order */
+	m_waitq.lock();
+	it = m_marker_watches.end();
+	while (it != m_marker_watches.begin() && sp < (it - 1)->sp)
+		--it;
+	m_marker_watches.insert(it, w);
+	m_has_marker_watches = true;
+	m_waitq.unlock();
+
+	/* the marker may have already completed */
+	completeMarkerWatches();
+
+	return NNP_NO_ERROR;
+}
+
+void nnpiInfContext::completeMarkerWatches()
+{
+	std::vector<std::pair<MarkerWatch, uint32_t>> ready;
+	nnpiCompletionQueue::entry e;
+
+	if (!m_has_marker_watches)
+		return;
+
+	m_waitq.lock();
+	if (broken() && !aborted()) {
+		for (auto &w : m_marker_watches)
+			ready.push_back(std::make_pair(w, 1));
+		m_marker_watches.clear();
+	} else {
+		while (!m_marker_watches.empty() &&
+		       m_last_completed_sync_point >= m_marker_watches.front().sp) {
+			ready.push_back(std::make_pair(m_marker_watches.front(), 0));
+			m_marker_watches.pop_front();
+		}
+
+		if (!m_failed_sync_points.empty()) {
+			for (auto w = m_marker_watches.begin(); w != m_marker_watches.end();) {
+				if (m_failed_sync_points.find(w->sp.val()) != m_failed_sync_points.end()) {
+					ready.push_back(std::make_pair(*w, 1));
+					w = m_marker_watches.erase(w);
+				} else {
+					++w;
+				}
+			}
+		}
+	}
+	m_has_marker_watches = !m_marker_watches.empty();
+	m_waitq.unlock();
+
+	for (auto &r : ready) {
+		if (r.first.cb) {
+			nnpiCallbackPool::run(r.first.cb,
+					      r.first.sp.getMarker(),
+					      r.second,
+					      r.first.cb_data,
+					      r.first.cb_worker);
+			continue;
+		}
+
+		e.type = NNP_COMPLETION_ENTRY_MARKER;
+		e.numErrors = r.second;
+		e.handle = r.first.sp.getMarker();
+		e.userData = r.first.user_data;
+		r.first.cq->post(e);
+	}
+}
+
 NNPError nnpiInfContext::waitMarker(uint32_t marker,
 				    uint32_t timeout_us)
 {
 	SyncPoint sp(marker);
 	NNPError ret = NNP_NO_ERROR;
 
+	if (m_chan->flushBatch() != 0)
+		return NNP_IO_ERROR;
+
 	auto cond = [this,sp] {
 			bool ret = m_last_completed_sync_point >= sp ||
 				   m_failed_sync_points.find(sp.val()) != m_failed_sync_points.end() ||
@@ -602,14 +882,7 @@ NNPError nnpiInfContext::waitMarker(uint32_t marker,
 			return ret;
 			};
 
-	bool found;
-
-	if (timeout_us == UINT32_MAX) {
-		m_waitq.wait_lock(cond);
-		found = true;
-	} else {
-		found = m_waitq.wait_timeout_lock(timeout_us, cond);
-	}
+	bool found = m_waitq.wait_policy_lock(waitPolicy(), timeout_us, &m_wait_stats, cond);
 
 	if (!found)
 		ret = NNP_TIMED_OUT;
@@ -688,8 +961,10 @@ void nnpiInfContext::parseExecError(nnpiExecErrorList *list,
 				    uint32_t idx,
 				    NNPCriticalErrorInfo *out_err)
 {
-	const struct ipc_exec_error_desc *desc = list->getDesc(idx);
-	if (!desc)
+	struct ipc_exec_error_desc d;
+	const struct ipc_exec_error_desc *desc = &d;
+
+	if (!list->getDesc(idx, &d))
 		return;
 
 	if (desc->cmd_type == CMDLIST_CMD_INFREQ) {
@@ -883,6 +1158,8 @@ void nnpiInfContext::processExecErrorList(union c2h_ExecErrorList *msg)
 		if (!cmdlist.get()) {
 			uint16_t cmdlistID = msg->cmdID;
 			nnp_log_err(GENERAL_LOG, "Got error list for not existing cmdlist %u\n", cmdlistID);
+			if (!msg->is_error && msg->clear_status == 0 && m_resp_pages.next() != NULL)
+				m_resp_pages.consume(NULL);
 			return;
 		}
 		list = cmdlist->getErrorList();
@@ -894,19 +1171,16 @@ void nnpiInfContext::processExecErrorList(union c2h_ExecErrorList *msg)
 	}
 
 	if (msg->clear_status == 0) {
-		uint32_t bsize, cont;
-		void *packet = m_resp_rb->lockAvailSpace(NNP_PAGE_SIZE,
-							 bsize,
-							 cont,
-							 0);
-		if (!packet) {
+		const void *packet = m_resp_pages.next();
+
+		if (!packet)
 			list->appendErrorListPacket(m_waitq, NULL, 0, 0, NNP_IPC_IO_ERROR);
-		} else {
-			list->appendErrorListPacket(m_waitq, packet, msg->pkt_size + 1, msg->total_size);
-			m_resp_rb->unlockAvailSpace(NNP_PAGE_SIZE);
-			if(!m_chan->sendResponseRingBufferHeadUpdate(0, NNP_PAGE_SIZE))
-				nnp_log_err(GENERAL_LOG, "FATAL: failed to update response ring bufer head!!!\n");
-		}
+		else
+			list->appendErrorListPage(m_waitq,
+						  m_resp_pages,
+						  packet,
+						  msg->pkt_size + 1,
+						  msg->total_size);
 	} else {
 		list->clearRequestSucceeded(m_waitq);
 	}
@@ -922,10 +1196,20 @@ void nnpiInfContext::failAllScheduledCopyCommands()
 void nnpiInfContext::completeAllCommandLists()
 {
 	m_objdb->for_each_cmdlist([](nnpiCommandList::ptr cmd) {
-					cmd->complete();
+					cmd->complete_all();
 				});
 }
 
+static inline bool is_object_destroyed_event(uint32_t event_code)
+{
+	return event_code == NNP_IPC_DEVRES_DESTROYED ||
+	       event_code == NNP_IPC_DEVNET_DESTROYED ||
+	       event_code == NNP_IPC_INFREQ_DESTROYED ||
+	       event_code == NNP_IPC_COPY_DESTROYED ||
+	       event_code == NNP_IPC_CMD_DESTROYED ||
+	       event_code == NNP_IPC_CONTEXT_DESTROYED;
+}
+
 bool nnpiInfContext::response_handler(const void     *_ctx,
 				      const uint64_t *response,
 				      uint32_t        response_size)
@@ -934,6 +1218,7 @@ bool nnpiInfContext::response_handler(const void     *_ctx,
 	union c2h_chan_msg_header *msg = (union c2h_chan_msg_header *)response;
 
 	if (response == nullptr) {
+		nnpiWaitQueue::flushNotifyBatch();
 		ctx->failAllScheduledCopyCommands();
 		/* channel was killed - destroy context */
 		/* make it broken to wakeup all */
@@ -943,6 +1228,7 @@ bool nnpiInfContext::response_handler(const void     *_ctx,
 					};
 		if (!ctx->card_fatal() && response_size == 0) {
 			ctx->m_waitq.update_and_notify(set_killed);
+			ctx->signalCriticalError();
 			ctx->completeAllCommandLists();
 		} else { // killed from atfork, don't take lock, no need to notify
 			set_killed();
@@ -956,12 +1242,18 @@ bool nnpiInfContext::response_handler(const void     *_ctx,
 	if (msg->opcode == NNP_IPC_C2H_OP_EVENT_REPORT) {
 		union c2h_event_report *ev = (union c2h_event_report *)msg;
 
+		/* objects may be released below, issue deferred wakeups first */
+		if (is_card_fatal_drv_event(ev->event_code) ||
+		    is_object_destroyed_event(ev->event_code))
+			nnpiWaitQueue::flushNotifyBatch();
+
 		if (is_card_fatal_drv_event(ev->event_code)) {
 			ctx->failAllScheduledCopyCommands();
 			ctx->m_waitq.update_and_notify([ctx,ev]{
 							if (ctx->m_critical_error.value == 0)
 								ctx->m_critical_error.value = ev->value;
 							});
+			ctx->signalCriticalError();
 			ctx->completeAllCommandLists();
 			ctx->m_objdb->clearAll();
 			nnpi_utils_reset_m_this(ctx->m_this);
@@ -979,6 +1271,7 @@ bool nnpiInfContext::response_handler(const void     *_ctx,
 							    ev->event_code == NNP_IPC_ABORT_REQUEST)
 								ctx->m_critical_error.value = ev->value;
 							});
+			ctx->signalCriticalError();
 			ctx->completeAllCommandLists();
 
 			return false;
@@ -1029,6 +1322,11 @@ bool nnpiInfContext::response_handler(const void     *_ctx,
 						cmdlist->complete();
 					else
 						cmdlist->addError(ev);
+				} else {
+					bool failed = (ev->event_code == NNP_IPC_EXECUTE_COPY_FAILED ||
+						       ev->event_code == NNP_IPC_EXECUTE_COPY_SUBRES_FAILED);
+
+					copy->completionEvent().signal(copy->user_hdl(), failed ? 1 : 0);
 				}
 			}
 		} else if (ev->event_code == NNP_IPC_EXECUTE_CPYLST_SUCCESS ||
@@ -1095,6 +1393,8 @@ bool nnpiInfContext::response_handler(const void     *_ctx,
 			return true;
 		} else if (ev->event_code == NNP_IPC_CREATE_SYNC_FAILED) {
 			ctx->m_waitq.update_and_notify([ctx,ev]{ ctx->m_failed_sync_points.insert(ev->obj_id); });
+			ctx->m_marker_event.signal();
+			ctx->completeMarkerWatches();
 		} else if (ev->event_code == NNP_IPC_EC_FAILED_TO_RELEASE_CREDIT) {
 			nnpiCommandList::ptr cmdlist;
 
@@ -1114,6 +1414,8 @@ bool nnpiInfContext::response_handler(const void     *_ctx,
 	} else if (msg->opcode == NNP_IPC_C2H_OP_CHAN_SYNC_DONE) {
 		union c2h_ChanSyncDone *sync = (union c2h_ChanSyncDone *)msg;
 		ctx->m_waitq.update_and_notify([ctx,sync]{ ctx->m_last_completed_sync_point.set(sync->syncSeq); });
+		ctx->m_marker_event.signal();
+		ctx->completeMarkerWatches();
 	} else if (msg->opcode == NNP_IPC_C2H_OP_CHAN_INFREQ_FAILED) {
 		union c2h_ChanInfReqFailed *reqfail = (union c2h_ChanInfReqFailed *)msg;
 		union c2h_event_report event;
@@ -1162,7 +1464,7 @@ NNPError nnpiInfContext::trace_user_data(const char *key,
 	memcpy_s(&keyU64, sizeof(uint64_t), key, size);
 	msg.key = keyU64;
 
-	if (m_chan->write(&msg, sizeof(msg)) != sizeof(msg))
+	if (m_chan->write_batched(&msg, sizeof(msg)) != sizeof(msg))
 		return NNP_IO_ERROR;
 
 	return NNP_NO_ERROR;
@@ -1183,7 +1485,7 @@ NNPError nnpiInfContext::send_user_handle(InfContextObjType type,
 	msg.val2 = id2;
 	msg.user_handle = user_handle;
 
-	if (m_chan->write(&msg, sizeof(msg)) != sizeof(msg))
+	if (m_chan->write_batched(&msg, sizeof(msg)) != sizeof(msg))
 		return NNP_IO_ERROR;
 
 	return NNP_NO_ERROR;
@@ -11,12 +11,16 @@
 #include "nnpdrvInference.h"
 #include "nnpiExecErrorList.h"
 #include <set>
+#include <deque>
 #include <atomic>
 #include <mutex>
+#include <thread>
 
 NNPError event_valToNNPError(uint32_t event_val);
 
 class nnpiContextObjDB;
+class nnpiCommandList;
+class nnpiInfCommandSchedParams;
 
 class InfContextObjID {
 public:
@@ -120,6 +124,10 @@ public:
 			       uint8_t              flags,
 			       nnpiInfContext::ptr &out_ctx);
 
+	static NNPError create(uint32_t                      dev_num,
+			       const NNPInferContextOptions &options,
+			       nnpiInfContext::ptr          &out_ctx);
+
 	~nnpiInfContext();
 
 	NNPError destroy();
@@ -138,9 +146,17 @@ public:
 			is_card_fatal_drv_event(m_critical_error.event_code);
 	}
 
+	/* optional channel feature (NNP_IPC_CTX_FEATURE_*) enabled by the card */
+	bool has_feature(uint8_t feature) const {
+		return (m_features & feature) == feature;
+	}
+
 	NNPError recover();
 
-	nnpiChannel::ptr chan() { return m_chan; }
+	const nnpiChannel::ptr &chan() const { return m_chan; }
+
+	/* orders payload uploads to the execute ring (ring 1) by priority */
+	nnpiPriorityLock &execRingLock() { return m_exec_ring_lock; }
 	nnpiDevice::ptr device() { return m_chan->device(); }
 	nnpiContextObjDB *objdb() { return m_objdb; }
 
@@ -209,8 +225,65 @@ public:
 				const InfContextObjID &id,
 				union c2h_event_report &reply);
 
+	/* returns -ETIMEDOUT if no reply arrived within timeout_us */
 	int wait_create_command(const InfContextObjID &id,
-				union c2h_event_report &reply);
+				union c2h_event_report &reply,
+				uint32_t timeout_us = UINT32_MAX);
+
+	NNPError beginSubmitBatch();
+	NNPError submitBatch();
+
+	void queryRingInfo(NNPInferContextRingInfo *out_info);
+	void queryIdUsage(NNPInferContextIdUsage *out_usage);
+
+	/*
+	 * Wait policy used by marker and command list waits of this
+	 * context, unless overridden by the calling thread.
+	 */
+	void setWaitPolicy(const nnpiWaitPolicy &policy)
+	{
+		m_wait_spin_count = policy.spin_count;
+		m_wait_yield_count = policy.yield_count;
+	}
+
+	nnpiWaitPolicy waitPolicy() const
+	{
+		const nnpiWaitPolicy *tp = nnpiWaitQueue::threadWaitPolicy();
+		nnpiWaitPolicy policy;
+
+		if (tp)
+			return *tp;
+
+		policy.spin_count = m_wait_spin_count;
+		policy.yield_count = m_wait_yield_count;
+		return policy;
+	}
+
+	nnpiWaitStats &waitStats() { return m_wait_stats; }
+
+	/*
+	 * Completion events - the marker event is signalled when markers
+	 * complete or fail, the error event when a critical error is set.
+	 */
+	nnpiCompletionEvent &markerEvent() { return m_marker_event; }
+	nnpiCompletionEvent &errorEvent() { return m_error_event; }
+
+	/*
+	 * Posts an entry to cq when the marker completes, fails or the
+	 * context becomes broken.
+	 */
+	NNPError addMarkerWatch(uint32_t                        marker,
+				const nnpiCompletionQueue::ptr &cq,
+				uint64_t                        user_data);
+
+	/*
+	 * Calls cb, once, when the marker completes, fails or the
+	 * context becomes broken.
+	 */
+	NNPError addMarkerCallback(uint32_t          marker,
+				   nnpiCompletionCb  cb,
+				   void             *user_data,
+				   bool              on_worker);
 
 	NNPError createMarker(uint32_t &out_marker);
 	NNPError waitMarker(uint32_t marker,
@@ -241,46 +314,108 @@ public:
 	void set_user_hdl(uint64_t user_hdl) { m_user_hdl = user_hdl; }
 	uint64_t user_hdl() const { return m_user_hdl; }
 
-	void cmdlist_finalized_add(int i) {
-		m_waitq.update_and_notify([this, i] { m_cmdlist_finalized_in_progress += i; });
+	/*
+	 * Schedules of an object wait while a command list referencing it is
+	 * being created on the device. f updates the objects create_refs.
+	 */
+	template <class F>
+	void update_create_refs(F f) {
+		m_waitq.update_and_notify(f);
+	}
+
+	template <class Pred>
+	bool test_create_refs(Pred p) {
+		std::lock_guard<std::mutex> lock(m_waitq.mutex());
+		return p();
 	}
 
-	bool wait_can_schedule() {
-		m_waitq.wait([this] { return m_cmdlist_finalized_in_progress == 0 || broken(); });
+	template <class Pred>
+	bool wait_can_schedule(Pred no_create_refs) {
+		m_waitq.wait([this, &no_create_refs] { return no_create_refs() || broken(); });
 		return !broken();
 	}
 
+	/*
+	 * Capture mode - while a capture list is set, schedules of copies,
+	 * infer requests and command lists of the context made by the
+	 * thread which began the capture are appended to it instead of
+	 * being sent to the device. Schedules of other threads are sent
+	 * as usual, and only the capturing thread may end the capture.
+	 */
+	NNPError beginCapture(const std::shared_ptr<nnpiCommandList> &cmdlist);
+	std::shared_ptr<nnpiCommandList> endCapture();
+	bool capturing() {
+		if (!m_capturing.load(std::memory_order_relaxed))
+			return false;
+		std::lock_guard<std::mutex> lock(m_capture_mutex);
+		return m_capture.get() && m_capture_thread == std::this_thread::get_id();
+	}
+
+	/*
+	 * If the calling thread is capturing, calls make(arena, cmds) to
+	 * create the commands to append in the command arena of the capture
+	 * list and appends them to it. Returns false if the calling thread
+	 * is not capturing, make is then not called.
+	 */
+	template <class F>
+	bool capture(F make, NNPError &ret)
+	{
+		std::lock_guard<std::mutex> lock(m_capture_mutex);
+		std::vector<nnpiInfCommandSchedParams *> cmds;
+
+		if (!m_capture.get() || m_capture_thread != std::this_thread::get_id())
+			return false;
+
+		make(capture_arena(), cmds);
+		ret = capture_append(cmds);
+
+		return true;
+	}
+
 private:
+	/* m_capture_mutex must be held and a capture list set */
+	nnpiArena &capture_arena();
+	NNPError capture_append(const std::vector<nnpiInfCommandSchedParams *> &cmds);
+
 	explicit nnpiInfContext(nnpiContextObjDB *objdb) :
 		m_devres_ida((1 << NNP_IPC_INF_DEVRES_BITS) - 1),
 		m_copy_ida((1 << NNP_IPC_INF_COPY_BITS) - 1),
 		m_devnet_ida((1 << NNP_IPC_INF_DEVNET_BITS) - 1),
 		m_cmdlist_ida((1 << NNP_IPC_INF_CMDS_BITS) - 1),
-		m_cmdlist_finalized_in_progress(0),
 		m_objdb(objdb),
-		m_user_hdl(0)
+		m_user_hdl(0),
+		m_wait_spin_count(0),
+		m_wait_yield_count(0),
+		m_has_marker_watches(false),
+		m_capturing(false),
+		m_features(0)
 
 	{
 		m_critical_error.value = 0;
 		m_p2p_tr = 0;
 	}
 
-	void *lockWriteBuffer()
-	{
-		uint32_t cont;
-		void *ptr;
-
-		ptr = m_cmd_rb->lockFreeSpace(NNP_PAGE_SIZE, cont);
-
-		return ptr;
-	}
+	void processExecErrorList(union c2h_ExecErrorList *msg);
 
-	void unlockWriteBuffer()
+	void signalCriticalError()
 	{
-		m_cmd_rb->unlockFreeSpace(NNP_PAGE_SIZE);
+		m_error_event.signal();
+		m_marker_event.signal();
+		completeMarkerWatches();
 	}
 
-	void processExecErrorList(union c2h_ExecErrorList *msg);
+	/* a marker watch either posts to cq or calls cb */
+	struct MarkerWatch {
+		SyncPoint                sp;
+		nnpiCompletionQueue::ptr cq;
+		uint64_t                 user_data;
+		nnpiCompletionCb         cb;
+		void                    *cb_data;
+		bool                     cb_worker;
+	};
+
+	NNPError addMarkerWatch(const MarkerWatch &w);
+	void completeMarkerWatches();
 
 	void failAllScheduledCopyCommands();
 	void completeAllCommandLists();
@@ -302,14 +437,27 @@ private:
 	nnpiIDA m_copy_ida;
 	nnpiIDA m_devnet_ida;
 	nnpiIDA m_cmdlist_ida;
-	uint32_t m_cmdlist_finalized_in_progress;
 	nnpiContextObjDB *m_objdb;
 	SyncPoint m_sync_point;
 	SyncPoint m_last_completed_sync_point;
 	std::set<uint16_t> m_failed_sync_points;
+	nnpiResponsePages m_resp_pages;
 	nnpiExecErrorList m_errorList;
 	std::mutex m_mutex;
 	nnpiInfContext::ptr m_this;  // holds refcount to myself, released by response thread when CONTEXT_DESTROYED command arrived
 	std::atomic<uint16_t> m_p2p_tr;
 	uint64_t m_user_hdl;
+	std::atomic<uint32_t> m_wait_spin_count;
+	std::atomic<uint32_t> m_wait_yield_count;
+	nnpiWaitStats m_wait_stats;
+	nnpiCompletionEvent m_marker_event;
+	nnpiCompletionEvent m_error_event;
+	std::deque<MarkerWatch> m_marker_watches; /* ordered by marker, protected by m_waitq */
+	std::atomic<bool> m_has_marker_watches;
+	nnpiPriorityLock m_exec_ring_lock;
+	std::shared_ptr<nnpiCommandList> m_capture; /* protected by m_capture_mutex */
+	std::thread::id m_capture_thread;           /* protected by m_capture_mutex */
+	std::atomic<bool> m_capturing;
+	std::mutex m_capture_mutex;
+	uint8_t m_features;
 };
@@ -39,6 +39,7 @@ NNPError nnpiInfReq::create(nnpiDevNet::ptr         devnet,
 		      config_data_size;
 
 	if (packet_size >= NNP_PAGE_SIZE ||
+	    packet_size > devnet->context()->chan()->commandRingBuffer(0)->maxPayload() ||
 	    outputs.size() == 0)
 		return NNP_NOT_SUPPORTED;
 
@@ -71,8 +72,7 @@ NNPError nnpiInfReq::create(nnpiDevNet::ptr         devnet,
 	msg.destroy = 0;
 	msg.size = packet_size;
 
-	uint32_t cont;
-	uint32_t *ptr = (uint32_t *)cmd_ring->lockFreeSpace(NNP_PAGE_SIZE, cont);
+	uint32_t *ptr = (uint32_t *)cmd_ring->lockPayload(packet_size);
 	if (!ptr)
 		return NNP_IO_ERROR;
 
@@ -95,12 +95,15 @@ NNPError nnpiInfReq::create(nnpiDevNet::ptr         devnet,
 	if (config_data_size > 0)
 		memcpy_s(ptr16, NNP_PAGE_SIZE-((size_t)ptr16-(size_t)ptr)-3*sizeof(uint32_t), config_data, config_data_size);
 
+	cmd_ring->setPayloadSize(packet_size);
+
 	if (ctx->chan()->write(&msg, sizeof(msg)) != sizeof(msg)) {
 		cmd_ring->unlockFreeSpace(0);
 		return NNP_IO_ERROR;
 	}
 
-	cmd_ring->unlockFreeSpace(NNP_PAGE_SIZE);
+	cmd_ring->unlockPayload(packet_size);
+	ctx->chan()->checkCommandRingBufferGrow(0);
 
 	rc = ctx->wait_create_command(InfContextObjID(INF_OBJ_TYPE_INFREQ, protocol_id, devnet->id()),
 				      reply);
@@ -148,9 +151,19 @@ NNPError nnpiInfReq::destroy()
 NNPError nnpiInfReq::schedule(nnpdrvinfSchedParams *schedParams)
 {
 	h2c_ChanInferenceReqSchedule msg;
-	nnpiInfContext::ptr ctx(m_devnet->context());
+	const nnpiInfContext::ptr &ctx = m_devnet->context();
+
+	if (ctx->capturing()) {
+		NNPError ret;
 
-	if (!ctx->wait_can_schedule())
+		if (ctx->capture([this, schedParams](nnpiArena                                &arena,
+						     std::vector<nnpiInfCommandSchedParams *> &cmds) {
+				cmds.push_back(new (arena) nnpiInfReqSchedParams(shared_from_this(), schedParams));
+			}, ret))
+			return ret;
+	}
+
+	if (!ctx->wait_can_schedule([this] { return m_create_refs == 0; }))
 		return NNP_CONTEXT_BROKEN;
 
 	msg.value[0] = 0;
@@ -173,7 +186,7 @@ NNPError nnpiInfReq::schedule(nnpdrvinfSchedParams *schedParams)
 		msg.schedParamsIsNull = 1;
 	}
 
-	if (ctx->chan()->write(&msg, sizeof(msg)) != sizeof(msg))
+	if (ctx->chan()->write_batched(&msg, sizeof(msg)) != sizeof(msg))
 		return NNP_IO_ERROR;
 
 	return NNP_NO_ERROR;
@@ -10,7 +10,7 @@
 #include "nnpiDevNet.h"
 #include "nnpdrvInference.h"
 
-class nnpiInfReq {
+class nnpiInfReq : public std::enable_shared_from_this<nnpiInfReq> {
 public:
 	typedef std::shared_ptr<nnpiInfReq> ptr;
 
@@ -30,7 +30,30 @@ public:
 	void set_user_hdl(uint64_t user_hdl) { m_user_hdl = user_hdl; }
 	uint64_t user_hdl() const { return m_user_hdl; }
 
-	nnpiDevNet::ptr network() const { return m_devnet; }
+	const nnpiDevNet::ptr &network() const { return m_devnet; }
+	const nnpiDevRes::vec &inputs() const { return m_inputs; }
+	const nnpiDevRes::vec &outputs() const { return m_outputs; }
+
+	/* true if other may replace this request in a created command list */
+	bool same_shape(const nnpiInfReq &other) const
+	{
+		if (other.m_devnet != m_devnet ||
+		    other.m_inputs.size() != m_inputs.size() ||
+		    other.m_outputs.size() != m_outputs.size())
+			return false;
+
+		for (size_t i = 0; i < m_inputs.size(); ++i)
+			if (other.m_inputs[i]->size() != m_inputs[i]->size())
+				return false;
+		for (size_t i = 0; i < m_outputs.size(); ++i)
+			if (other.m_outputs[i]->size() != m_outputs[i]->size())
+				return false;
+
+		return true;
+	}
+
+	/* command lists being created with this request, protected by the context waitq */
+	uint32_t &create_refs() { return m_create_refs; }
 
 	NNPError destroy();
 	NNPError schedule(nnpdrvinfSchedParams *schedParams);
@@ -44,7 +67,8 @@ private:
 		m_id(protocol_id),
 		m_inputs(inputs),
 		m_outputs(outputs),
-		m_user_hdl(0)
+		m_user_hdl(0),
+		m_create_refs(0)
 	{
 	}
 
@@ -54,4 +78,5 @@ private:
 	nnpiDevRes::vec m_inputs;
 	nnpiDevRes::vec m_outputs;
 	uint64_t m_user_hdl;
+	uint32_t m_create_refs;
 };
@@ -19,19 +19,108 @@
 #include "nnpiInfReq.h"
 #include "nnpiml_types.h"
 #include "nnpiCommandList.h"
+#include "nnpiSubmitQueue.h"
+#include "nnpiCommandListTemplate.h"
 #include "nnp_log.h"
 //#include "nnpi_umd_internal.h"
 #include "safe_lib.h"
 //#include "nnpdrvMaintenance.h"
 //#include "nnpiMgmt.h"
 
-static nnpiHandleMap<nnpiInfContext, uint64_t> s_contexts;
-static nnpiHandleMap<nnpiDevRes, uint64_t> s_devres;
-static nnpiHandleMap<nnpiCopyCommand, uint64_t> s_copy;
-static nnpiHandleMap<nnpiDevNet, uint64_t> s_networks;
-static nnpiHandleMap<nnpiInfReq, uint64_t> s_infreqs;
-static nnpiHandleMap<nnpiCommandList, uint64_t> s_cmdlists;
+static nnpiHandleMap<nnpiInfContext, uint64_t> s_contexts(NNPI_HANDLE_TAG_CONTEXT);
+static nnpiHandleMap<nnpiDevRes, uint64_t> s_devres(NNPI_HANDLE_TAG_DEVRES);
+static nnpiHandleMap<nnpiCopyCommand, uint64_t> s_copy(NNPI_HANDLE_TAG_COPY);
+static nnpiHandleMap<nnpiDevNet, uint64_t> s_networks(NNPI_HANDLE_TAG_NETWORK);
+static nnpiHandleMap<nnpiInfReq, uint64_t> s_infreqs(NNPI_HANDLE_TAG_INFREQ);
+static nnpiHandleMap<nnpiCommandList, uint64_t> s_cmdlists(NNPI_HANDLE_TAG_CMDLIST);
+static nnpiHandleMap<nnpiCompletionQueue, uint64_t> s_cqs(NNPI_HANDLE_TAG_CQ);
+static nnpiHandleMap<nnpiSubmitQueue, uint64_t> s_squeues(NNPI_HANDLE_TAG_SQUEUE);
+static nnpiHandleMap<nnpiCommandListTemplate, uint64_t> s_cmdlist_tmpls(NNPI_HANDLE_TAG_CMDLIST_TMPL);
 static bool s_atexit_installed = false;
+static std::mutex s_atexit_mutex;
+
+/*
+ * Pinned handles refer to the object directly and keep one reference
+ * to it for the lifetime of the pin, so pinned calls do no lookup and
+ * no reference counting. In debug builds the live pins are tracked,
+ * so a call on an unpinned handle fails before touching it, and the
+ * public handle is kept to validate that the object was not destroyed.
+ */
+enum nnpiPinnedType {
+	PINNED_COPY = 0,
+	PINNED_CMDLIST,
+	PINNED_INFREQ
+};
+
+struct nnpiPinnedBase {
+	nnpiPinnedBase(nnpiPinnedType t, uint64_t h) : type(t), hdl(h) {}
+	virtual ~nnpiPinnedBase() {}
+
+	const nnpiPinnedType type;
+	const uint64_t       hdl;
+};
+
+#if defined (_DEBUG) || defined(DEBUG)
+static std::set<nnpiPinnedBase *> s_pinned;
+static std::mutex s_pinned_mutex;
+
+static inline void pinned_add(nnpiPinnedBase *p)
+{
+	std::lock_guard<std::mutex> lock(s_pinned_mutex);
+	s_pinned.insert(p);
+}
+
+static inline bool pinned_remove(nnpiPinnedBase *p)
+{
+	std::lock_guard<std::mutex> lock(s_pinned_mutex);
+	return s_pinned.erase(p) != 0;
+}
+
+static inline bool pinned_live(nnpiPinnedBase *p)
+{
+	std::lock_guard<std::mutex> lock(s_pinned_mutex);
+	return s_pinned.count(p) != 0;
+}
+#else
+static inline void pinned_add(nnpiPinnedBase *) {}
+static inline bool pinned_remove(nnpiPinnedBase *) { return true; }
+static inline bool pinned_live(nnpiPinnedBase *) { return true; }
+#endif
+
+template <class T, nnpiPinnedType TYPE>
+struct nnpiPinned : public nnpiPinnedBase {
+	nnpiPinned(uint64_t h, const std::shared_ptr<T> &o) :
+		nnpiPinnedBase(TYPE, h),
+		obj(o)
+	{
+	}
+
+	static inline T *get(NNPPinnedHandle pinned)
+	{
+		nnpiPinnedBase *p = (nnpiPinnedBase *)(uintptr_t)pinned;
+
+		if (!p || !pinned_live(p) || p->type != TYPE)
+			return nullptr;
+
+		return static_cast<nnpiPinned *>(p)->obj.get();
+	}
+
+	const std::shared_ptr<T> obj;
+};
+
+typedef nnpiPinned<nnpiCopyCommand, PINNED_COPY> nnpiPinnedCopy;
+typedef nnpiPinned<nnpiCommandList, PINNED_CMDLIST> nnpiPinnedCmdList;
+typedef nnpiPinned<nnpiInfReq, PINNED_INFREQ> nnpiPinnedInfReq;
+
+#if defined (_DEBUG) || defined(DEBUG)
+#define NNPI_VALIDATE_PINNED(pinned, map, obj, err) \
+	do { \
+		if (map.find(((nnpiPinnedBase *)(uintptr_t)(pinned))->hdl).get() != (obj)) \
+			return (err); \
+	} while (0)
+#else
+#define NNPI_VALIDATE_PINNED(pinned, map, obj, err)
+#endif
 
 static void nnpdrvFin_no_wait(void)
 {
@@ -204,25 +293,46 @@ NNPError nnpdrvQueryDeviceStatus(uint32_t deviceNum, NNPDeviceStatus *outDevStat
 void nnpdrvAtExit()
 {
 	nnpdrvFin_no_wait();
+	nnpiChannel::joinDeferredKills();
 
 	nnpiDevice::clear_devices(false);
+	nnpiResponseReactor::stop();
+	nnpiCallbackPool::stop();
 }
 
 NNPError nnpdrvCreateInferContextWithFlags(uint32_t         deviceNum,
 					   uint8_t          flags,
 					   NNPInferContext *outContext)
+{
+	NNPInferContextOptions options;
+
+	memset(&options, 0, sizeof(options));
+	options.flags = flags;
+
+	return nnpdrvCreateInferContextWithOptions(deviceNum, &options, outContext);
+}
+
+NNPError nnpdrvCreateInferContextWithOptions(uint32_t                      deviceNum,
+					     const NNPInferContextOptions *options,
+					     NNPInferContext              *outContext)
 {
 	nnpiInfContext::ptr ctx;
 	NNPError ret;
 
-	if (!outContext)
+	if (!outContext || !options)
 		return NNP_INVALID_ARGUMENT;
 
 	ret = nnpiInfContext::create(deviceNum,
-				     flags,
+				     *options,
 				     ctx);
 	if (ret == NNP_NO_ERROR) {
-		*outContext = s_contexts.makeHandle(ctx);
+		NNPInferContext hdl = s_contexts.makeHandle(ctx);
+		if (!hdl) {
+			ctx->destroy();
+			return NNP_OUT_OF_MEMORY;
+		}
+
+		*outContext = hdl;
 		ctx->set_user_hdl(*outContext);
 		ctx->send_user_handle(INF_OBJ_TYPE_CONTEXT, 0, 0, *outContext);
 
@@ -230,7 +340,7 @@ NNPError nnpdrvCreateInferContextWithFlags(uint32_t         deviceNum,
 		// Install nnpdrvAtExit as atexit handler, if not yet installed
 		//
 		if (!s_atexit_installed) {
-			std::lock_guard<std::mutex> lock(s_contexts.mutex());
+			std::lock_guard<std::mutex> lock(s_atexit_mutex);
 			if (!s_atexit_installed) {
 				atexit(nnpdrvAtExit);
 				s_atexit_installed = true;
@@ -287,6 +397,269 @@ NNPError nnpdrvQueryInferContextInfo(NNPInferContext 	  ctx,
 	return NNP_NO_ERROR;
 }
 
+NNPError nnpdrvQueryInferContextRingInfo(NNPInferContext          ctx,
+					 NNPInferContextRingInfo *outInfo)
+{
+	nnpiInfContext::ptr c = s_contexts.find(ctx);
+	if (!c.get())
+		return NNP_NO_SUCH_CONTEXT;
+
+	if (!outInfo)
+		return NNP_INVALID_ARGUMENT;
+
+	c->queryRingInfo(outInfo);
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpdrvQueryInferContextIdUsage(NNPInferContext         ctx,
+					NNPInferContextIdUsage *outUsage)
+{
+	nnpiInfContext::ptr c = s_contexts.find(ctx);
+	if (!c.get())
+		return NNP_NO_SUCH_CONTEXT;
+
+	if (!outUsage)
+		return NNP_INVALID_ARGUMENT;
+
+	c->queryIdUsage(outUsage);
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpdrvQueryDeviceNetworkIdUsage(NNPDeviceNetwork  net,
+					 NNPIdUsage       *outUsage)
+{
+	nnpiDevNet::ptr devnet = s_networks.find(net);
+	if (!devnet.get())
+		return NNP_NO_SUCH_NETWORK;
+
+	if (!outUsage)
+		return NNP_INVALID_ARGUMENT;
+
+	devnet->queryIdUsage(outUsage);
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpdrvCreateCompletionQueue(NNPCompletionQueue *outCq)
+{
+	nnpiCompletionQueue::ptr cq;
+
+	if (!outCq)
+		return NNP_INVALID_ARGUMENT;
+
+	cq = nnpiCompletionQueue::create();
+	if (!cq.get())
+		return NNP_OUT_OF_MEMORY;
+
+	NNPCompletionQueue hdl = s_cqs.makeHandle(cq);
+	if (!hdl) {
+		cq->destroy();
+		return NNP_OUT_OF_MEMORY;
+	}
+
+	*outCq = hdl;
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpdrvDestroyCompletionQueue(NNPCompletionQueue cq)
+{
+	nnpiCompletionQueue::ptr q = s_cqs.find(cq);
+	if (!q.get())
+		return NNP_NO_SUCH_COMPLETION_QUEUE;
+
+	s_cqs.remove(cq);
+	q->destroy();
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpdrvCommandListSetCompletionQueue(NNPCommandList     commandList,
+					     NNPCompletionQueue cq,
+					     uint64_t           userData)
+{
+	nnpiCompletionQueue::ptr q;
+
+	nnpiCommandList::ptr cmdlist = s_cmdlists.find(commandList);
+	if (!cmdlist.get())
+		return NNP_NO_SUCH_CMDLIST;
+
+	if (cq != 0) {
+		q = s_cqs.find(cq);
+		if (!q.get())
+			return NNP_NO_SUCH_COMPLETION_QUEUE;
+	}
+
+	cmdlist->completionEvent().setQueue(q, NNP_COMPLETION_ENTRY_COMMAND_LIST, userData);
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpdrvCopySetCompletionQueue(NNPCopyHandle      copyHandle,
+				      NNPCompletionQueue cq,
+				      uint64_t           userData)
+{
+	nnpiCompletionQueue::ptr q;
+
+	nnpiCopyCommand::ptr copy = s_copy.find(copyHandle);
+	if (!copy.get())
+		return NNP_NO_SUCH_COPY_HANDLE;
+
+	if (cq != 0) {
+		q = s_cqs.find(cq);
+		if (!q.get())
+			return NNP_NO_SUCH_COMPLETION_QUEUE;
+	}
+
+	copy->completionEvent().setQueue(q, NNP_COMPLETION_ENTRY_COPY, userData);
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpdrvCompletionQueueAddMarker(NNPCompletionQueue cq,
+					NNPInferContext    ctx,
+					NNPMarker          marker,
+					uint64_t           userData)
+{
+	nnpiCompletionQueue::ptr q = s_cqs.find(cq);
+	if (!q.get())
+		return NNP_NO_SUCH_COMPLETION_QUEUE;
+
+	nnpiInfContext::ptr c = s_contexts.find(ctx);
+	if (!c.get())
+		return NNP_NO_SUCH_CONTEXT;
+
+	return c->addMarkerWatch((uint32_t)marker, q, userData);
+}
+
+NNPError nnpdrvCompletionQueueWait(NNPCompletionQueue  cq,
+				   NNPCompletionEntry *entries,
+				   uint32_t            maxEntries,
+				   uint32_t            minEntries,
+				   uint32_t            timeoutUs,
+				   uint32_t           *outNumEntries)
+{
+	uint32_t n;
+
+	nnpiCompletionQueue::ptr q = s_cqs.find(cq);
+	if (!q.get())
+		return NNP_NO_SUCH_COMPLETION_QUEUE;
+
+	if (!entries || !outNumEntries || maxEntries == 0 || minEntries > maxEntries)
+		return NNP_INVALID_ARGUMENT;
+
+	if (nnpiChannel::flushThreadBatch() != 0)
+		return NNP_IO_ERROR;
+
+	n = q->wait(entries, maxEntries, minEntries, timeoutUs);
+
+	*outNumEntries = n;
+
+	if (q->destroyed())
+		return NNP_NO_SUCH_COMPLETION_QUEUE;
+
+	return (n >= minEntries ? NNP_NO_ERROR : NNP_TIMED_OUT);
+}
+
+NNPError nnpdrvCreateSubmitQueue(NNPInferContext  ctx,
+				 uint8_t          priority,
+				 NNPSubmitQueue  *outQueue)
+{
+	nnpiSubmitQueue::ptr q;
+	NNPError ret;
+
+	nnpiInfContext::ptr c = s_contexts.find(ctx);
+	if (!c.get())
+		return NNP_NO_SUCH_CONTEXT;
+
+	if (!outQueue)
+		return NNP_INVALID_ARGUMENT;
+
+	ret = nnpiSubmitQueue::create(c, priority, q);
+	if (ret != NNP_NO_ERROR)
+		return ret;
+
+	NNPSubmitQueue hdl = s_squeues.makeHandle(q);
+	if (!hdl)
+		return NNP_OUT_OF_MEMORY;
+
+	*outQueue = hdl;
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpdrvDestroySubmitQueue(NNPSubmitQueue queue)
+{
+	nnpiSubmitQueue::ptr q = s_squeues.find(queue);
+	if (!q.get())
+		return NNP_NO_SUCH_SUBMIT_QUEUE;
+
+	s_squeues.remove(queue);
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpdrvSubmitQueueScheduleCopy(NNPSubmitQueue queue,
+				       NNPCopyHandle  copyHandle,
+				       uint64_t       byteSize)
+{
+	nnpiSubmitQueue::ptr q = s_squeues.find(queue);
+	if (!q.get())
+		return NNP_NO_SUCH_SUBMIT_QUEUE;
+
+	nnpiCopyCommand::ptr copy = s_copy.find(copyHandle);
+	if (!copy.get())
+		return NNP_NO_SUCH_COPY_HANDLE;
+
+	return q->scheduleCopy(copy, byteSize);
+}
+
+NNPError nnpdrvSubmitQueueScheduleInferReq(NNPSubmitQueue              queue,
+					   NNPInferRequest             infReq,
+					   const nnpdrvinfSchedParams *schedParams)
+{
+	nnpiSubmitQueue::ptr q = s_squeues.find(queue);
+	if (!q.get())
+		return NNP_NO_SUCH_SUBMIT_QUEUE;
+
+	nnpiInfReq::ptr infreq = s_infreqs.find(infReq);
+	if (!infreq.get())
+		return NNP_NO_SUCH_INFREQ_HANDLE;
+
+	return q->scheduleInferReq(infreq, schedParams);
+}
+
+NNPError nnpdrvSubmitQueueScheduleCommandList(NNPSubmitQueue queue,
+					      NNPCommandList commandList)
+{
+	nnpiSubmitQueue::ptr q = s_squeues.find(queue);
+	if (!q.get())
+		return NNP_NO_SUCH_SUBMIT_QUEUE;
+
+	nnpiCommandList::ptr cmdlist = s_cmdlists.find(commandList);
+	if (!cmdlist.get())
+		return NNP_NO_SUCH_CMDLIST;
+
+	return q->scheduleCommandList(cmdlist);
+}
+
+NNPError nnpdrvQuerySubmitQueueStats(NNPSubmitQueue       queue,
+				     NNPSubmitQueueStats *outStats)
+{
+	nnpiSubmitQueue::ptr q = s_squeues.find(queue);
+	if (!q.get())
+		return NNP_NO_SUCH_SUBMIT_QUEUE;
+
+	if (!outStats)
+		return NNP_INVALID_ARGUMENT;
+
+	q->queryStats(outStats);
+
+	return NNP_NO_ERROR;
+}
+
 NNPError nnpdrvInferContextTraceUserData(NNPInferContext ctx,
 					 const char     *key,
 					 uint64_t        user_data)
@@ -330,7 +703,11 @@ NNPError nnpdrvCreateHostResource(uint64_t         byteSize,
 		}
 	}
 
-	*outHostRes = nnpiHostRes::handle_map.makeHandle(hostres);
+	NNPHostResource hdl = nnpiHostRes::handle_map.makeHandle(hostres);
+	if (!hdl)
+		return NNP_OUT_OF_MEMORY;
+
+	*outHostRes = hdl;
 	hostres->set_user_hdl(*outHostRes);
 	return NNP_NO_ERROR;
 }
@@ -374,7 +751,11 @@ NNPError nnpdrvCreateHostResourceFromBuf(const void      *buf,
 		}
 	}
 
-	*outHostRes = nnpiHostRes::handle_map.makeHandle(hostres);
+	NNPHostResource hdl = nnpiHostRes::handle_map.makeHandle(hostres);
+	if (!hdl)
+		return NNP_OUT_OF_MEMORY;
+
+	*outHostRes = hdl;
 	hostres->set_user_hdl(*outHostRes);
 	return NNP_NO_ERROR;
 }
@@ -431,6 +812,44 @@ NNPError nnpdrvUnlockHostResource(NNPHostResource hostRes)
 	return hostres->unlock_cpu_access();
 }
 
+NNPError nnpdrvHostResourceGetEventFd(NNPHostResource hostRes,
+				      int            *outFd)
+{
+	nnpiHostRes::ptr hostres = nnpiHostRes::handle_map.find(hostRes);
+	if (!hostres.get())
+		return NNP_NO_SUCH_RESOURCE;
+
+	if (!outFd)
+		return NNP_INVALID_ARGUMENT;
+
+	if (hostres->usageFlags() & NNP_RESOURECE_USAGE_LOCKLESS)
+		return NNP_NOT_SUPPORTED;
+
+	*outFd = hostres->completionEvent().fd();
+	if (*outFd < 0)
+		return NNP_IO_ERROR;
+
+	return NNP_NO_ERROR;
+}
+
+static void fill_wait_stats(const nnpiWaitStats &stats, NNPWaitStats *out_stats)
+{
+	out_stats->spinResolved = stats.get(nnpiWaitStats::SPIN);
+	out_stats->yieldResolved = stats.get(nnpiWaitStats::YIELD);
+	out_stats->blockResolved = stats.get(nnpiWaitStats::BLOCK);
+	out_stats->timedOut = stats.get(nnpiWaitStats::TIMEOUT);
+}
+
+NNPError nnpdrvQueryHostResourceWaitStats(NNPWaitStats *outStats)
+{
+	if (!outStats)
+		return NNP_INVALID_ARGUMENT;
+
+	fill_wait_stats(nnpiHostRes::cpu_wait_stats, outStats);
+
+	return NNP_NO_ERROR;
+}
+
 NNPError nnpdrvCreateDeviceResourceFIFO(NNPInferContext    ctx,
 					uint64_t           elemByteSize,
 					uint32_t           depth,
@@ -460,7 +879,13 @@ NNPError nnpdrvCreateDeviceResourceFIFO(NNPInferContext    ctx,
 	if (ret != NNP_NO_ERROR)
 		return ret;
 
-	*outDevRes = s_devres.makeHandle(devres);
+	NNPDeviceResource hdl = s_devres.makeHandle(devres);
+	if (!hdl) {
+		devres->destroy();
+		return NNP_OUT_OF_MEMORY;
+	}
+
+	*outDevRes = hdl;
 	devres->set_user_hdl(*outDevRes);
 	devres->m_ctx->send_user_handle(INF_OBJ_TYPE_DEVRES, devres->id(), 0, *outDevRes);
 
@@ -538,7 +963,13 @@ static NNPError createCopyCommand(NNPInferContext ctx,
 				      is_c2h,
 				      copy);
 	if (ret == NNP_NO_ERROR) {
-		*outHandle = s_copy.makeHandle(copy);
+		NNPCopyHandle hdl = s_copy.makeHandle(copy);
+		if (!hdl) {
+			copy->destroy();
+			return NNP_OUT_OF_MEMORY;
+		}
+
+		*outHandle = hdl;
 		copy->set_user_hdl(*outHandle);
 		copy->context()->send_user_handle(INF_OBJ_TYPE_COPY, copy->id(), COPY_USER_HANDLE_TYPE_COPY, *outHandle);
 	}
@@ -576,7 +1007,13 @@ static NNPError createDeviceToDeviceCopyCommand(NNPInferContext ctx,
 					  src_devres,
 					  copy);
 	if (ret == NNP_NO_ERROR) {
-		*outHandle = s_copy.makeHandle(copy);
+		NNPCopyHandle hdl = s_copy.makeHandle(copy);
+		if (!hdl) {
+			copy->destroy();
+			return NNP_OUT_OF_MEMORY;
+		}
+
+		*outHandle = hdl;
 		copy->set_user_hdl(*outHandle);
 		copy->context()->send_user_handle(INF_OBJ_TYPE_COPY, copy->id(), COPY_USER_HANDLE_TYPE_COPY, *outHandle);
 	}
@@ -991,7 +1428,13 @@ NNPError nnpdrvCreateDeviceNetworkWithResources(NNPInferContext    ctx,
 				 netConfigDataSize,
 				 devnet);
 	if (ret == NNP_NO_ERROR) {
-		*outNetHandle = s_networks.makeHandle(devnet);
+		NNPDeviceNetwork hdl = s_networks.makeHandle(devnet);
+		if (!hdl) {
+			devnet->destroy();
+			return NNP_OUT_OF_MEMORY;
+		}
+
+		*outNetHandle = hdl;
 		devnet->set_user_hdl(*outNetHandle);
 		devnet->context()->send_user_handle(INF_OBJ_TYPE_DEVNET, devnet->id(), 0, *outNetHandle);
 	}
@@ -1129,7 +1572,13 @@ NNPError nnpdrvCreateInferRequest(NNPDeviceNetwork   devNet,
 				 infreq);
 
 	if (ret == NNP_NO_ERROR) {
-		*outHandle = s_infreqs.makeHandle(infreq);
+		NNPInferRequest hdl = s_infreqs.makeHandle(infreq);
+		if (!hdl) {
+			infreq->destroy();
+			return NNP_OUT_OF_MEMORY;
+		}
+
+		*outHandle = hdl;
 		infreq->set_user_hdl(*outHandle);
 		devnet->context()->send_user_handle(INF_OBJ_TYPE_INFREQ, devnet->id(), infreq->id(), *outHandle);
 	}
@@ -1172,43 +1621,184 @@ NNPError nnpdrvScheduleCopy(NNPCopyHandle copyHandle, uint64_t byteSize, uint8_t
 	return copy->schedule(byteSize, priority);
 }
 
-NNPError nnpdrvGetMarker(NNPInferContext  ctx,
-			 NNPMarker       *outMarker)
+NNPError nnpdrvPinCopy(NNPCopyHandle    copyHandle,
+		       NNPPinnedHandle *outPinned)
 {
-	nnpiInfContext::ptr c = s_contexts.find(ctx);
-	if (!c.get())
-		return NNP_NO_SUCH_CONTEXT;
+	nnpiPinnedCopy *p;
 
-	if (c->broken() && !c->aborted())
-		return NNP_CONTEXT_BROKEN;
+	nnpiCopyCommand::ptr copy = s_copy.find(copyHandle);
+	if (!copy.get())
+		return NNP_NO_SUCH_COPY_HANDLE;
 
-	uint32_t marker;
+	if (!outPinned)
+		return NNP_INVALID_ARGUMENT;
 
-	NNPError ret = c->createMarker(marker);
+	p = new (std::nothrow) nnpiPinnedCopy(copyHandle, copy);
+	if (!p)
+		return NNP_OUT_OF_MEMORY;
 
-	if (ret == NNP_NO_ERROR)
-		*outMarker = (NNPMarker)marker;
+	pinned_add(p);
+	*outPinned = (NNPPinnedHandle)(uintptr_t)p;
 
-	return ret;
+	return NNP_NO_ERROR;
 }
 
-NNPError nnpdrvFinish(NNPInferContext ctx)
+NNPError nnpdrvPinCommandList(NNPCommandList   commandList,
+			      NNPPinnedHandle *outPinned)
 {
-	NNPError ret;
-	NNPMarker marker = 0;
+	nnpiPinnedCmdList *p;
 
-	ret = nnpdrvGetMarker(ctx, &marker);
-	if (ret != NNP_NO_ERROR)
-		return ret;
+	nnpiCommandList::ptr cmdlist = s_cmdlists.find(commandList);
+	if (!cmdlist.get())
+		return NNP_NO_SUCH_CMDLIST;
 
-	ret = nnpdrvWaitForMarker(ctx, marker, UINT32_MAX);
+	if (!outPinned)
+		return NNP_INVALID_ARGUMENT;
 
-	return ret;
+	p = new (std::nothrow) nnpiPinnedCmdList(commandList, cmdlist);
+	if (!p)
+		return NNP_OUT_OF_MEMORY;
+
+	pinned_add(p);
+	*outPinned = (NNPPinnedHandle)(uintptr_t)p;
+
+	return NNP_NO_ERROR;
 }
 
-NNPError nnpdrvWaitForMarker(NNPInferContext ctx,
-			     NNPMarker       marker,
-			     uint32_t        timeoutUs)
+NNPError nnpdrvPinInferRequest(NNPInferRequest  infReq,
+			       NNPPinnedHandle *outPinned)
+{
+	nnpiPinnedInfReq *p;
+
+	nnpiInfReq::ptr infreq = s_infreqs.find(infReq);
+	if (!infreq.get())
+		return NNP_NO_SUCH_INFREQ_HANDLE;
+
+	if (!outPinned)
+		return NNP_INVALID_ARGUMENT;
+
+	p = new (std::nothrow) nnpiPinnedInfReq(infReq, infreq);
+	if (!p)
+		return NNP_OUT_OF_MEMORY;
+
+	pinned_add(p);
+	*outPinned = (NNPPinnedHandle)(uintptr_t)p;
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpdrvUnpinHandle(NNPPinnedHandle pinned)
+{
+	nnpiPinnedBase *p = (nnpiPinnedBase *)(uintptr_t)pinned;
+
+	if (!p || !pinned_remove(p))
+		return NNP_INVALID_ARGUMENT;
+
+	delete p;
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpdrvPinnedScheduleCopy(NNPPinnedHandle pinned,
+				  uint64_t        byteSize,
+				  uint8_t         priority)
+{
+	nnpiCopyCommand *copy = nnpiPinnedCopy::get(pinned);
+	if (!copy)
+		return NNP_INVALID_ARGUMENT;
+
+	NNPI_VALIDATE_PINNED(pinned, s_copy, copy, NNP_NO_SUCH_COPY_HANDLE);
+
+	return copy->schedule(byteSize, priority);
+}
+
+NNPError nnpdrvPinnedScheduleInferReq(NNPPinnedHandle       pinned,
+				      nnpdrvinfSchedParams *schedParams)
+{
+	nnpiInfReq *infreq = nnpiPinnedInfReq::get(pinned);
+	if (!infreq)
+		return NNP_INVALID_ARGUMENT;
+
+	NNPI_VALIDATE_PINNED(pinned, s_infreqs, infreq, NNP_NO_SUCH_INFREQ_HANDLE);
+
+	return infreq->schedule(schedParams);
+}
+
+NNPError nnpdrvCopySetCompletionCallback(NNPCopyHandle         copyHandle,
+					 NNPCompletionCallback callback,
+					 void                 *userData,
+					 uint32_t              flags)
+{
+	nnpiCopyCommand::ptr copy = s_copy.find(copyHandle);
+	if (!copy.get())
+		return NNP_NO_SUCH_COPY_HANDLE;
+
+	copy->completionEvent().setCallback(callback,
+					    userData,
+					    (flags & NNP_COMPLETION_CALLBACK_WORKER) != 0);
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpdrvBeginSubmitBatch(NNPInferContext ctx)
+{
+	nnpiInfContext::ptr c = s_contexts.find(ctx);
+	if (!c.get())
+		return NNP_NO_SUCH_CONTEXT;
+
+	return c->beginSubmitBatch();
+}
+
+NNPError nnpdrvSubmitBatch(NNPInferContext ctx)
+{
+	nnpiInfContext::ptr c = s_contexts.find(ctx);
+	if (!c.get())
+		return NNP_NO_SUCH_CONTEXT;
+
+	return c->submitBatch();
+}
+
+NNPError nnpdrvGetMarker(NNPInferContext  ctx,
+			 NNPMarker       *outMarker)
+{
+	nnpiInfContext::ptr c = s_contexts.find(ctx);
+	if (!c.get())
+		return NNP_NO_SUCH_CONTEXT;
+
+	if (c->broken() && !c->aborted())
+		return NNP_CONTEXT_BROKEN;
+
+	/* a marker cannot be recorded into the capture list */
+	if (c->capturing())
+		return NNP_NOT_SUPPORTED;
+
+	uint32_t marker;
+
+	NNPError ret = c->createMarker(marker);
+
+	if (ret == NNP_NO_ERROR)
+		*outMarker = (NNPMarker)marker;
+
+	return ret;
+}
+
+NNPError nnpdrvFinish(NNPInferContext ctx)
+{
+	NNPError ret;
+	NNPMarker marker = 0;
+
+	ret = nnpdrvGetMarker(ctx, &marker);
+	if (ret != NNP_NO_ERROR)
+		return ret;
+
+	ret = nnpdrvWaitForMarker(ctx, marker, UINT32_MAX);
+
+	return ret;
+}
+
+NNPError nnpdrvWaitForMarker(NNPInferContext ctx,
+			     NNPMarker       marker,
+			     uint32_t        timeoutUs)
 {
 	nnpiInfContext::ptr c = s_contexts.find(ctx);
 	if (!c.get())
@@ -1217,6 +1807,75 @@ NNPError nnpdrvWaitForMarker(NNPInferContext ctx,
 	return c->waitMarker((uint32_t)marker, timeoutUs);
 }
 
+NNPError nnpdrvInferContextNotifyMarker(NNPInferContext       ctx,
+					NNPMarker             marker,
+					NNPCompletionCallback cb,
+					void                 *userData,
+					uint32_t              flags)
+{
+	nnpiInfContext::ptr c = s_contexts.find(ctx);
+	if (!c.get())
+		return NNP_NO_SUCH_CONTEXT;
+
+	if (!cb)
+		return NNP_INVALID_ARGUMENT;
+
+	return c->addMarkerCallback((uint32_t)marker,
+				    cb,
+				    userData,
+				    (flags & NNP_COMPLETION_CALLBACK_WORKER) != 0);
+}
+
+NNPError nnpdrvInferContextSetWaitPolicy(NNPInferContext      ctx,
+					 const NNPWaitPolicy *policy)
+{
+	nnpiWaitPolicy p;
+
+	nnpiInfContext::ptr c = s_contexts.find(ctx);
+	if (!c.get())
+		return NNP_NO_SUCH_CONTEXT;
+
+	if (!policy)
+		return NNP_INVALID_ARGUMENT;
+
+	p.spin_count = policy->spinCount;
+	p.yield_count = policy->yieldCount;
+	c->setWaitPolicy(p);
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpdrvSetThreadWaitPolicy(const NNPWaitPolicy *policy)
+{
+	nnpiWaitPolicy p;
+
+	if (!policy) {
+		nnpiWaitQueue::setThreadWaitPolicy(nullptr);
+		return NNP_NO_ERROR;
+	}
+
+	p.spin_count = policy->spinCount;
+	p.yield_count = policy->yieldCount;
+	nnpiWaitQueue::setThreadWaitPolicy(&p);
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpdrvQueryInferContextWaitStats(NNPInferContext ctx,
+					  NNPWaitStats   *outStats)
+{
+	nnpiInfContext::ptr c = s_contexts.find(ctx);
+	if (!c.get())
+		return NNP_NO_SUCH_CONTEXT;
+
+	if (!outStats)
+		return NNP_INVALID_ARGUMENT;
+
+	fill_wait_stats(c->waitStats(), outStats);
+
+	return NNP_NO_ERROR;
+}
+
 NNPError nnpdrvGetError(NNPInferContext		ctx,
 			NNPCriticalErrorInfo	*outErrorInfo)
 {
@@ -1234,6 +1893,40 @@ NNPError nnpdrvWaitForCriticalError(NNPInferContext ctx,
 	return c->waitCriticalError(outErrorInfo, timeoutUs);
 }
 
+NNPError nnpdrvInferContextGetMarkerEventFd(NNPInferContext ctx,
+					    int            *outFd)
+{
+	nnpiInfContext::ptr c = s_contexts.find(ctx);
+	if (!c.get())
+		return NNP_NO_SUCH_CONTEXT;
+
+	if (!outFd)
+		return NNP_INVALID_ARGUMENT;
+
+	*outFd = c->markerEvent().fd();
+	if (*outFd < 0)
+		return NNP_IO_ERROR;
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpdrvInferContextGetErrorEventFd(NNPInferContext ctx,
+					   int            *outFd)
+{
+	nnpiInfContext::ptr c = s_contexts.find(ctx);
+	if (!c.get())
+		return NNP_NO_SUCH_CONTEXT;
+
+	if (!outFd)
+		return NNP_INVALID_ARGUMENT;
+
+	*outFd = c->errorEvent().fd();
+	if (*outFd < 0)
+		return NNP_IO_ERROR;
+
+	return NNP_NO_ERROR;
+}
+
 NNPError nnpdrvGetCriticalErrorMessage(NNPInferContext ctx,
 				       void          *buf,
 				       uint32_t       buf_size,
@@ -1291,24 +1984,113 @@ NNPError nnpdrvCreateCommandListBegin(NNPInferContext  ctx,
 	if (ret != NNP_NO_ERROR)
 		return ret;
 
-	*outCommandList = s_cmdlists.makeHandle(cmdlist);
+	NNPCommandList hdl = s_cmdlists.makeHandle(cmdlist);
+	if (!hdl) {
+		cmdlist->destroy();
+		return NNP_OUT_OF_MEMORY;
+	}
+
+	*outCommandList = hdl;
 	cmdlist->set_user_hdl(*outCommandList);
 
 	return NNP_NO_ERROR;
 }
 
+static uint32_t cmdlist_opt_flags(void)
+{
+	uint32_t optFlags = nnpiCommandList::BATCH_COPIES;
+
+	if (getenv("NNPI_NO_BATCH_COPIES"))
+		optFlags &= ~(nnpiCommandList::BATCH_COPIES);
+	/* relies on the access sets of the commands, so this is opt-in */
+	if (getenv("NNPI_CMDLIST_REORDER_COPIES"))
+		optFlags |= nnpiCommandList::REORDER_COPIES;
+	/* dropped copies cannot be overwritten, so this is opt-in */
+	if (getenv("NNPI_CMDLIST_DROP_REDUNDANT_COPIES"))
+		optFlags |= nnpiCommandList::DROP_REDUNDANT_COPIES;
+
+	return optFlags;
+}
+
 NNPError nnpdrvCreateCommandListEnd(NNPCommandList commandList)
 {
 	nnpiCommandList::ptr cmdlist = s_cmdlists.find(commandList);
 	if (!cmdlist.get())
 		return NNP_NO_SUCH_CMDLIST;
 
-	uint32_t optFlags = nnpiCommandList::BATCH_COPIES;
+	return cmdlist->finalize(cmdlist_opt_flags());
+}
 
-	if (getenv("NNPI_NO_BATCH_COPIES"))
-		optFlags &= ~(nnpiCommandList::BATCH_COPIES);
+NNPError nnpdrvCreateCommandListEndAsync(NNPCommandList commandList)
+{
+	nnpiCommandList::ptr cmdlist = s_cmdlists.find(commandList);
+	if (!cmdlist.get())
+		return NNP_NO_SUCH_CMDLIST;
 
-	return cmdlist->finalize(optFlags);
+	return cmdlist->finalize_async(cmdlist_opt_flags());
+}
+
+NNPError nnpdrvWaitCommandListCreated(NNPCommandList commandList,
+				      uint32_t       timeoutUs)
+{
+	nnpiCommandList::ptr cmdlist = s_cmdlists.find(commandList);
+	if (!cmdlist.get())
+		return NNP_NO_SUCH_CMDLIST;
+
+	return cmdlist->wait_created(timeoutUs);
+}
+
+NNPError nnpdrvInferContextBeginCapture(NNPInferContext  ctx,
+					NNPCommandList  *outCommandList)
+{
+	nnpiCommandList::ptr cmdlist;
+
+	nnpiInfContext::ptr c = s_contexts.find(ctx);
+	if (!c.get())
+		return NNP_NO_SUCH_CONTEXT;
+
+	if (!outCommandList)
+		return NNP_INVALID_ARGUMENT;
+
+	NNPError ret = nnpiCommandList::create(c, cmdlist);
+	if (ret != NNP_NO_ERROR)
+		return ret;
+
+	NNPCommandList hdl = s_cmdlists.makeHandle(cmdlist);
+	if (!hdl) {
+		cmdlist->destroy();
+		return NNP_OUT_OF_MEMORY;
+	}
+
+	cmdlist->set_user_hdl(hdl);
+
+	ret = c->beginCapture(cmdlist);
+	if (ret != NNP_NO_ERROR) {
+		cmdlist->destroy();
+		s_cmdlists.remove(hdl);
+		return ret;
+	}
+
+	*outCommandList = hdl;
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpdrvInferContextEndCapture(NNPInferContext  ctx,
+				      NNPCommandList  *outCommandList)
+{
+	nnpiInfContext::ptr c = s_contexts.find(ctx);
+	if (!c.get())
+		return NNP_NO_SUCH_CONTEXT;
+
+	nnpiCommandList::ptr cmdlist = c->endCapture();
+	if (!cmdlist.get())
+		return NNP_INVALID_ARGUMENT;
+
+	if (outCommandList)
+		*outCommandList = cmdlist->user_hdl();
+
+	return cmdlist->finalize(cmdlist_opt_flags());
 }
 
 NNPError nnpdrvDestroyCommandList(NNPCommandList commandList)
@@ -1324,6 +2106,140 @@ NNPError nnpdrvDestroyCommandList(NNPCommandList commandList)
 	return ret;
 }
 
+NNPError nnpdrvCreateCommandListTemplate(NNPCommandList          commandList,
+					 NNPCommandListTemplate *outTemplate)
+{
+	nnpiCommandListTemplate::ptr tmpl;
+	NNPError ret;
+
+	nnpiCommandList::ptr cmdlist = s_cmdlists.find(commandList);
+	if (!cmdlist.get())
+		return NNP_NO_SUCH_CMDLIST;
+
+	if (!outTemplate)
+		return NNP_INVALID_ARGUMENT;
+
+	ret = nnpiCommandListTemplate::create(cmdlist, tmpl);
+	if (ret != NNP_NO_ERROR)
+		return ret;
+
+	NNPCommandListTemplate hdl = s_cmdlist_tmpls.makeHandle(tmpl);
+	if (!hdl)
+		return NNP_OUT_OF_MEMORY;
+
+	*outTemplate = hdl;
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpdrvQueryCommandListTemplate(NNPCommandListTemplate tmpl,
+					uint32_t              *outNumCommands)
+{
+	nnpiCommandListTemplate::ptr t = s_cmdlist_tmpls.find(tmpl);
+	if (!t.get())
+		return NNP_NO_SUCH_CMDLIST_TEMPLATE;
+
+	if (!outNumCommands)
+		return NNP_INVALID_ARGUMENT;
+
+	*outNumCommands = t->numCommands();
+
+	return NNP_NO_ERROR;
+}
+
+static NNPError resolve_template_subst(const nnpiCommandListTemplate::ptr &t,
+				       const uint64_t                     *handles,
+				       nnpiCommandListTemplate::Subst     *out_subst)
+{
+	for (uint32_t i = 0; i < t->numCommands(); ++i) {
+		nnpiCommandListTemplate::Subst &s = out_subst[i];
+
+		s.copy.reset();
+		s.infreq.reset();
+		if (handles[i] == 0)
+			continue;
+
+		if (t->commandType(i) == CMDLIST_CMD_COPY) {
+			s.copy = s_copy.find(handles[i]);
+			if (!s.copy.get())
+				return NNP_NO_SUCH_COPY_HANDLE;
+			if (s.copy->context() != t->context())
+				return NNP_INVALID_ARGUMENT;
+		} else {
+			s.infreq = s_infreqs.find(handles[i]);
+			if (!s.infreq.get())
+				return NNP_NO_SUCH_INFREQ_HANDLE;
+			if (s.infreq->network()->context() != t->context())
+				return NNP_INVALID_ARGUMENT;
+		}
+	}
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpdrvInstantiateCommandListTemplate(NNPCommandListTemplate tmpl,
+					      uint32_t               numLists,
+					      const uint64_t        *substHandles,
+					      NNPCommandList        *outCommandLists)
+{
+	std::vector<nnpiCommandListTemplate::Subst> subst;
+	std::vector<nnpiCommandList::ptr> cmdlists;
+	NNPError ret = NNP_NO_ERROR;
+
+	nnpiCommandListTemplate::ptr t = s_cmdlist_tmpls.find(tmpl);
+	if (!t.get())
+		return NNP_NO_SUCH_CMDLIST_TEMPLATE;
+
+	if (numLists == 0 || !outCommandLists)
+		return NNP_INVALID_ARGUMENT;
+
+	if (substHandles)
+		subst.resize(t->numCommands());
+	cmdlists.reserve(numLists);
+
+	for (uint32_t i = 0; i < numLists && ret == NNP_NO_ERROR; ++i) {
+		nnpiCommandList::ptr cmdlist;
+
+		if (substHandles)
+			ret = resolve_template_subst(t,
+						     substHandles + (size_t)i * t->numCommands(),
+						     &subst[0]);
+		if (ret == NNP_NO_ERROR)
+			ret = t->instantiate(substHandles ? &subst[0] : NULL, cmdlist);
+		if (ret == NNP_NO_ERROR) {
+			outCommandLists[i] = s_cmdlists.makeHandle(cmdlist);
+			if (!outCommandLists[i]) {
+				cmdlist->destroy();
+				ret = NNP_OUT_OF_MEMORY;
+				break;
+			}
+			cmdlist->set_user_hdl(outCommandLists[i]);
+			cmdlists.push_back(cmdlist);
+		}
+	}
+
+	if (ret == NNP_NO_ERROR)
+		ret = nnpiCommandList::finalize_all(cmdlists, cmdlist_opt_flags());
+
+	if (ret != NNP_NO_ERROR) {
+		for (uint32_t i = 0; i < cmdlists.size(); ++i) {
+			cmdlists[i]->destroy();
+			s_cmdlists.remove(outCommandLists[i]);
+			outCommandLists[i] = 0;
+		}
+	}
+
+	return ret;
+}
+
+NNPError nnpdrvDestroyCommandListTemplate(NNPCommandListTemplate tmpl)
+{
+	if (!s_cmdlist_tmpls.remove(tmpl))
+		return NNP_NO_SUCH_CMDLIST_TEMPLATE;
+
+	return NNP_NO_ERROR;
+}
+
 NNPError nnpdrvCommandListAppendCopy(NNPCommandList        commandList,
 				     NNPCopyHandle         copyHandle,
 				     uint64_t              byteSize,
@@ -1342,11 +2258,16 @@ NNPError nnpdrvCommandListAppendCopy(NNPCommandList        commandList,
 		byteSize = UINT64_MAX;
 	if ((flags & NNP_SCHEDULE_SKIP_EXECUTION) != 0)
 		byteSize = 0;
-	nnpiInfCopyCommandSchedParams *copy_params = new nnpiInfCopyCommandSchedParams(copy,
-										       priority,
-										       byteSize);
+	nnpiInfCopyCommandSchedParams *copy_params =
+		new (cmdlist->cmd_arena()) nnpiInfCopyCommandSchedParams(copy,
+									 priority,
+									 byteSize);
+
+	NNPError ret = cmdlist->append(copy_params);
+	if (ret != NNP_NO_ERROR)
+		delete copy_params;
 
-	return cmdlist->append(copy_params);
+	return ret;
 }
 
 NNPError nnpdrvCommandListAppendInferRequest(NNPCommandList        commandList,
@@ -1361,10 +2282,15 @@ NNPError nnpdrvCommandListAppendInferRequest(NNPCommandList        commandList,
 	if (!infreq.get())
 		return NNP_NO_SUCH_INFREQ_HANDLE;
 
-	nnpiInfReqSchedParams *inf_params = new nnpiInfReqSchedParams(infreq,
-								      schedParams);
+	nnpiInfReqSchedParams *inf_params =
+		new (cmdlist->cmd_arena()) nnpiInfReqSchedParams(infreq,
+								 schedParams);
+
+	NNPError ret = cmdlist->append(inf_params);
+	if (ret != NNP_NO_ERROR)
+		delete inf_params;
 
-	return cmdlist->append(inf_params);
+	return ret;
 }
 
 NNPError nnpdrvCommandListOverwriteCopy(NNPCommandList        commandList,
@@ -1373,49 +2299,84 @@ NNPError nnpdrvCommandListOverwriteCopy(NNPCommandList        commandList,
 					uint8_t               priority,
 					uint32_t              flags)
 {
+	NNPCommandListEdit edit;
+
 	nnpiCommandList::ptr cmdlist = s_cmdlists.find(commandList);
 	if (!cmdlist.get())
 		return NNP_NO_SUCH_CMDLIST;
 
-	nnpiInfCommandSchedParams *command = cmdlist->get_cmd_for_overwrite(copy_idx);
-	if (command == NULL)
-		return NNP_INVALID_ARGUMENT;
-
-	if (command->type() != CMDLIST_CMD_COPY)
-		return NNP_NO_SUCH_COPY_HANDLE;
-
-	nnpiInfCopyCommandSchedParams *copy_params =
-		dynamic_cast<nnpiInfCopyCommandSchedParams *> (command);
-
-	if (byteSize == 0)
-		byteSize = UINT64_MAX;
-	if ((flags & NNP_SCHEDULE_SKIP_EXECUTION) != 0)
-		byteSize = 0;
-	copy_params->overwrite(priority, byteSize);
+	memset(&edit, 0, sizeof(edit));
+	edit.index = copy_idx;
+	edit.priority = priority;
+	edit.flags = flags;
+	edit.byteSize = byteSize;
 
-	return NNP_NO_ERROR;
+	return cmdlist->overwrite(&edit, 1);
 }
 
 NNPError nnpdrvCommandListOverwriteInferRequest(NNPCommandList        commandList,
 						uint16_t              infreq_idx,
 						nnpdrvinfSchedParams *schedParams)
+{
+	NNPCommandListEdit edit;
+
+	nnpiCommandList::ptr cmdlist = s_cmdlists.find(commandList);
+	if (!cmdlist.get())
+		return NNP_NO_SUCH_CMDLIST;
+
+	memset(&edit, 0, sizeof(edit));
+	edit.index = infreq_idx;
+	edit.isInferReq = 1;
+	edit.schedParams = schedParams;
+
+	return cmdlist->overwrite(&edit, 1);
+}
+
+NNPError nnpdrvCommandListOverwrite(NNPCommandList            commandList,
+				    uint32_t                  numEdits,
+				    const NNPCommandListEdit *edits)
 {
 	nnpiCommandList::ptr cmdlist = s_cmdlists.find(commandList);
 	if (!cmdlist.get())
 		return NNP_NO_SUCH_CMDLIST;
 
-	nnpiInfCommandSchedParams *command = cmdlist->get_cmd_for_overwrite(infreq_idx);
-	if (command == NULL)
+	if (!edits && numEdits > 0)
 		return NNP_INVALID_ARGUMENT;
 
-	if (command->type() != CMDLIST_CMD_INFREQ)
-		return NNP_NO_SUCH_INFREQ_HANDLE;
+	return cmdlist->overwrite(edits, numEdits);
+}
 
-	nnpiInfReqSchedParams *infreq_params =
-		dynamic_cast<nnpiInfReqSchedParams *> (command);
-	infreq_params->overwrite(schedParams);
+NNPError nnpdrvCommandListRebind(NNPCommandList               commandList,
+				 uint32_t                     numBindings,
+				 const NNPCommandListBinding *bindings)
+{
+	std::vector<nnpiCommandList::Binding> b(numBindings);
+	CmdListCommandType type;
 
-	return NNP_NO_ERROR;
+	nnpiCommandList::ptr cmdlist = s_cmdlists.find(commandList);
+	if (!cmdlist.get())
+		return NNP_NO_SUCH_CMDLIST;
+
+	if (!bindings && numBindings > 0)
+		return NNP_INVALID_ARGUMENT;
+
+	for (uint32_t i = 0; i < numBindings; ++i) {
+		if (!cmdlist->command_type(bindings[i].index, type))
+			return NNP_INVALID_ARGUMENT;
+
+		b[i].index = bindings[i].index;
+		if (type == CMDLIST_CMD_COPY) {
+			b[i].copy = s_copy.find(bindings[i].handle);
+			if (!b[i].copy.get())
+				return NNP_NO_SUCH_COPY_HANDLE;
+		} else {
+			b[i].infreq = s_infreqs.find(bindings[i].handle);
+			if (!b[i].infreq.get())
+				return NNP_NO_SUCH_INFREQ_HANDLE;
+		}
+	}
+
+	return cmdlist->rebind(b);
 }
 
 NNPError nnpdrvScheduleCommandList(NNPCommandList commandList)
@@ -1427,6 +2388,17 @@ NNPError nnpdrvScheduleCommandList(NNPCommandList commandList)
 	return cmdlist->schedule();
 }
 
+NNPError nnpdrvPinnedScheduleCommandList(NNPPinnedHandle pinned)
+{
+	nnpiCommandList *cmdlist = nnpiPinnedCmdList::get(pinned);
+	if (!cmdlist)
+		return NNP_INVALID_ARGUMENT;
+
+	NNPI_VALIDATE_PINNED(pinned, s_cmdlists, cmdlist, NNP_NO_SUCH_CMDLIST);
+
+	return cmdlist->schedule();
+}
+
 NNPError nnpdrvWaitCommandList(NNPCommandList commandList,
 			       uint32_t timeoutUs,
 			       NNPCriticalErrorInfo *errors,
@@ -1441,6 +2413,55 @@ NNPError nnpdrvWaitCommandList(NNPCommandList commandList,
 			     numErrors);
 }
 
+NNPError nnpdrvCommandListSetInstanceDepth(NNPCommandList commandList,
+					   uint32_t       depth)
+{
+	nnpiCommandList::ptr cmdlist = s_cmdlists.find(commandList);
+	if (!cmdlist.get())
+		return NNP_NO_SUCH_CMDLIST;
+
+	return cmdlist->set_depth(depth);
+}
+
+NNPError nnpdrvScheduleCommandListInstance(NNPCommandList commandList,
+					   uint64_t      *outInstance)
+{
+	nnpiCommandList::ptr cmdlist = s_cmdlists.find(commandList);
+	if (!cmdlist.get())
+		return NNP_NO_SUCH_CMDLIST;
+
+	return cmdlist->schedule(0, nullptr, outInstance);
+}
+
+NNPError nnpdrvWaitCommandListInstance(NNPCommandList        commandList,
+				       uint64_t              instance,
+				       uint32_t              timeoutUs,
+				       NNPCriticalErrorInfo *errors,
+				       uint32_t             *numErrors)
+{
+	nnpiCommandList::ptr cmdlist = s_cmdlists.find(commandList);
+	if (!cmdlist.get())
+		return NNP_NO_SUCH_CMDLIST;
+
+	return cmdlist->wait(timeoutUs,
+			     errors,
+			     numErrors,
+			     instance);
+}
+
+NNPError nnpdrvQueryCommandListInstances(NNPCommandList commandList,
+					 uint64_t      *outScheduled,
+					 uint64_t      *outCompleted)
+{
+	nnpiCommandList::ptr cmdlist = s_cmdlists.find(commandList);
+	if (!cmdlist.get())
+		return NNP_NO_SUCH_CMDLIST;
+
+	cmdlist->query_instances(outScheduled, outCompleted);
+
+	return NNP_NO_ERROR;
+}
+
 NNPError nnpdrvCommandListGetErrorMessage(NNPCommandList commandList,
 					  uint32_t       index,
 					  void          *buf,
@@ -1454,6 +2475,39 @@ NNPError nnpdrvCommandListGetErrorMessage(NNPCommandList commandList,
 	return cmdlist->getErrorList()->getErrorMessage(index, buf, buf_size, out_buf_size);
 }
 
+NNPError nnpdrvCommandListGetEventFd(NNPCommandList commandList,
+				     int           *outFd)
+{
+	nnpiCommandList::ptr cmdlist = s_cmdlists.find(commandList);
+	if (!cmdlist.get())
+		return NNP_NO_SUCH_CMDLIST;
+
+	if (!outFd)
+		return NNP_INVALID_ARGUMENT;
+
+	*outFd = cmdlist->completionEvent().fd();
+	if (*outFd < 0)
+		return NNP_IO_ERROR;
+
+	return NNP_NO_ERROR;
+}
+
+NNPError nnpdrvCommandListSetCompletionCallback(NNPCommandList        commandList,
+						NNPCompletionCallback callback,
+						void                 *userData,
+						uint32_t              flags)
+{
+	nnpiCommandList::ptr cmdlist = s_cmdlists.find(commandList);
+	if (!cmdlist.get())
+		return NNP_NO_SUCH_CMDLIST;
+
+	cmdlist->completionEvent().setCallback(callback,
+					       userData,
+					       (flags & NNP_COMPLETION_CALLBACK_WORKER) != 0);
+
+	return NNP_NO_ERROR;
+}
+
 NNPError nnpdrvCommandListClearErrorState(NNPCommandList commandList)
 {
 	nnpiCommandList::ptr cmdlist = s_cmdlists.find(commandList);
@@ -1465,45 +2519,68 @@ NNPError nnpdrvCommandListClearErrorState(NNPCommandList commandList)
 
 void nnpiInferenceLock(void)
 {
-	s_contexts.mutex().lock();
+	s_contexts.lock();
 
 	//nnpiGlobalLock must be locked
 	nnpiActiveContexts::lock();
 
-	nnpiHostRes::handle_map.mutex().lock();
-	s_devres.mutex().lock();
-	s_networks.mutex().lock();
-	s_infreqs.mutex().lock();
-	s_copy.mutex().lock();
-	s_cmdlists.mutex().lock();
+	nnpiHostRes::handle_map.lock();
+	s_devres.lock();
+	s_networks.lock();
+	s_infreqs.lock();
+	s_copy.lock();
+	s_cmdlists.lock();
+	s_cqs.lock();
+	s_squeues.lock();
+	s_cmdlist_tmpls.lock();
+
+	nnpiResponseReactor::lock();
+	nnpiCallbackPool::lock();
 }
 
 void nnpiInferenceUnlock(void)
 {
-	s_cmdlists.mutex().unlock();
-	s_copy.mutex().unlock();
-	s_infreqs.mutex().unlock();
-	s_networks.mutex().unlock();
-	s_devres.mutex().unlock();
-	nnpiHostRes::handle_map.mutex().unlock();
+	nnpiCallbackPool::unlock();
+	nnpiResponseReactor::unlock();
+
+	s_cmdlist_tmpls.unlock();
+	s_squeues.unlock();
+	s_cqs.unlock();
+	s_cmdlists.unlock();
+	s_copy.unlock();
+	s_infreqs.unlock();
+	s_networks.unlock();
+	s_devres.unlock();
+	nnpiHostRes::handle_map.unlock();
 
 	//nnpiGlobalLock must be locked
 	nnpiActiveContexts::unlock();
 
-	s_contexts.mutex().unlock();
+	s_contexts.unlock();
 }
 
 void nnpiForkChildInferenceReset(void)
 {
+	nnpiResponseReactor::fork_child_reset();
+	nnpiCallbackPool::fork_child_reset();
+	nnpiChannel::fork_child_reset();
 	nnpiActiveContexts::close_all();
 
-	s_cmdlists.clear();
-	s_copy.clear();
-	s_infreqs.clear();
-	s_networks.clear();
-	s_devres.clear();
-	nnpiHostRes::handle_map.clear();
-	s_contexts.clear();
+	/*
+	 * Runs only in the forked child, where the calling thread is the
+	 * only one, so the maps are cleared without waiting for readers
+	 * which were pinning slots in the parent at fork time.
+	 */
+	s_cmdlist_tmpls.fork_child_clear();
+	s_cmdlists.fork_child_clear();
+	s_cqs.fork_child_clear();
+	s_squeues.fork_child_clear();
+	s_copy.fork_child_clear();
+	s_infreqs.fork_child_clear();
+	s_networks.fork_child_clear();
+	s_devres.fork_child_clear();
+	nnpiHostRes::handle_map.fork_child_clear();
+	s_contexts.fork_child_clear();
 
 	nnpiActiveContexts::destroy();
 }
@@ -0,0 +1,232 @@
+/*******************************************
+ * Copyright (C) 2017-2020 Intel Corporation
+ * SPDX-License-Identifier: Apache-2.0
+ *******************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <sched.h>
+
+/*
+ * Direct-indexed table of objects keyed by a BITS wide protocol ID.
+ *
+ * The ID space is covered by a radix tree of 256 entry nodes whose
+ * leaves hold the object slots. Nodes are allocated on first insert
+ * below them and are freed only with the table, so get() walks the
+ * tree without a lock and never allocates. A slot is pinned by a reader
+ * count in its state while its shared_ptr is copied, remove() clears
+ * the valid bit and waits for pinned readers before releasing the
+ * object. Writers are serialized by a per table mutex.
+ */
+template <class T, unsigned int BITS>
+class nnpiObjTable {
+public:
+	typedef std::shared_ptr<T> ptr;
+
+	nnpiObjTable()
+	{
+		for (unsigned int i = 0; i < FANOUT; ++i)
+			m_root.child[i].store(nullptr, std::memory_order_relaxed);
+	}
+
+	~nnpiObjTable()
+	{
+		free_children(&m_root, LEVELS - 1);
+	}
+
+	ptr get(uint32_t id) const
+	{
+		Slot *slot = lookup(id);
+
+		if (!slot)
+			return ptr();
+
+		return pin_get(*slot);
+	}
+
+	void insert(uint32_t id, const ptr &obj)
+	{
+		ptr old;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Slot &slot = alloc_slot(id);
+
+		if (invalidate(slot))
+			old = std::move(slot.obj);
+		slot.obj = obj;
+		if (obj.get())
+			slot.state.store(VALID, std::memory_order_release);
+	}
+
+	void remove(uint32_t id)
+	{
+		ptr old;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Slot *slot = lookup(id);
+
+		if (slot && invalidate(*slot))
+			old = std::move(slot->obj);
+	}
+
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for_each_slot(&m_root, LEVELS - 1, [](Slot &slot) {
+					if (invalidate(slot))
+						slot.obj.reset();
+				});
+	}
+
+	/* cb is called without the table lock, objects may be removed meanwhile */
+	template <class CB_FUNC>
+	void for_each(CB_FUNC cb)
+	{
+		for_each_slot(&m_root, LEVELS - 1, [&cb](Slot &slot) {
+					ptr obj = pin_get(slot);
+
+					if (obj.get())
+						cb(obj);
+				});
+	}
+
+private:
+	static const unsigned int FANOUT_BITS = 8;
+	static const unsigned int FANOUT = 1 << FANOUT_BITS;
+	static const unsigned int LEVELS = BITS / FANOUT_BITS;
+	static const uint32_t VALID = 1U << 31; /* state: valid (1) | readers (31) */
+
+	static_assert(BITS % FANOUT_BITS == 0 && LEVELS >= 2 && BITS <= 32,
+		      "unsupported nnpiObjTable id width");
+
+	struct Slot {
+		Slot() : state(0) {}
+
+		std::atomic<uint32_t> state;
+		ptr                   obj;
+	};
+
+	struct Node {
+		std::atomic<void *> child[FANOUT];
+	};
+
+	static inline unsigned int level_idx(uint32_t id, unsigned int level)
+	{
+		return (id >> (level * FANOUT_BITS)) & (FANOUT - 1);
+	}
+
+	Slot *lookup(uint32_t id) const
+	{
+		const Node *node = &m_root;
+		Slot *leaf;
+
+		for (unsigned int l = LEVELS - 1; l > 1; --l) {
+			node = (const Node *)node->child[level_idx(id, l)].load(std::memory_order_acquire);
+			if (!node)
+				return nullptr;
+		}
+
+		leaf = (Slot *)node->child[level_idx(id, 1)].load(std::memory_order_acquire);
+		if (!leaf)
+			return nullptr;
+
+		return &leaf[level_idx(id, 0)];
+	}
+
+	/* table mutex must be held */
+	Slot &alloc_slot(uint32_t id)
+	{
+		Node *node = &m_root;
+		Slot *leaf;
+
+		for (unsigned int l = LEVELS - 1; l > 1; --l) {
+			std::atomic<void *> &c = node->child[level_idx(id, l)];
+
+			if (!c.load(std::memory_order_relaxed)) {
+				Node *n = new Node;
+
+				for (unsigned int i = 0; i < FANOUT; ++i)
+					n->child[i].store(nullptr, std::memory_order_relaxed);
+				c.store(n, std::memory_order_release);
+			}
+			node = (Node *)c.load(std::memory_order_relaxed);
+		}
+
+		std::atomic<void *> &c = node->child[level_idx(id, 1)];
+		if (!c.load(std::memory_order_relaxed))
+			c.store(new Slot[FANOUT], std::memory_order_release);
+		leaf = (Slot *)c.load(std::memory_order_relaxed);
+
+		return leaf[level_idx(id, 0)];
+	}
+
+	static ptr pin_get(Slot &slot)
+	{
+		ptr ret;
+		uint32_t state = slot.state.load(std::memory_order_acquire);
+
+		do {
+			if (!(state & VALID))
+				return ret;
+		} while (!slot.state.compare_exchange_weak(state, state + 1,
+							   std::memory_order_acquire,
+							   std::memory_order_acquire));
+
+		ret = slot.obj;
+		slot.state.fetch_sub(1, std::memory_order_release);
+
+		return ret;
+	}
+
+	/* table mutex must be held, returns false if the slot was not valid */
+	static bool invalidate(Slot &slot)
+	{
+		uint32_t state = slot.state.fetch_and(~VALID, std::memory_order_acq_rel);
+
+		while ((slot.state.load(std::memory_order_acquire) & ~VALID) != 0)
+			sched_yield();
+
+		return (state & VALID) != 0;
+	}
+
+	template <class F>
+	static void for_each_slot(const Node *node, unsigned int level, F f)
+	{
+		for (unsigned int i = 0; i < FANOUT; ++i) {
+			void *c = node->child[i].load(std::memory_order_acquire);
+
+			if (!c)
+				continue;
+			if (level > 1) {
+				for_each_slot((const Node *)c, level - 1, f);
+			} else {
+				Slot *leaf = (Slot *)c;
+
+				for (unsigned int j = 0; j < FANOUT; ++j)
+					f(leaf[j]);
+			}
+		}
+	}
+
+	static void free_children(Node *node, unsigned int level)
+	{
+		for (unsigned int i = 0; i < FANOUT; ++i) {
+			void *c = node->child[i].load(std::memory_order_relaxed);
+
+			if (!c)
+				continue;
+			if (level > 1) {
+				free_children((Node *)c, level - 1);
+				delete (Node *)c;
+			} else {
+				delete [] (Slot *)c;
+			}
+		}
+	}
+
+	Node m_root;
+	std::mutex m_mutex;
+};
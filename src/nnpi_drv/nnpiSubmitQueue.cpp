@@ -0,0 +1,128 @@
+/*******************************************
+ * Copyright (C) 2017-2020 Intel Corporation
+ * SPDX-License-Identifier: Apache-2.0
+ *******************************************/
+
+#include "nnpiSubmitQueue.h"
+#include <string.h>
+#include <chrono>
+
+NNPError nnpiSubmitQueue::create(const nnpiInfContext::ptr &ctx,
+				 uint8_t                    priority,
+				 nnpiSubmitQueue::ptr      &out_queue)
+{
+	if (priority > nnpiPriorityLock::MAX_PRIORITY)
+		return NNP_INVALID_ARGUMENT;
+
+	out_queue.reset(new nnpiSubmitQueue(ctx, priority));
+	if (!out_queue.get())
+		return NNP_OUT_OF_MEMORY;
+
+	return NNP_NO_ERROR;
+}
+
+uint64_t nnpiSubmitQueue::enter()
+{
+	std::chrono::steady_clock::time_point start;
+	uint32_t depth = m_depth.fetch_add(1) + 1;
+	uint32_t max_depth = m_max_depth.load(std::memory_order_relaxed);
+
+	while (depth > max_depth &&
+	       !m_max_depth.compare_exchange_weak(max_depth, depth))
+		;
+
+	if (m_mutex.try_lock()) {
+		m_ring_stall_base = nnpiRingBuffer::threadStallUs();
+		return 0;
+	}
+
+	start = std::chrono::steady_clock::now();
+	m_mutex.lock();
+	m_ring_stall_base = nnpiRingBuffer::threadStallUs();
+
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - start).count() + 1;
+}
+
+void nnpiSubmitQueue::leave(uint64_t stall_us)
+{
+	/* add the time this submission waited for command ring space */
+	stall_us += nnpiRingBuffer::threadStallUs() - m_ring_stall_base;
+	m_mutex.unlock();
+
+	m_submitted.fetch_add(1, std::memory_order_relaxed);
+	if (stall_us > 0) {
+		m_stalls.fetch_add(1, std::memory_order_relaxed);
+		m_stall_us.fetch_add(stall_us, std::memory_order_relaxed);
+	}
+	m_depth.fetch_sub(1);
+}
+
+NNPError nnpiSubmitQueue::scheduleCopy(const nnpiCopyCommand::ptr &copy,
+				       uint64_t                    byte_size)
+{
+	NNPError ret;
+	uint64_t stall_us;
+
+	if (copy->context() != m_ctx)
+		return NNP_INVALID_ARGUMENT;
+
+	stall_us = enter();
+	ret = copy->schedule(byte_size, m_priority);
+	leave(stall_us);
+
+	return ret;
+}
+
+NNPError nnpiSubmitQueue::scheduleInferReq(const nnpiInfReq::ptr      &infreq,
+					   const nnpdrvinfSchedParams *sched_params)
+{
+	nnpdrvinfSchedParams params;
+	nnpdrvinfSchedParams *p = NULL;
+	NNPError ret;
+	uint64_t stall_us;
+
+	if (infreq->network()->context() != m_ctx)
+		return NNP_INVALID_ARGUMENT;
+
+	/* keep device defaults for a normal priority queue without params */
+	if (sched_params != NULL) {
+		params = *sched_params;
+		params.priority = m_priority;
+		p = &params;
+	} else if (m_priority != NNP_SUBMIT_QUEUE_PRIORITY_NORMAL) {
+		memset(&params, 0, sizeof(params));
+		params.priority = m_priority;
+		p = &params;
+	}
+
+	stall_us = enter();
+	ret = infreq->schedule(p);
+	leave(stall_us);
+
+	return ret;
+}
+
+NNPError nnpiSubmitQueue::scheduleCommandList(const nnpiCommandList::ptr &cmdlist)
+{
+	NNPError ret;
+	uint64_t stall_us;
+
+	if (cmdlist->context() != m_ctx)
+		return NNP_INVALID_ARGUMENT;
+
+	stall_us = enter();
+	ret = cmdlist->schedule(m_priority, &stall_us);
+	leave(stall_us);
+
+	return ret;
+}
+
+void nnpiSubmitQueue::queryStats(NNPSubmitQueueStats *out_stats) const
+{
+	out_stats->numSubmitted = m_submitted.load(std::memory_order_relaxed);
+	out_stats->numStalls = m_stalls.load(std::memory_order_relaxed);
+	out_stats->stallTimeUs = m_stall_us.load(std::memory_order_relaxed);
+	out_stats->depth = m_depth.load();
+	out_stats->maxDepth = m_max_depth.load();
+}
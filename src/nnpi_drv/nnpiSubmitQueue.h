@@ -0,0 +1,78 @@
+/*******************************************
+ * Copyright (C) 2017-2020 Intel Corporation
+ * SPDX-License-Identifier: Apache-2.0
+ *******************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include "nnpdrvInference.h"
+#include "nnpiInfContext.h"
+#include "nnpiCopyCommand.h"
+#include "nnpiInfReq.h"
+#include "nnpiCommandList.h"
+
+/*
+ * Context submit queue.
+ * Submissions of a queue are serialized on the queue's own lock, so
+ * queues of the same context do not wait for each other there. The
+ * queue priority goes to the message priority fields and orders execute
+ * ring uploads through the context execRingLock.
+ * Queues are not independent below that: all queues of a context send
+ * through the same channel, so schedule messages of every queue share
+ * the command ring 0 and the channel write path and are serialized by
+ * the channel, and a broken context fails all of its queues.
+ */
+class nnpiSubmitQueue {
+public:
+	typedef std::shared_ptr<nnpiSubmitQueue> ptr;
+
+	static NNPError create(const nnpiInfContext::ptr &ctx,
+			       uint8_t                    priority,
+			       nnpiSubmitQueue::ptr      &out_queue);
+
+	nnpiInfContext::ptr context() const { return m_ctx; }
+	uint8_t priority() const { return m_priority; }
+
+	NNPError scheduleCopy(const nnpiCopyCommand::ptr &copy,
+			      uint64_t                    byte_size);
+	NNPError scheduleInferReq(const nnpiInfReq::ptr      &infreq,
+				  const nnpdrvinfSchedParams *sched_params);
+	NNPError scheduleCommandList(const nnpiCommandList::ptr &cmdlist);
+
+	void queryStats(NNPSubmitQueueStats *out_stats) const;
+
+private:
+	nnpiSubmitQueue(const nnpiInfContext::ptr &ctx,
+			uint8_t                    priority) :
+		m_ctx(ctx),
+		m_priority(priority),
+		m_submitted(0),
+		m_stalls(0),
+		m_stall_us(0),
+		m_ring_stall_base(0),
+		m_depth(0),
+		m_max_depth(0)
+	{
+	}
+
+	/*
+	 * enters the queue, returns the time waited for earlier submissions,
+	 * leave() adds the time waited for command ring space meanwhile
+	 */
+	uint64_t enter();
+	void leave(uint64_t stall_us);
+
+	const nnpiInfContext::ptr m_ctx;
+	const uint8_t m_priority;
+	std::mutex m_mutex;
+	std::atomic<uint64_t> m_submitted;
+	std::atomic<uint64_t> m_stalls;
+	std::atomic<uint64_t> m_stall_us;
+	uint64_t m_ring_stall_base; /* ring stall time of the submitting thread, under m_mutex */
+	std::atomic<uint32_t> m_depth;
+	std::atomic<uint32_t> m_max_depth;
+};
@@ -5,7 +5,28 @@
 
 #include "nnpiUtils.h"
 #include <string.h>
+#include <algorithm>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "safe_lib.h"
+#include "ipc_protocol.h"
+
+static inline long futex_wait(std::atomic<uint32_t> *uaddr,
+			      uint32_t               val,
+			      const struct timespec *timeout)
+{
+	return syscall(SYS_futex, (uint32_t *)uaddr, FUTEX_WAIT_PRIVATE, val, timeout, NULL, 0);
+}
+
+static inline long futex_wake_all(std::atomic<uint32_t> *uaddr)
+{
+	return syscall(SYS_futex, (uint32_t *)uaddr, FUTEX_WAKE_PRIVATE, INT32_MAX, NULL, NULL, 0);
+}
+
+thread_local uint64_t nnpiRingBuffer::s_thread_stall_us = 0;
 
 void nnpiRingBuffer::push(void *buf, uint32_t size)
 {
@@ -35,22 +56,376 @@ void nnpiRingBuffer::pop(void *buf, uint32_t size)
 	unlockAvailSpace(size);
 }
 
-int nnpiIDA::alloc(uint32_t &out_id)
+bool nnpiRingBuffer::tryLockEmpty()
+{
+	if (m_lockless) {
+		if (!m_lf_prod_mutex.try_lock())
+			return false;
+		if (!m_invalid &&
+		    m_lf_tail.load(std::memory_order_relaxed) == m_lf_head.load(std::memory_order_acquire))
+			return true;
+		m_lf_prod_mutex.unlock();
+		return false;
+	}
+
+	if (!m_waitq.mutex().try_lock())
+		return false;
+	if (!m_invalid && getAvailBytes() == 0)
+		return true;
+	m_waitq.unlock();
+	return false;
+}
+
+void nnpiRingBuffer::replaceBuffer(nnpiHostRes::ptr hostres)
+{
+	m_hostres = hostres;
+	m_buf.store((uint8_t *)hostres->vaddr(), std::memory_order_relaxed);
+	m_size.store((uint32_t)hostres->size(), std::memory_order_relaxed);
+	m_head = 0;
+	m_tail = 0;
+	m_is_full = false;
+	m_lf_base = m_lf_tail.load(std::memory_order_relaxed);
+}
+
+static inline uint32_t ring_record_size(uint32_t payload_size)
+{
+	return (sizeof(struct nnpiRingRecordHdr) + payload_size + 7) & ~7U;
+}
+
+uint32_t nnpiRingBuffer::maxPayload() const
+{
+	if (m_packed)
+		return NNP_PAGE_SIZE - sizeof(struct nnpiRingRecordHdr);
+
+	return NNP_PAGE_SIZE;
+}
+
+void *nnpiRingBuffer::lockPayload(uint32_t max_size,
+				  uint32_t timeout_us)
+{
+	uint32_t rec_size, cont;
+	uint8_t *ptr;
+
+	if (max_size > maxPayload())
+		return NULL;
+
+	if (!m_packed) {
+		ptr = (uint8_t *)lockFreeSpace(NNP_PAGE_SIZE, cont, timeout_us);
+		if (ptr != NULL && cont != NNP_PAGE_SIZE) {
+			unlockFreeSpace(0);
+			return NULL;
+		}
+
+		return ptr;
+	}
+
+	rec_size = ring_record_size(max_size);
+	ptr = (uint8_t *)lockFreeSpace(rec_size, cont, timeout_us);
+	if (ptr != NULL && cont < rec_size) {
+		struct nnpiRingRecordHdr *pad = (struct nnpiRingRecordHdr *)ptr;
+
+		/*
+		 * Not enough contiguous space before the ring end,
+		 * skip to the ring start with a padding record, the
+		 * card consumes it together with the next record.
+		 */
+		pad->size = cont - sizeof(*pad);
+		pad->flags = NNPI_RING_RECORD_PAD;
+		unlockFreeSpace(cont);
+
+		ptr = (uint8_t *)lockFreeSpace(rec_size, cont, timeout_us);
+		if (ptr != NULL && cont < rec_size) {
+			unlockFreeSpace(0);
+			return NULL;
+		}
+	}
+
+	if (ptr == NULL)
+		return NULL;
+
+	m_record = ptr;
+
+	return ptr + sizeof(struct nnpiRingRecordHdr);
+}
+
+void nnpiRingBuffer::setPayloadSize(uint32_t size)
+{
+	struct nnpiRingRecordHdr *hdr = (struct nnpiRingRecordHdr *)m_record;
+
+	if (!m_packed)
+		return;
+
+	hdr->size = size;
+	hdr->flags = 0;
+}
+
+void nnpiRingBuffer::unlockPayload(uint32_t size)
+{
+	if (!m_packed)
+		unlockFreeSpace(NNP_PAGE_SIZE);
+	else
+		unlockFreeSpace(ring_record_size(size));
+}
+
+void *nnpiRingBuffer::lf_lockFreeSpace(uint32_t  size,
+				       uint32_t &outContSize,
+				       uint32_t  timeout_us)
+{
+	struct timespec deadline, now, rel;
+	std::chrono::steady_clock::time_point stall_start;
+	uint64_t tail;
+	uint32_t seq;
+	bool timed_out = false;
+	bool stalled = false;
+
+	outContSize = 0;
+
+	if (timeout_us != UINT32_MAX) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout_us / 1000000;
+		deadline.tv_nsec += (timeout_us % 1000000) * 1000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	m_lf_prod_mutex.lock();
+
+	/* the tail is only modified by producers, which are serialized */
+	tail = m_lf_tail.load(std::memory_order_relaxed);
+
+	while (!m_invalid &&
+	       m_size - (uint32_t)(tail - m_lf_head.load(std::memory_order_acquire)) < size) {
+		if (timed_out)
+			break;
+
+		if (!stalled) {
+			stalled = true;
+			stall_start = std::chrono::steady_clock::now();
+			m_stalls++;
+		}
+
+		/*
+		 * Register as a waiter before sampling the futex word,
+		 * the response thread bumps the word before it checks
+		 * for waiters, so either we see the new word value or
+		 * it sees us waiting.
+		 */
+		m_lf_waiters.fetch_add(1);
+		seq = m_lf_seq.load();
+		if (!m_invalid &&
+		    m_size - (uint32_t)(tail - m_lf_head.load(std::memory_order_acquire)) < size) {
+			if (timeout_us == UINT32_MAX) {
+				futex_wait(&m_lf_seq, seq, NULL);
+			} else {
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				rel.tv_sec = deadline.tv_sec - now.tv_sec;
+				rel.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+				if (rel.tv_nsec < 0) {
+					rel.tv_sec--;
+					rel.tv_nsec += 1000000000;
+				}
+				if (rel.tv_sec < 0)
+					timed_out = true;
+				else if (futex_wait(&m_lf_seq, seq, &rel) != 0 && errno == ETIMEDOUT)
+					timed_out = true;
+			}
+		}
+		m_lf_waiters.fetch_sub(1);
+	}
+
+	if (stalled)
+		addThreadStall(stall_start);
+
+	if (m_invalid ||
+	    m_size - (uint32_t)(tail - m_lf_head.load(std::memory_order_acquire)) < size) {
+		m_lf_prod_mutex.unlock();
+		return NULL;
+	}
+
+	uint32_t off = (uint32_t)((tail - m_lf_base) % m_size);
+	uint32_t end_dist = m_size - off;
+
+	if (end_dist >= size)
+		outContSize = size;
+	else
+		outContSize = end_dist;
+
+	return m_buf + off;
+}
+
+void nnpiRingBuffer::lf_updateHead(uint32_t size)
+{
+	if (size == 0)
+		return;
+
+	/* only the channel response thread advances the head */
+	m_lf_head.store(m_lf_head.load(std::memory_order_relaxed) + size,
+			std::memory_order_release);
+	lf_wakeup();
+}
+
+void nnpiRingBuffer::lf_wakeup()
+{
+	m_lf_seq.fetch_add(1);
+	if (m_lf_waiters.load() > 0)
+		futex_wake_all(&m_lf_seq);
+}
+
+void *nnpiArena::alloc(size_t size)
 {
 	std::lock_guard<std::mutex> lock(m_mutex);
+	uint8_t *p;
 
-	if (m_free_ranges.size() < 1)
-		return -1;
+	size = (size + 15) & ~(size_t)15;
+
+	/* a large object gets a chunk of its own, the last chunk stays current */
+	if (size > CHUNK_SIZE) {
+		m_chunks.emplace(m_chunks.begin(), new uint8_t[size]);
+		return m_chunks.front().get();
+	}
+
+	if (m_used + size > CHUNK_SIZE) {
+		m_chunks.emplace_back(new uint8_t[CHUNK_SIZE]);
+		m_used = 0;
+	}
+
+	p = m_chunks.back().get() + m_used;
+	m_used += size;
+
+	return p;
+}
+
+nnpiIDA::nnpiIDA(uint32_t max_id) :
+	m_num_levels(0),
+	m_capacity(max_id + 1),
+	m_num_alloc(0),
+	m_max_alloc(0)
+{
+	uint64_t n = (uint64_t)max_id + 1;
+
+	/* all IDs free, bits past max_id are never set */
+	do {
+		std::vector<uint64_t> &level = m_levels[m_num_levels++];
+
+		level.assign((n + 63) / 64, ~0ULL);
+		if (n % 64)
+			level.back() = (1ULL << (n % 64)) - 1;
+		n = level.size();
+	} while (n > 1);
+}
+
+uint32_t nnpiIDA::find_next_free(unsigned int level, uint32_t pos)
+{
+	std::vector<uint64_t> &bits = m_levels[level];
+	uint32_t w = pos / 64;
+	uint64_t word;
+
+	if (w >= bits.size())
+		return NONE;
+
+	word = bits[w] & (~0ULL << (pos % 64));
+	if (word)
+		return w * 64 + __builtin_ctzll(word);
+
+	if (level + 1 == m_num_levels)
+		return NONE;
+
+	/* next word of this level having a free bit */
+	w = find_next_free(level + 1, w + 1);
+	if (w == NONE)
+		return NONE;
+
+	return w * 64 + __builtin_ctzll(bits[w]);
+}
+
+uint32_t nnpiIDA::find_next_used(uint32_t pos, uint32_t end)
+{
+	std::vector<uint64_t> &bits = m_levels[0];
+
+	while (pos < end) {
+		uint64_t word = ~bits[pos / 64] & (~0ULL << (pos % 64));
+
+		if (word) {
+			pos = (pos & ~63U) + __builtin_ctzll(word);
+			return pos < end ? pos : NONE;
+		}
+		pos = (pos & ~63U) + 64;
+	}
+
+	return NONE;
+}
+
+void nnpiIDA::set_bits(uint32_t word, uint64_t mask)
+{
+	for (unsigned int l = 0; ; ++l) {
+		uint64_t &bits = m_levels[l][word];
+		bool was_empty = (bits == 0);
+
+		bits |= mask;
+		if (!was_empty || l + 1 == m_num_levels)
+			break;
+		mask = 1ULL << (word % 64);
+		word /= 64;
+	}
+}
 
-	std::map<uint32_t, uint32_t>::iterator i = m_free_ranges.begin();
+void nnpiIDA::clear_bits(uint32_t word, uint64_t mask)
+{
+	for (unsigned int l = 0; ; ++l) {
+		uint64_t &bits = m_levels[l][word];
+
+		bits &= ~mask;
+		if (bits != 0 || l + 1 == m_num_levels)
+			break;
+		mask = 1ULL << (word % 64);
+		word /= 64;
+	}
+}
+
+/* returns the number of IDs which changed state */
+uint32_t nnpiIDA::update_range(uint32_t first, uint32_t count, bool set)
+{
+	uint64_t end = (uint64_t)first + count;
+	uint64_t pos = first;
+	uint32_t changed = 0;
+
+	if (end > m_capacity)
+		end = m_capacity;
+
+	while (pos < end) {
+		uint32_t w = pos / 64;
+		uint64_t len = std::min<uint64_t>(end, (uint64_t)w * 64 + 64) - pos;
+		uint64_t mask = (len == 64 ? ~0ULL : ((1ULL << len) - 1)) << (pos % 64);
+		uint64_t bits = m_levels[0][w];
+
+		if (set) {
+			changed += __builtin_popcountll(mask & ~bits);
+			set_bits(w, mask);
+		} else {
+			changed += __builtin_popcountll(mask & bits);
+			clear_bits(w, mask);
+		}
+		pos += len;
+	}
 
-	out_id = (*i).first;
-	if ((*i).first < (*i).second)
-		m_free_ranges[(*i).first + 1] = (*i).second;
+	return changed;
+}
+
+int nnpiIDA::alloc(uint32_t &out_id)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	uint32_t id = find_next_free(0, 0);
+
+	if (id == NONE)
+		return -1;
 
-	m_free_ranges.erase(i);
+	clear_bits(id / 64, 1ULL << (id % 64));
 
-	m_num_alloc++;
+	if (++m_num_alloc > m_max_alloc)
+		m_max_alloc = m_num_alloc;
+	out_id = id;
 
 	return 0;
 }
@@ -58,24 +433,48 @@ int nnpiIDA::alloc(uint32_t &out_id)
 void nnpiIDA::free(uint32_t id)
 {
 	std::lock_guard<std::mutex> lock(m_mutex);
-	std::map<uint32_t, uint32_t>::iterator i;
 
+	/* ignore out of range and already free IDs */
+	if (id >= m_capacity || (m_levels[0][id / 64] & (1ULL << (id % 64))))
+		return;
+
+	set_bits(id / 64, 1ULL << (id % 64));
 	m_num_alloc--;
+}
+
+int nnpiIDA::alloc_range(uint32_t count, uint32_t &out_first)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	uint32_t first, used;
 
-	for (i = m_free_ranges.begin();
-	     i != m_free_ranges.end();
-	     i++) {
-		if ((*i).first == id + 1) {
-			m_free_ranges[id] = (*i).second;
-			m_free_ranges.erase(i);
-			return;
-		} else if ((*i).second == id - 1) {
-			(*i).second = id;
-			return;
+	if (count == 0 || count > m_capacity)
+		return -1;
+
+	first = find_next_free(0, 0);
+	while (first != NONE && (uint64_t)first + count <= m_capacity) {
+		used = find_next_used(first, first + count);
+		if (used == NONE) {
+			update_range(first, count, false);
+			m_num_alloc += count;
+			if (m_num_alloc > m_max_alloc)
+				m_max_alloc = m_num_alloc;
+			out_first = first;
+			return 0;
 		}
+		first = find_next_free(0, used);
 	}
 
-	m_free_ranges[id] = id;
+	return -1;
+}
+
+void nnpiIDA::free_range(uint32_t first, uint32_t count)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (first >= m_capacity)
+		return;
+
+	m_num_alloc -= update_range(first, count, true);
 }
 
 uint32_t nnpiIDA::get_num_alloc(void)
@@ -84,3 +483,12 @@ uint32_t nnpiIDA::get_num_alloc(void)
 
 	return m_num_alloc;
 }
+
+void nnpiIDA::get_usage(NNPIdUsage *out_usage)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	out_usage->allocated = m_num_alloc;
+	out_usage->maxAllocated = m_max_alloc;
+	out_usage->capacity = m_capacity;
+}
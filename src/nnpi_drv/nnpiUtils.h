@@ -8,30 +8,95 @@
 #include <memory>
 #include <stdint.h>
 #include <map>
+#include <vector>
 #include "nnpiHostProc.h"
 #include "nnpiWaitQueue.h"
 #include <mutex>
+#include <atomic>
+#include <chrono>
+
+#define NNPI_CACHE_LINE_SIZE 64
+
+/*
+ * Header of a variable length record in a packed command ring.
+ * Records start 8 bytes aligned and never wrap around the ring end,
+ * space left at the ring end is covered by a padding record.
+ */
+struct nnpiRingRecordHdr {
+	uint32_t size;   /* payload bytes following the header */
+	uint32_t flags;
+};
 
+#define NNPI_RING_RECORD_PAD   (1 << 0)
+
+/*
+ * nnpiRingBuffer - host side of a channel ring buffer.
+ *
+ * By default all ring state is protected by the ring wait queue mutex.
+ * A ring created with lockless=true (used for command rings only) keeps
+ * its head and tail as free running atomic byte counters on separate
+ * cache lines: producers are serialized by a producer-only mutex, the
+ * response thread advances the head without taking any lock and a
+ * producer sleeps on a futex only when the ring is actually full.
+ */
 class nnpiRingBuffer {
 public:
 	typedef std::shared_ptr<nnpiRingBuffer> ptr;
 
-	explicit nnpiRingBuffer(nnpiHostRes::ptr hostres) :
+	explicit nnpiRingBuffer(nnpiHostRes::ptr hostres,
+				bool             lockless = false) :
 		m_hostres(hostres),
 		m_buf((uint8_t *)hostres->vaddr()),
 		m_size((uint32_t)hostres->size()),
 		m_head(0),
 		m_tail(0),
 		m_is_full(false),
-		m_invalid(false)
+		m_invalid(false),
+		m_lockless(lockless),
+		m_packed(false),
+		m_record(NULL),
+		m_stalls(0),
+		m_lf_base(0),
+		m_lf_tail(0),
+		m_lf_head(0),
+		m_lf_seq(0),
+		m_lf_waiters(0)
 	{
 	}
 
-	inline uint32_t head() const { return m_head; }
+	inline bool lockless() const { return m_lockless; }
+	inline uint32_t size() const { return m_size.load(std::memory_order_relaxed); }
+	inline uint64_t stalls() const { return m_stalls.load(std::memory_order_relaxed); }
+
+	/* time the calling thread spent waiting for free space of any ring */
+	static inline uint64_t threadStallUs() { return s_thread_stall_us; }
+	nnpiHostRes::ptr hostres() const { return m_hostres; }
+
+	inline uint32_t head() const
+	{
+		if (m_lockless)
+			return (uint32_t)((m_lf_head.load(std::memory_order_acquire) - m_lf_base) % m_size);
+		return m_head;
+	}
+
+	/*
+	 * Replaces the ring memory, the ring must be empty and locked
+	 * by lockFreeSpace() or tryLockEmpty() when called.
+	 */
+	void replaceBuffer(nnpiHostRes::ptr hostres);
+
+	/*
+	 * Locks the ring without blocking if no writer holds it and the
+	 * card consumed all of it, unlocked by unlockFreeSpace(0).
+	 */
+	bool tryLockEmpty();
 
 	inline uint32_t getFreeBytes()
 	{
-		if (m_is_full)
+		if (m_lockless)
+			return m_size - (uint32_t)(m_lf_tail.load(std::memory_order_relaxed) -
+						   m_lf_head.load(std::memory_order_acquire));
+		else if (m_is_full)
 			return 0;
 		else if (m_tail >= m_head)
 			return (m_head + m_size - m_tail);
@@ -41,7 +106,10 @@ public:
 
 	inline uint32_t getAvailBytes()
 	{
-		if (m_is_full)
+		if (m_lockless)
+			return (uint32_t)(m_lf_tail.load(std::memory_order_relaxed) -
+					  m_lf_head.load(std::memory_order_acquire));
+		else if (m_is_full)
 			return m_size;
 		else if (m_head > m_tail)
 			return (m_tail + m_size - m_head);
@@ -56,10 +124,20 @@ public:
 			    uint32_t &outContSize,
 			    uint32_t timeout_us = UINT32_MAX)
 	{
+		std::chrono::steady_clock::time_point stall_start;
 		bool avail;
+		bool stalled = false;
 
-		auto cond = [this, size]{
+		if (m_lockless)
+			return lf_lockFreeSpace(size, outContSize, timeout_us);
+
+		auto cond = [this, size, &stalled, &stall_start]{
 			bool ret = getFreeBytes() >= size || m_invalid;
+			if (!ret && !stalled) {
+				stalled = true;
+				stall_start = std::chrono::steady_clock::now();
+				m_stalls++;
+			}
 			return ret;
 		};
 
@@ -70,6 +148,9 @@ public:
 			avail = m_waitq.wait_timeout_lock(timeout_us, cond);
 		}
 
+		if (stalled)
+			addThreadStall(stall_start);
+
 		if (!m_invalid && avail) {
 			uint32_t end_dist = m_size - m_tail;
 
@@ -88,6 +169,14 @@ public:
 
 	void unlockFreeSpace(uint32_t size)
 	{
+		if (m_lockless) {
+			if (size > 0)
+				m_lf_tail.store(m_lf_tail.load(std::memory_order_relaxed) + size,
+						std::memory_order_release);
+			m_lf_prod_mutex.unlock();
+			return;
+		}
+
 		if (size > 0) {
 			m_tail = (m_tail + size) % m_size;
 			if (m_tail == m_head)
@@ -151,6 +240,11 @@ public:
 
 	void updateHead(uint32_t size)
 	{
+		if (m_lockless) {
+			lf_updateHead(size);
+			return;
+		}
+
 		if (size > 0) {
 			m_waitq.lock();
 			m_head = (m_head + size) % m_size;
@@ -161,38 +255,140 @@ public:
 
 	void setInvalid()
 	{
+		if (m_lockless) {
+			m_invalid = true;
+			lf_wakeup();
+			return;
+		}
+
 		m_waitq.update_and_notify([this] { m_invalid = true; });
 	}
 
 	const uint8_t *buf() const { return m_buf; }
 
+	/*
+	 * Command payload interface.
+	 * In the default mode every payload occupies a full page slot,
+	 * when packed mode is set each payload is written as a
+	 * variable length record so several payloads share a page.
+	 * lockPayload returns with the ring locked, the payload size is
+	 * set (before the command message is written) by setPayloadSize
+	 * and the ring is unlocked with unlockPayload once the message
+	 * has been written, unlockFreeSpace(0) cancels the reservation.
+	 */
+	void setPacked(bool packed) { m_packed = packed; }
+	bool packed() const { return m_packed; }
+	uint32_t maxPayload() const;
+	void *lockPayload(uint32_t max_size,
+			  uint32_t timeout_us = UINT32_MAX);
+	void setPayloadSize(uint32_t size);
+	void unlockPayload(uint32_t size);
+
 private:
-	nnpiHostRes::ptr m_hostres;
-	nnpiWaitQueue    m_waitq;
-	uint8_t * const  m_buf;
-	const uint32_t   m_size;
-	uint32_t         m_head;
-	uint32_t         m_tail;
-	bool             m_is_full;
-	bool             m_invalid;
+	void *lf_lockFreeSpace(uint32_t size,
+			       uint32_t &outContSize,
+			       uint32_t timeout_us);
+	void lf_updateHead(uint32_t size);
+	void lf_wakeup();
+
+	static inline void addThreadStall(std::chrono::steady_clock::time_point start)
+	{
+		s_thread_stall_us += std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - start).count() + 1;
+	}
+
+	static thread_local uint64_t s_thread_stall_us;
+
+private:
+	nnpiHostRes::ptr  m_hostres;
+	nnpiWaitQueue     m_waitq;
+	/* replaced only while the ring is locked, read unlocked by size() */
+	std::atomic<uint8_t *> m_buf;
+	std::atomic<uint32_t>  m_size;
+	uint32_t          m_head;
+	uint32_t          m_tail;
+	bool              m_is_full;
+	std::atomic<bool> m_invalid;
+	const bool        m_lockless;
+	bool              m_packed;
+	uint8_t          *m_record;
+	std::atomic<uint64_t> m_stalls;
+
+	/*
+	 * lockless mode state, producer and consumer owned counters
+	 * are kept on separate cache lines.
+	 */
+	std::mutex            m_lf_prod_mutex;
+	uint64_t              m_lf_base;     /* counters value at ring offset 0 */
+	char                  m_lf_pad0[NNPI_CACHE_LINE_SIZE];
+	std::atomic<uint64_t> m_lf_tail;     /* written by producers only */
+	char                  m_lf_pad1[NNPI_CACHE_LINE_SIZE];
+	std::atomic<uint64_t> m_lf_head;     /* written by response thread only */
+	std::atomic<uint32_t> m_lf_seq;      /* futex word, bumped on head advance */
+	std::atomic<uint32_t> m_lf_waiters;
+	char                  m_lf_pad2[NNPI_CACHE_LINE_SIZE];
 };
 
-class nnpiIDA {
+/*
+ * Bump allocator for many small objects sharing one owner lifetime.
+ * Memory is taken from fixed size chunks and only released, all at
+ * once, when the arena is destroyed. Objects placed in the arena must
+ * be destructed by their owner before that.
+ */
+class nnpiArena {
 public:
-	explicit nnpiIDA(uint32_t max_id)
+	nnpiArena() : m_used(CHUNK_SIZE)
 	{
-		m_free_ranges[0] = max_id;
-		m_num_alloc = 0;
 	}
 
+	/* returns 16 bytes aligned memory */
+	void *alloc(size_t size);
+
+private:
+	static const size_t CHUNK_SIZE = 16384;
+
+	std::mutex                             m_mutex;
+	std::vector<std::unique_ptr<uint8_t[]>> m_chunks;
+	size_t                                 m_used;  /* bytes used in the last chunk */
+};
+
+/*
+ * Protocol ID allocator over [0, max_id].
+ * Free IDs are kept in a hierarchical bitmap: a set bit in level 0
+ * marks a free ID and a set bit in level l marks a level l-1 word with
+ * a free bit. The lowest free ID is found with one find-first-set per
+ * level, and an alloc or free updates at most one word per level.
+ */
+class nnpiIDA {
+public:
+	explicit nnpiIDA(uint32_t max_id);
+
 	int alloc(uint32_t &out_id);
 	void free(uint32_t id);
+
+	/* allocates count consecutive IDs, lowest first */
+	int alloc_range(uint32_t count, uint32_t &out_first);
+	void free_range(uint32_t first, uint32_t count);
+
 	uint32_t get_num_alloc();
+	void get_usage(NNPIdUsage *out_usage);
 
 private:
-	std::map<uint32_t, uint32_t> m_free_ranges;
+	static const unsigned int MAX_LEVELS = 6;
+	static const uint32_t NONE = UINT32_MAX;
+
+	uint32_t find_next_free(unsigned int level, uint32_t pos);
+	uint32_t find_next_used(uint32_t pos, uint32_t end);
+	void set_bits(uint32_t word, uint64_t mask);
+	void clear_bits(uint32_t word, uint64_t mask);
+	uint32_t update_range(uint32_t first, uint32_t count, bool set);
+
+	std::vector<uint64_t> m_levels[MAX_LEVELS];
+	unsigned int m_num_levels;
+	const uint32_t m_capacity;
 	std::mutex m_mutex;
 	uint32_t m_num_alloc;
+	uint32_t m_max_alloc;
 };
 
 template<class T>
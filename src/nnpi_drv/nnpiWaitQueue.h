@@ -9,6 +9,60 @@
 #include <condition_variable>
 #include <chrono>
 #include <mutex>
+#include <atomic>
+#include <sched.h>
+
+#define NNPI_NOTIFY_BATCH_MAX 64
+
+class nnpiWaitQueue;
+
+struct nnpiNotifyBatch {
+	uint32_t       depth;
+	uint32_t       num;
+	nnpiWaitQueue *waitq[NNPI_NOTIFY_BATCH_MAX];
+};
+
+/*
+ * Wait policy - number of times to spin and then to yield the cpu
+ * polling the wait condition before blocking on the wait queue.
+ */
+struct nnpiWaitPolicy {
+	uint32_t spin_count;
+	uint32_t yield_count;
+};
+
+/* counts which phase of a policy wait resolved the wait */
+class nnpiWaitStats {
+public:
+	enum Phase {
+		SPIN = 0,
+		YIELD,
+		BLOCK,
+		TIMEOUT,
+		NUM_PHASES
+	};
+
+	nnpiWaitStats()
+	{
+		for (int i = 0; i < NUM_PHASES; ++i)
+			m_count[i] = 0;
+	}
+
+	inline void add(Phase p) { m_count[p].fetch_add(1, std::memory_order_relaxed); }
+	inline uint64_t get(Phase p) const { return m_count[p].load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<uint64_t> m_count[NUM_PHASES];
+};
+
+static inline void nnpi_cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield" ::: "memory");
+#endif
+}
 
 class nnpiWaitQueue {
 public:
@@ -18,12 +72,43 @@ public:
 
 	std::mutex &mutex() { return m_mutex; }
 
+	/*
+	 * Notification batching.
+	 * While the calling thread is inside a notify batch, update_and_notify
+	 * and unlock_notify apply the update under the wait queue lock but
+	 * defer the wakeup. Each wait queue updated during the batch is
+	 * notified once when the batch ends or is flushed.
+	 * Wait queues updated in a batch must stay alive until it is flushed.
+	 */
+	static inline void beginNotifyBatch()
+	{
+		notify_batch().depth++;
+	}
+
+	static inline void flushNotifyBatch()
+	{
+		nnpiNotifyBatch &batch = notify_batch();
+
+		for (uint32_t i = 0; i < batch.num; ++i)
+			batch.waitq[i]->m_cv.notify_all();
+		batch.num = 0;
+	}
+
+	static inline void endNotifyBatch()
+	{
+		nnpiNotifyBatch &batch = notify_batch();
+
+		if (batch.depth > 0 && --batch.depth == 0)
+			flushNotifyBatch();
+	}
+
 	template <class UpdateOp>
 	inline void update_and_notify(UpdateOp update_op)
 	{
 		std::lock_guard<std::mutex> lock(m_mutex);
 		update_op();
-		m_cv.notify_all();
+		if (!defer_notify())
+			m_cv.notify_all();
 	}
 
 	template <class Pred>
@@ -66,6 +151,90 @@ public:
 		return ret;
 	}
 
+	/*
+	 * Thread wait policy override.
+	 * When set, it is used by policy waits of the calling thread
+	 * instead of the waited object's policy.
+	 */
+	static inline const nnpiWaitPolicy *threadWaitPolicy()
+	{
+		nnpiThreadWaitPolicy &tp = thread_policy();
+
+		return tp.set ? &tp.policy : nullptr;
+	}
+
+	static inline void setThreadWaitPolicy(const nnpiWaitPolicy *policy)
+	{
+		nnpiThreadWaitPolicy &tp = thread_policy();
+
+		tp.set = (policy != nullptr);
+		if (policy)
+			tp.policy = *policy;
+	}
+
+	/*
+	 * Same as wait_timeout_lock (or wait_lock when usec is UINT32_MAX)
+	 * but polls the condition according to the wait policy before
+	 * blocking. Returns with the lock held when the condition is met.
+	 */
+	template <class Pred>
+	inline bool wait_policy_lock(const nnpiWaitPolicy &policy,
+				     uint32_t              usec,
+				     nnpiWaitStats        *stats,
+				     Pred                  cond)
+	{
+		std::chrono::steady_clock::time_point deadline;
+		bool ret;
+
+		if (usec != 0 && (policy.spin_count > 0 || policy.yield_count > 0)) {
+			bool infinite = (usec == UINT32_MAX);
+
+			if (!infinite)
+				deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(usec);
+
+			for (uint32_t i = 0; i < policy.spin_count; ++i) {
+				if (try_lock_cond(cond)) {
+					if (stats)
+						stats->add(nnpiWaitStats::SPIN);
+					return true;
+				}
+				if (!infinite && std::chrono::steady_clock::now() >= deadline)
+					break;
+				nnpi_cpu_relax();
+			}
+
+			for (uint32_t i = 0; i < policy.yield_count; ++i) {
+				if (try_lock_cond(cond)) {
+					if (stats)
+						stats->add(nnpiWaitStats::YIELD);
+					return true;
+				}
+				if (!infinite && std::chrono::steady_clock::now() >= deadline)
+					break;
+				sched_yield();
+			}
+
+			if (!infinite) {
+				auto now = std::chrono::steady_clock::now();
+
+				usec = (now >= deadline ? 0 :
+					std::chrono::duration_cast<std::chrono::microseconds>(deadline - now).count());
+			}
+		}
+
+		if (usec == UINT32_MAX) {
+			wait_lock(cond);
+			ret = true;
+		} else {
+			ret = wait_timeout_lock(usec, cond);
+		}
+
+		if (stats)
+			stats->add(ret ? nnpiWaitStats::BLOCK : nnpiWaitStats::TIMEOUT);
+
+		return ret;
+	}
+
 	inline void lock()
 	{
 		m_mutex.lock();
@@ -79,10 +248,124 @@ public:
 	inline void unlock_notify()
 	{
 		m_mutex.unlock();
-		m_cv.notify_all();
+		if (!defer_notify())
+			m_cv.notify_all();
 	}
 
 private:
+	struct nnpiThreadWaitPolicy {
+		bool           set;
+		nnpiWaitPolicy policy;
+	};
+
+	static inline nnpiThreadWaitPolicy &thread_policy()
+	{
+		static thread_local nnpiThreadWaitPolicy s_policy;
+
+		return s_policy;
+	}
+
+	template <class Pred>
+	inline bool try_lock_cond(Pred cond)
+	{
+		if (!m_mutex.try_lock())
+			return false;
+		if (cond())
+			return true;
+		m_mutex.unlock();
+		return false;
+	}
+
+	static inline nnpiNotifyBatch &notify_batch()
+	{
+		static thread_local nnpiNotifyBatch s_batch;
+
+		return s_batch;
+	}
+
+	inline bool defer_notify()
+	{
+		nnpiNotifyBatch &batch = notify_batch();
+
+		if (batch.depth == 0)
+			return false;
+
+		for (uint32_t i = 0; i < batch.num; ++i)
+			if (batch.waitq[i] == this)
+				return true;
+
+		if (batch.num >= NNPI_NOTIFY_BATCH_MAX)
+			return false;
+
+		batch.waitq[batch.num++] = this;
+		return true;
+	}
+
 	std::mutex m_mutex;
 	std::condition_variable m_cv;
 };
+
+/*
+ * Lock granted in priority order.
+ * A waiter is granted the lock only when no waiter of a higher
+ * priority is pending, waiters of the same priority are woken
+ * together and race for it.
+ */
+class nnpiPriorityLock {
+public:
+	static const uint8_t MAX_PRIORITY = 3;
+
+	nnpiPriorityLock() :
+		m_busy(false)
+	{
+		for (unsigned int i = 0; i <= MAX_PRIORITY; ++i)
+			m_waiting[i] = 0;
+	}
+
+	/* returns the time, in microseconds, spent waiting for the lock */
+	uint64_t lock(uint8_t priority)
+	{
+		std::chrono::steady_clock::time_point start;
+
+		if (priority > MAX_PRIORITY)
+			priority = MAX_PRIORITY;
+
+		m_waitq.lock();
+		if (can_lock(priority)) {
+			m_busy = true;
+			m_waitq.unlock();
+			return 0;
+		}
+		++m_waiting[priority];
+		m_waitq.unlock();
+
+		start = std::chrono::steady_clock::now();
+		m_waitq.wait_lock([this, priority] { return can_lock(priority); });
+		--m_waiting[priority];
+		m_busy = true;
+		m_waitq.unlock();
+
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - start).count() + 1;
+	}
+
+	void unlock()
+	{
+		m_waitq.update_and_notify([this] { m_busy = false; });
+	}
+
+private:
+	bool can_lock(uint8_t priority) const
+	{
+		if (m_busy)
+			return false;
+		for (unsigned int i = priority + 1; i <= MAX_PRIORITY; ++i)
+			if (m_waiting[i] > 0)
+				return false;
+		return true;
+	}
+
+	nnpiWaitQueue m_waitq;
+	bool          m_busy;
+	uint32_t      m_waiting[MAX_PRIORITY + 1];
+};
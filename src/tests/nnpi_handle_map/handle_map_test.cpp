@@ -0,0 +1,180 @@
+/*******************************************
+ * Copyright (C) 2017-2020 Intel Corporation
+ * SPDX-License-Identifier: Apache-2.0
+ *******************************************/
+
+/**
+ * @brief Handle map test
+ * @file handle_map_test.cpp
+ *
+ * Checks that nnpiHandleMap rejects handles of another map and stale
+ * handles of removed objects, and that find() run concurrently with
+ * makeHandle() and remove() never resolves a handle to another object
+ * and never sees an object after its remove() returned.
+ */
+
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "nnpiHandleMap.h"
+
+#define CHECK(cond) \
+{ \
+	if (!(cond)) { \
+		fprintf(stderr, "Check failed on line %d: %s\n", __LINE__, #cond); \
+		return -1; \
+	} \
+}
+
+static std::atomic<int> s_live_objs(0);
+
+struct TestObj {
+	TestObj() : hdl(0) { s_live_objs++; }
+	~TestObj() { s_live_objs--; }
+
+	std::atomic<uint64_t> hdl; /* set once the handle is known */
+};
+
+typedef nnpiHandleMap<TestObj, uint64_t> TestMap;
+
+static int test_tags(void)
+{
+	TestMap a(NNPI_HANDLE_TAG_CONTEXT);
+	TestMap b(NNPI_HANDLE_TAG_COPY);
+	std::shared_ptr<TestObj> obj(new TestObj());
+	uint64_t ha, hb, h;
+
+	ha = a.makeHandle(obj);
+	hb = b.makeHandle(obj);
+	CHECK(ha != 0 && hb != 0);
+	CHECK(ha != hb);
+
+	/* a handle is resolved by its own map only */
+	CHECK(a.find(ha).get() == obj.get());
+	CHECK(b.find(ha).get() == nullptr);
+	CHECK(a.find(hb).get() == nullptr);
+	CHECK(!b.remove(ha));
+	CHECK(!a.remove(hb));
+	CHECK(a.find(ha).get() == obj.get());
+	CHECK(b.find(hb).get() == obj.get());
+
+	CHECK(a.get_first(h));
+	CHECK(h == ha);
+
+	CHECK(a.find(0).get() == nullptr);
+	CHECK(a.find(~0ULL).get() == nullptr);
+	CHECK(a.makeHandle(std::shared_ptr<TestObj>()) == 0);
+
+	CHECK(a.remove(ha));
+	CHECK(b.remove(hb));
+	CHECK(!a.get_first(h));
+
+	return 0;
+}
+
+static int test_stale(void)
+{
+	TestMap map(NNPI_HANDLE_TAG_INFREQ);
+	std::shared_ptr<TestObj> obj1(new TestObj());
+	std::shared_ptr<TestObj> obj2(new TestObj());
+	uint64_t h1, h2;
+
+	h1 = map.makeHandle(obj1);
+	CHECK(map.remove(h1));
+	CHECK(!map.remove(h1));
+
+	/* the slot is reused with a new generation */
+	h2 = map.makeHandle(obj2);
+	CHECK(h2 != h1);
+	CHECK((h2 & 0xffffffff) == (h1 & 0xffffffff));
+	CHECK(map.find(h1).get() == nullptr);
+	CHECK(map.find(h2).get() == obj2.get());
+	CHECK(!map.remove(h1));
+	CHECK(map.find(h2).get() == obj2.get());
+
+	/* cleared handles are stale as well */
+	map.clear();
+	CHECK(map.find(h2).get() == nullptr);
+	CHECK(!map.remove(h2));
+
+	h1 = map.makeHandle(obj1);
+	map.fork_child_clear();
+	CHECK(map.find(h1).get() == nullptr);
+
+	return 0;
+}
+
+static int test_concurrent(void)
+{
+	const unsigned int NUM_READERS = 4;
+	const unsigned int NUM_SLOTS = 64;
+	const unsigned int NUM_ROUNDS = 20000;
+	TestMap map(NNPI_HANDLE_TAG_CMDLIST);
+	std::atomic<uint64_t> published[NUM_SLOTS];
+	std::atomic<bool> stop(false);
+	std::atomic<unsigned int> errors(0);
+	std::vector<std::thread> readers;
+
+	for (unsigned int i = 0; i < NUM_SLOTS; ++i)
+		published[i] = 0;
+
+	for (unsigned int r = 0; r < NUM_READERS; ++r) {
+		readers.push_back(std::thread([&map, &published, &stop, &errors] {
+			while (!stop.load()) {
+				for (unsigned int i = 0; i < NUM_SLOTS; ++i) {
+					uint64_t h = published[i].load();
+					std::shared_ptr<TestObj> obj;
+
+					if (h == 0)
+						continue;
+					obj = map.find(h);
+					if (obj.get() && obj->hdl.load() != h)
+						errors++;
+				}
+			}
+		}));
+	}
+
+	for (unsigned int round = 0; round < NUM_ROUNDS && errors.load() == 0; ++round) {
+		unsigned int i = round % NUM_SLOTS;
+		uint64_t old = published[i].exchange(0);
+
+		/* no reader may find the object once remove returned */
+		if (old != 0 && (!map.remove(old) || map.find(old).get() != nullptr))
+			errors++;
+
+		std::shared_ptr<TestObj> obj(new TestObj());
+		uint64_t h = map.makeHandle(obj);
+
+		if (h == 0)
+			errors++;
+		obj->hdl = h;
+		published[i] = h;
+	}
+
+	stop = true;
+	for (auto t = readers.begin(); t != readers.end(); ++t)
+		t->join();
+
+	CHECK(errors.load() == 0);
+
+	map.clear();
+	CHECK(s_live_objs.load() == 0);
+
+	return 0;
+}
+
+int main(void)
+{
+	if (test_tags() != 0 ||
+	    test_stale() != 0 ||
+	    test_concurrent() != 0)
+		return 1;
+
+	CHECK(s_live_objs.load() == 0);
+
+	printf("handle_map_test passed\n");
+
+	return 0;
+}
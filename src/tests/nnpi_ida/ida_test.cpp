@@ -0,0 +1,217 @@
+/*******************************************
+ * Copyright (C) 2017-2020 Intel Corporation
+ * SPDX-License-Identifier: Apache-2.0
+ *******************************************/
+
+/**
+ * @brief Protocol ID allocator test
+ * @file ida_test.cpp
+ *
+ * Checks nnpiIDA single and range allocations against a reference set
+ * of free IDs, with capacities ending on and right after the bitmap
+ * word and level boundaries.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <set>
+#include "nnpiUtils.h"
+
+#define CHECK(cond) \
+{ \
+	if (!(cond)) { \
+		fprintf(stderr, "Check failed on line %d: %s\n", __LINE__, #cond); \
+		return -1; \
+	} \
+}
+
+/* allocates the whole ID space, lowest ID first, then expects failure */
+static int test_fill(uint32_t capacity)
+{
+	nnpiIDA ida(capacity - 1);
+	NNPIdUsage usage;
+	uint32_t id;
+
+	for (uint32_t i = 0; i < capacity; ++i) {
+		CHECK(ida.alloc(id) == 0);
+		CHECK(id == i);
+	}
+	CHECK(ida.alloc(id) != 0);
+	CHECK(ida.get_num_alloc() == capacity);
+
+	/* IDs at the word and level boundaries are found again */
+	for (uint32_t b = 64; b <= capacity; b *= 64) {
+		ida.free(b - 1);
+		if (b < capacity)
+			ida.free(b);
+	}
+	for (uint32_t b = 64; b <= capacity; b *= 64) {
+		CHECK(ida.alloc(id) == 0);
+		CHECK(id == b - 1);
+		if (b < capacity) {
+			CHECK(ida.alloc(id) == 0);
+			CHECK(id == b);
+		}
+	}
+	CHECK(ida.alloc(id) != 0);
+
+	ida.free(capacity - 1);
+	CHECK(ida.alloc(id) == 0);
+	CHECK(id == capacity - 1);
+
+	/* freeing an already free or out of range ID is ignored */
+	ida.free(0);
+	ida.free(0);
+	ida.free(capacity);
+	CHECK(ida.get_num_alloc() == capacity - 1);
+
+	ida.get_usage(&usage);
+	CHECK(usage.allocated == capacity - 1);
+	CHECK(usage.maxAllocated == capacity);
+	CHECK(usage.capacity == capacity);
+
+	return 0;
+}
+
+static int test_range(void)
+{
+	nnpiIDA ida(199);
+	uint32_t id, first;
+
+	for (uint32_t i = 0; i < 60; ++i)
+		CHECK(ida.alloc(id) == 0);
+
+	/* crosses the first word boundary */
+	CHECK(ida.alloc_range(10, first) == 0);
+	CHECK(first == 60);
+
+	/* a hole too small for the range is skipped */
+	ida.free(10);
+	ida.free(11);
+	CHECK(ida.alloc_range(3, first) == 0);
+	CHECK(first == 70);
+	CHECK(ida.alloc_range(2, first) == 0);
+	CHECK(first == 10);
+
+	/* the last range fits exactly at the end */
+	CHECK(ida.alloc_range(127, first) == 0);
+	CHECK(first == 73);
+	CHECK(ida.alloc(id) != 0);
+	CHECK(ida.get_num_alloc() == 200);
+
+	ida.free_range(60, 13);
+	CHECK(ida.get_num_alloc() == 187);
+	CHECK(ida.alloc_range(14, first) != 0);
+	CHECK(ida.alloc_range(13, first) == 0);
+	CHECK(first == 60);
+
+	/* only allocated IDs of a freed range are counted */
+	ida.free_range(190, 5);
+	ida.free_range(185, 10);
+	CHECK(ida.get_num_alloc() == 190);
+	ida.free_range(195, 100);
+	CHECK(ida.get_num_alloc() == 185);
+
+	CHECK(ida.alloc_range(0, first) != 0);
+	CHECK(ida.alloc_range(201, first) != 0);
+
+	return 0;
+}
+
+/* random allocations checked against the lowest free IDs of a reference set */
+static int test_random(uint32_t capacity, uint32_t num_ops)
+{
+	nnpiIDA ida(capacity - 1);
+	std::set<uint32_t> free_ids;
+	std::set<uint32_t> used_ids;
+	uint32_t id, first;
+
+	for (uint32_t i = 0; i < capacity; ++i)
+		free_ids.insert(i);
+
+	srand(1);
+	for (uint32_t op = 0; op < num_ops; ++op) {
+		uint32_t r = rand() % 8;
+
+		if (r < 3) {
+			int ret = ida.alloc(id);
+
+			CHECK((ret == 0) == !free_ids.empty());
+			if (ret == 0) {
+				CHECK(id == *free_ids.begin());
+				free_ids.erase(id);
+				used_ids.insert(id);
+			}
+		} else if (r < 5) {
+			uint32_t count = 1 + rand() % 100;
+			uint32_t expected = UINT32_MAX;
+			uint32_t run = 0, prev = 0;
+
+			for (auto it = free_ids.begin(); it != free_ids.end(); ++it) {
+				run = (run > 0 && *it == prev + 1) ? run + 1 : 1;
+				prev = *it;
+				if (run == count) {
+					expected = *it + 1 - count;
+					break;
+				}
+			}
+
+			int ret = ida.alloc_range(count, first);
+
+			CHECK((ret == 0) == (expected != UINT32_MAX));
+			if (ret == 0) {
+				CHECK(first == expected);
+				for (uint32_t i = first; i < first + count; ++i) {
+					free_ids.erase(i);
+					used_ids.insert(i);
+				}
+			}
+		} else if (r < 7) {
+			if (used_ids.empty())
+				continue;
+			auto it = used_ids.lower_bound(rand() % capacity);
+			if (it == used_ids.end())
+				it = used_ids.begin();
+			id = *it;
+			ida.free(id);
+			used_ids.erase(it);
+			free_ids.insert(id);
+		} else {
+			uint32_t count = 1 + rand() % 200;
+
+			first = rand() % capacity;
+			ida.free_range(first, count);
+			for (uint32_t i = first; i < first + count && i < capacity; ++i) {
+				used_ids.erase(i);
+				free_ids.insert(i);
+			}
+		}
+
+		CHECK(ida.get_num_alloc() == used_ids.size());
+	}
+
+	return 0;
+}
+
+int main(void)
+{
+	/* one word, two words, one full level 1 word, three levels */
+	static const uint32_t capacities[] = { 1, 64, 65, 64 * 64, 64 * 64 + 1, 64 * 64 * 64 };
+
+	for (unsigned int i = 0; i < sizeof(capacities) / sizeof(capacities[0]); ++i) {
+		if (test_fill(capacities[i]) != 0) {
+			fprintf(stderr, "fill test failed with capacity %u\n", capacities[i]);
+			return 1;
+		}
+	}
+
+	if (test_range() != 0)
+		return 1;
+
+	if (test_random(5000, 20000) != 0)
+		return 1;
+
+	printf("ida_test passed\n");
+
+	return 0;
+}
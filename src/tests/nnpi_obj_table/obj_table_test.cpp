@@ -0,0 +1,162 @@
+/*******************************************
+ * Copyright (C) 2017-2020 Intel Corporation
+ * SPDX-License-Identifier: Apache-2.0
+ *******************************************/
+
+/**
+ * @brief Context object table test
+ * @file obj_table_test.cpp
+ *
+ * Checks nnpiObjTable insert, replace, remove and clear at the radix
+ * tree node boundaries of two and three level tables, and that get()
+ * run concurrently with insert() and remove() only returns the object
+ * inserted under the requested ID and never one whose remove() returned.
+ */
+
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "nnpiObjTable.h"
+
+#define CHECK(cond) \
+{ \
+	if (!(cond)) { \
+		fprintf(stderr, "Check failed on line %d: %s\n", __LINE__, #cond); \
+		return -1; \
+	} \
+}
+
+static std::atomic<int> s_live_objs(0);
+
+struct TestObj {
+	explicit TestObj(uint32_t obj_id) : id(obj_id) { s_live_objs++; }
+	~TestObj() { s_live_objs--; }
+
+	const uint32_t id;
+};
+
+typedef std::shared_ptr<TestObj> TestObjPtr;
+
+template <unsigned int BITS>
+static int test_basic(void)
+{
+	nnpiObjTable<TestObj, BITS> table;
+	const uint32_t max_id = (uint32_t)((1ULL << BITS) - 1);
+	const uint32_t ids[] = { 0, 1, 255, 256, 257, 65535, max_id - 256, max_id };
+	const unsigned int num_ids = sizeof(ids) / sizeof(ids[0]);
+	int count;
+
+	for (unsigned int i = 0; i < num_ids; ++i)
+		table.insert(ids[i], TestObjPtr(new TestObj(ids[i])));
+
+	for (unsigned int i = 0; i < num_ids; ++i) {
+		TestObjPtr obj = table.get(ids[i]);
+
+		CHECK(obj.get() != nullptr);
+		CHECK(obj->id == ids[i]);
+	}
+
+	/* a free slot of an allocated leaf and an ID of a missing subtree */
+	CHECK(table.get(2).get() == nullptr);
+	CHECK(table.get(max_id - 1).get() == nullptr);
+	CHECK(table.get(1U << (BITS - 1)).get() == nullptr);
+
+	count = 0;
+	table.for_each([&count](const TestObjPtr &obj) {
+		if (obj.get())
+			count++;
+	});
+	CHECK(count == s_live_objs.load());
+
+	/* replacing releases the old object */
+	int live = s_live_objs.load();
+	table.insert(256, TestObjPtr(new TestObj(256)));
+	CHECK(s_live_objs.load() == live);
+
+	/* inserting no object leaves the slot empty */
+	table.insert(257, TestObjPtr());
+	CHECK(table.get(257).get() == nullptr);
+	CHECK(s_live_objs.load() == live - 1);
+
+	table.remove(255);
+	CHECK(table.get(255).get() == nullptr);
+	CHECK(table.get(256).get() != nullptr);
+	CHECK(s_live_objs.load() == live - 2);
+	table.remove(255);
+	table.remove(2);
+	table.remove(1U << (BITS - 1));
+
+	table.clear();
+	CHECK(s_live_objs.load() == 0);
+	for (unsigned int i = 0; i < num_ids; ++i)
+		CHECK(table.get(ids[i]).get() == nullptr);
+
+	/* slots are reused after clear */
+	table.insert(max_id, TestObjPtr(new TestObj(max_id)));
+	CHECK(table.get(max_id).get() != nullptr);
+
+	return 0;
+}
+
+static int test_concurrent(void)
+{
+	const unsigned int NUM_READERS = 4;
+	const uint32_t NUM_IDS = 600; /* spans three leaves */
+	const unsigned int NUM_ROUNDS = 50000;
+	nnpiObjTable<TestObj, 16> table;
+	std::atomic<bool> stop(false);
+	std::atomic<unsigned int> errors(0);
+	std::vector<std::thread> readers;
+
+	for (unsigned int r = 0; r < NUM_READERS; ++r) {
+		readers.push_back(std::thread([&table, &stop, &errors] {
+			while (!stop.load()) {
+				for (uint32_t id = 0; id < NUM_IDS; ++id) {
+					TestObjPtr obj = table.get(id);
+
+					if (obj.get() && obj->id != id)
+						errors++;
+				}
+			}
+		}));
+	}
+
+	for (unsigned int round = 0; round < NUM_ROUNDS && errors.load() == 0; ++round) {
+		uint32_t id = (round * 7) % NUM_IDS;
+
+		if (round % 3 == 0) {
+			table.remove(id);
+			/* no reader may get the object once remove returned */
+			if (table.get(id).get() != nullptr)
+				errors++;
+		} else {
+			table.insert(id, TestObjPtr(new TestObj(id)));
+		}
+	}
+
+	stop = true;
+	for (auto t = readers.begin(); t != readers.end(); ++t)
+		t->join();
+
+	CHECK(errors.load() == 0);
+
+	table.clear();
+	CHECK(s_live_objs.load() == 0);
+
+	return 0;
+}
+
+int main(void)
+{
+	if (test_basic<16>() != 0 ||
+	    test_basic<24>() != 0 ||
+	    test_concurrent() != 0)
+		return 1;
+
+	CHECK(s_live_objs.load() == 0);
+
+	printf("obj_table_test passed\n");
+
+	return 0;
+}